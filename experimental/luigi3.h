@@ -22,6 +22,7 @@
 
 #ifdef UI_SSE2
 #include <xmmintrin.h>
+#include <emmintrin.h>
 #endif
 
 #ifdef UI_AVX512
@@ -254,18 +255,17 @@ typedef struct UIFont {
 #ifdef UI_FREETYPE
 	bool isFreeType;
 	FT_Face font;
-#ifdef UI_UNICODE
-	FT_Bitmap *glyphs;
-	bool *glyphsRendered;
-	int *glyphOffsetsX, *glyphOffsetsY, *glyphAdvance;
-#else
-	FT_Bitmap glyphs[128];
-	bool glyphsRendered[128];
-	int glyphOffsetsX[128], glyphOffsetsY[128];
-#endif
+	uint32_t size; // Rendered glyphs are cached by (font, code point, size); see UIGlyphCacheSetBudget.
 #endif
 } UIFont;
 
+#ifdef UI_FREETYPE
+typedef struct UIGlyphCacheStatistics {
+	size_t bytes, glyphs; // Currently cached.
+	uint64_t hits, misses, evictions;
+} UIGlyphCacheStatistics;
+#endif
+
 typedef struct UIShortcut {
 	intptr_t code;
 	bool ctrl, shift, alt;
@@ -842,6 +842,11 @@ char *UIStringCopy(const char *in, ptrdiff_t inBytes);
 UIFont *UIFontCreate(const char *cPath, uint32_t size);
 UIFont *UIFontActivate(UIFont *font); // Returns the previously active font.
 
+#ifdef UI_FREETYPE
+void UIGlyphCacheSetBudget(size_t maximumBytes); // Glyphs shared by all fonts; the least recently drawn are evicted past this.
+UIGlyphCacheStatistics UIGlyphCacheGetStatistics();
+#endif
+
 #ifdef UI_DEBUG
 void UIInspectorLog(const char *cFormat, ...);
 #endif
@@ -861,9 +866,38 @@ ptrdiff_t _UIStringLength(const char *cString) {
 
 #define _UNICODE_MAX_CODEPOINT 0x10FFFF
 
+ptrdiff_t _UIUtf8AsciiPrefix(const char *cString, ptrdiff_t bytes) {
+	// Count the leading bytes below 0x80, checking a block at a time until one contains a multi-byte sequence.
+	ptrdiff_t i = 0;
+
+#ifdef UI_SSE2
+	while (i + 16 <= bytes && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (cString + i)))) {
+		i += 16;
+	}
+#else
+	while (i + 8 <= bytes) {
+		uint64_t word = 0;
+		for (int j = 0; j < 8; j++) word |= (uint64_t) (uint8_t) cString[i + j] << (j * 8);
+		if (word & 0x8080808080808080ULL) break;
+		i += 8;
+	}
+#endif
+
+	while (i < bytes && (uint8_t) cString[i] < 0x80) {
+		i++;
+	}
+
+	return i;
+}
+
 int Utf8GetCodePoint(const char *cString, ptrdiff_t bytesLength, ptrdiff_t *bytesConsumed) {
 	UI_ASSERT(bytesLength > 0 && "Attempted to get UTF-8 code point from an empty string");
 
+	if ((uint8_t) (cString[0] - 1) < 0x7F) {
+		if (bytesConsumed) *bytesConsumed = 1;
+		return cString[0];
+	}
+
 	if (bytesConsumed == NULL) {
 		ptrdiff_t bytesConsumed;
 		return Utf8GetCodePoint(cString, bytesLength, &bytesConsumed);
@@ -941,6 +975,11 @@ ptrdiff_t Utf8StringLength(const char *cString, ptrdiff_t bytes) {
 	ptrdiff_t length = 0;
 	ptrdiff_t byteIndex = 0;
 	while (byteIndex < bytes) {
+		ptrdiff_t ascii = _UIUtf8AsciiPrefix(cString + byteIndex, bytes - byteIndex);
+		length += ascii;
+		byteIndex += ascii;
+		if (byteIndex == bytes) break;
+
 		ptrdiff_t bytesConsumed;
 		Utf8GetCodePoint(cString+ byteIndex, bytes - byteIndex, &bytesConsumed);
 		byteIndex += bytesConsumed;
@@ -1060,6 +1099,9 @@ struct {
 
 #ifdef UI_FREETYPE
 	FT_Library ft;
+	struct _UIGlyph **glyphSlots, *glyphsNewest, *glyphsOldest;
+	size_t glyphSlotCount, glyphCacheBudget;
+	UIGlyphCacheStatistics glyphCache;
 #endif
 } ui;
 
@@ -1626,6 +1668,9 @@ void UIDrawString(UIPainter *painter, UIRectangle r, const char *string, ptrdiff
 	int x = align == UI_ALIGN_CENTER ? ((r.l + r.r - width) / 2) : align == UI_ALIGN_RIGHT ? (r.r - width) : r.l;
 	int y = (r.t + r.b - height) / 2;
 	int i = 0, j = 0;
+#ifdef UI_UNICODE
+	int asciiEnd = 0;
+#endif
 
 	int selectFrom = -1, selectTo = -1;
 
@@ -1641,7 +1686,8 @@ void UIDrawString(UIPainter *painter, UIRectangle r, const char *string, ptrdiff
 	while (j < bytes) {
 		ptrdiff_t bytesConsumed = 1;
 #ifdef UI_UNICODE
-		int c = Utf8GetCodePoint(string, bytes - j, &bytesConsumed);
+		if (j >= asciiEnd) asciiEnd = j + _UIUtf8AsciiPrefix(string, bytes - j);
+		int c = j < asciiEnd && *string ? *string : Utf8GetCodePoint(string, bytes - j, &bytesConsumed);
 		UI_ASSERT(bytesConsumed > 0);
 		string += bytesConsumed;
 #else
@@ -5218,22 +5264,125 @@ const uint64_t _uiFont[] = {
 	0x1800181818180000UL, 0x0000000018181818UL, 0x18701818180E0000UL, 0x000000000E181818UL, 0x000000003B6E0000UL, 0x0000000000000000UL, 0x63361C0800000000UL, 0x00000000007F6363UL,
 };
 
-void UIEnsureGlyphRendered(UIFont *font, int c) {
-	if (!font->glyphsRendered[c]) {
-		FT_Load_Char(font->font, c == 24 ? 0x2191 : c == 25 ? 0x2193 : c == 26 ? 0x2192 : c == 27 ? 0x2190 : c, FT_LOAD_DEFAULT);
+#ifdef UI_FREETYPE
+typedef struct _UIGlyph {
+	struct _UIGlyph *hashNext, *newer, *older;
+	UIFont *font;
+	uint32_t codePoint, size, hash;
+	int offsetX, offsetY;
+	size_t bytes; // Including this header.
+	FT_Bitmap bitmap;
+} _UIGlyph;
+
+uint32_t _UIGlyphHash(UIFont *font, uint32_t codePoint, uint32_t size) {
+	uint64_t key = (uint64_t) (uintptr_t) font ^ ((uint64_t) size << 40) ^ ((uint64_t) codePoint << 8);
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (uint32_t) (key >> 32);
+}
+
+void _UIGlyphUnlink(_UIGlyph *glyph) {
+	if (glyph->newer) glyph->newer->older = glyph->older; else ui.glyphsNewest = glyph->older;
+	if (glyph->older) glyph->older->newer = glyph->newer; else ui.glyphsOldest = glyph->newer;
+	glyph->newer = glyph->older = NULL;
+}
+
+void _UIGlyphLinkNewest(_UIGlyph *glyph) {
+	glyph->older = ui.glyphsNewest;
+	if (ui.glyphsNewest) ui.glyphsNewest->newer = glyph; else ui.glyphsOldest = glyph;
+	ui.glyphsNewest = glyph;
+}
+
+void _UIGlyphEvict(_UIGlyph *glyph) {
+	_UIGlyph **link = &ui.glyphSlots[glyph->hash & (ui.glyphSlotCount - 1)];
+	while (*link != glyph) link = &(*link)->hashNext;
+	*link = glyph->hashNext;
+	_UIGlyphUnlink(glyph);
+	ui.glyphCache.bytes -= glyph->bytes;
+	ui.glyphCache.glyphs--;
+	FT_Bitmap_Done(ui.ft, &glyph->bitmap);
+	UI_FREE(glyph);
+}
+
+void _UIGlyphCacheTrim(_UIGlyph *keep) {
+	while (ui.glyphCacheBudget && ui.glyphCache.bytes > ui.glyphCacheBudget 
+			&& ui.glyphsOldest && ui.glyphsOldest != keep) {
+		_UIGlyphEvict(ui.glyphsOldest);
+		ui.glyphCache.evictions++;
+	}
+}
+
+void _UIGlyphCacheGrow() {
+	size_t slotCount = ui.glyphSlotCount ? ui.glyphSlotCount * 2 : 256;
+	_UIGlyph **slots = (_UIGlyph **) UI_CALLOC(sizeof(_UIGlyph *) * slotCount);
+
+	for (_UIGlyph *glyph = ui.glyphsOldest; glyph; glyph = glyph->newer) {
+		_UIGlyph **slot = &slots[glyph->hash & (slotCount - 1)];
+		glyph->hashNext = *slot;
+		*slot = glyph;
+	}
+
+	UI_FREE(ui.glyphSlots);
+	ui.glyphSlots = slots;
+	ui.glyphSlotCount = slotCount;
+}
+
+_UIGlyph *_UIGlyphLookup(UIFont *font, uint32_t codePoint) {
+	uint32_t hash = _UIGlyphHash(font, codePoint, font->size);
+
+	for (_UIGlyph *glyph = ui.glyphSlotCount ? ui.glyphSlots[hash & (ui.glyphSlotCount - 1)] : NULL; glyph; glyph = glyph->hashNext) {
+		if (glyph->font == font && glyph->codePoint == codePoint && glyph->size == font->size) {
+			ui.glyphCache.hits++;
+
+			if (glyph != ui.glyphsNewest) {
+				_UIGlyphUnlink(glyph);
+				_UIGlyphLinkNewest(glyph);
+			}
+
+			return glyph;
+		}
+	}
+
+	ui.glyphCache.misses++;
+
+	uint32_t c = codePoint;
+	FT_Load_Char(font->font, c == 24 ? 0x2191 : c == 25 ? 0x2193 : c == 26 ? 0x2192 : c == 27 ? 0x2190 : c, FT_LOAD_DEFAULT);
 #ifdef UI_FREETYPE_SUBPIXEL
-		FT_Render_Glyph(font->font->glyph, FT_RENDER_MODE_LCD);
+	FT_Render_Glyph(font->font->glyph, FT_RENDER_MODE_LCD);
 #else
-		FT_Render_Glyph(font->font->glyph, FT_RENDER_MODE_NORMAL);
+	FT_Render_Glyph(font->font->glyph, FT_RENDER_MODE_NORMAL);
 #endif
-		FT_Bitmap_Copy(ui.ft, &font->font->glyph->bitmap, &font->glyphs[c]);
-		font->glyphOffsetsX[c] = font->font->glyph->bitmap_left;
-		font->glyphOffsetsY[c] = font->font->size->metrics.ascender / 64 - font->font->glyph->bitmap_top;
-		font->glyphAdvance[c] = font->font->glyph->advance.x / 64;
-		font->glyphsRendered[c] = true;
-	}
+
+	_UIGlyph *glyph = (_UIGlyph *) UI_CALLOC(sizeof(_UIGlyph));
+	glyph->font = font;
+	glyph->codePoint = codePoint;
+	glyph->size = font->size;
+	glyph->hash = hash;
+	FT_Bitmap_Copy(ui.ft, &font->font->glyph->bitmap, &glyph->bitmap);
+	glyph->offsetX = font->font->glyph->bitmap_left;
+	glyph->offsetY = font->font->size->metrics.ascender / 64 - font->font->glyph->bitmap_top;
+	glyph->bytes = sizeof(_UIGlyph) + glyph->bitmap.rows * (size_t) (glyph->bitmap.pitch < 0 ? -glyph->bitmap.pitch : glyph->bitmap.pitch);
+
+	if (ui.glyphCache.glyphs >= ui.glyphSlotCount) _UIGlyphCacheGrow();
+	_UIGlyph **slot = &ui.glyphSlots[hash & (ui.glyphSlotCount - 1)];
+	glyph->hashNext = *slot;
+	*slot = glyph;
+	_UIGlyphLinkNewest(glyph);
+	ui.glyphCache.bytes += glyph->bytes;
+	ui.glyphCache.glyphs++;
+	_UIGlyphCacheTrim(glyph);
+	return glyph;
 }
 
+void UIGlyphCacheSetBudget(size_t maximumBytes) {
+	ui.glyphCacheBudget = maximumBytes;
+	_UIGlyphCacheTrim(NULL);
+}
+
+UIGlyphCacheStatistics UIGlyphCacheGetStatistics() {
+	return ui.glyphCache;
+}
+#endif
+
 void UIDrawGlyph(UIPainter *painter, int x0, int y0, int c, uint32_t color) {
 #ifdef UI_FREETYPE
 	UIFont *font = ui.activeFont;
@@ -5249,17 +5398,12 @@ void UIDrawGlyph(UIPainter *painter, int x0, int y0, int c, uint32_t color) {
 #endif
 
 	if (font->isFreeType) {
-#ifdef UI_UNICODE
-		if (c < 0) c = '?';
-#else
-		if (c < 0 || c > 127) c = '?';
-#endif
+		if (c < 0 || c > 0x10FFFF) c = '?';
 		if (c == '\r') c = ' ';
 
-		UIEnsureGlyphRendered(font, c);
-
-		FT_Bitmap *bitmap = &font->glyphs[c];
-		x0 += font->glyphOffsetsX[c], y0 += font->glyphOffsetsY[c];
+		_UIGlyph *glyph = _UIGlyphLookup(font, c);
+		FT_Bitmap *bitmap = &glyph->bitmap;
+		x0 += glyph->offsetX, y0 += glyph->offsetY;
 
 		for (int y = 0; y < (int) bitmap->rows; y++) {
 			if (y0 + y < painter->clip.t) continue;
@@ -5334,18 +5478,14 @@ void UIDrawGlyph(UIPainter *painter, int x0, int y0, int c, uint32_t color) {
 }
 
 void UIFontDestroy(UIFont *font) {
-	for (uintptr_t i = 0; i < _UNICODE_MAX_CODEPOINT; i++) {
-		if (font->glyphsRendered[i]) {
-			FT_Bitmap_Done(ui.ft, &font->glyphs[i]);
-		}
+#ifdef UI_FREETYPE
+	for (_UIGlyph *glyph = ui.glyphsOldest, *next; glyph; glyph = next) {
+		next = glyph->newer;
+		if (glyph->font == font) _UIGlyphEvict(glyph);
 	}
 
-	FT_Done_Face(font->font);
-	UI_FREE(font->glyphs);
-	UI_FREE(font->glyphsRendered);
-	UI_FREE(font->glyphOffsetsX);
-	UI_FREE(font->glyphOffsetsY);
-	UI_FREE(font->glyphAdvance);
+	if (font->isFreeType) FT_Done_Face(font->font);
+#endif
 	UI_FREE(font);
 }
 
@@ -5353,13 +5493,6 @@ UIFont *UIFontCreate(const char *cPath, uint32_t size) {
 	UIFont *font = (UIFont *) UI_CALLOC(sizeof(UIFont));
 
 #ifdef UI_FREETYPE
-#ifdef UI_UNICODE
-	font->glyphs = (FT_Bitmap *) UI_CALLOC(sizeof(FT_Bitmap) * (_UNICODE_MAX_CODEPOINT + 1));
-	font->glyphsRendered = (bool *) UI_CALLOC(sizeof(bool) * (_UNICODE_MAX_CODEPOINT + 1));
-	font->glyphOffsetsX = (int *) UI_CALLOC(sizeof(int) * (_UNICODE_MAX_CODEPOINT + 1));
-	font->glyphOffsetsY = (int *) UI_CALLOC(sizeof(int) * (_UNICODE_MAX_CODEPOINT + 1));
-	font->glyphAdvance = (int *) UI_CALLOC(sizeof(int) * (_UNICODE_MAX_CODEPOINT + 1));
-#endif
 	if (cPath) {
 		int ret = FT_New_Face(ui.ft, cPath, 0, &font->font);
 		if (ret == 0) {
@@ -5380,6 +5513,8 @@ UIFont *UIFontCreate(const char *cPath, uint32_t size) {
 				FT_Set_Char_Size(font->font, 0, size * 64, 100, 100);
 			}
 
+			font->size = size;
+
 			FT_Load_Char(font->font, 'a', FT_LOAD_DEFAULT);
 			font->glyphWidth = font->font->glyph->advance.x / 64;
 			font->glyphHeight = (font->font->size->metrics.ascender - font->font->size->metrics.descender) / 64;
@@ -5637,6 +5772,7 @@ void _UIInitialiseCommon() {
 
 #ifdef UI_FREETYPE
 	FT_Init_FreeType(&ui.ft);
+	ui.glyphCacheBudget = 4 * 1024 * 1024;
 	UIFontActivate(UIFontCreate(_UI_TO_STRING_2(UI_FONT_PATH), 11));
 #else
 	UIFontActivate(UIFontCreate(0, 0));
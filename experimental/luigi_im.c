@@ -156,7 +156,9 @@ void Textbox(uintptr_t id, uint32_t flags, char *buffer, size_t bufferSpace) {
 	textbox->e.cp = (void *) id;
 	textbox->e.messageUser = ValueMessage;
 
-	if ((textbox->bytes != bytes || memcmp(textbox->string, buffer, bytes)) && &textbox->e != enumerateSource) {
+	char *string = UITextboxToCString(textbox);
+
+	if ((textbox->bytes != bytes || memcmp(string, buffer, bytes)) && &textbox->e != enumerateSource) {
 		UITextboxClear(textbox, false);
 		UITextboxReplace(textbox, buffer, -1, false);
 		UIElementRefresh(&textbox->e);
@@ -165,10 +167,12 @@ void Textbox(uintptr_t id, uint32_t flags, char *buffer, size_t bufferSpace) {
 	if (&textbox->e == enumerateSource) {
 		bytes = bufferSpace - 1;
 		if (textbox->bytes < bytes) bytes = textbox->bytes;
-		memcpy(buffer, textbox->string, bytes);
+		memcpy(buffer, string, bytes);
 		buffer[bytes] = 0;
 	}
 
+	UI_FREE(string);
+
 	if (!element) {
 		UIElementRefresh(textbox->e.parent);
 	}
@@ -1,4 +1,4 @@
-// TODO UITextbox features - mouse input, multi-line, clipboard, undo, IME support, number dragging.
+// TODO UITextbox features - mouse input, multi-line, clipboard, IME support, number dragging.
 // TODO New elements - list view, menu bar.
 // TODO Keyboard navigation - menus, dialogs, tables.
 // TODO Easier to use fonts; GDI font support.
@@ -16,6 +16,15 @@
 #include <X11/cursorfont.h>
 
 #include <xmmintrin.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+#ifdef UI_SSE2
+#include <emmintrin.h>
 #endif
 
 #define _UI_TO_STRING_1(x) #x
@@ -80,6 +89,13 @@ void _UIMessageProcess(EsMessage *message);
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include <freetype/ftbitmap.h>
+
+#ifdef UI_LINUX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #endif
 
 #define UI_SIZE_BUTTON_MINIMUM_WIDTH (100)
@@ -167,12 +183,19 @@ typedef enum UIMessage {
 
 	UI_MSG_VALUE_CHANGED, // sent to notify that the element's value has changed
 	UI_MSG_TABLE_GET_ITEM, // dp = pointer to UITableGetItem; return string length
+	UI_MSG_TABLE_GET_RANGE, // dp = pointer to UITableGetRange; return 1 if handled, or -(arena bytes needed) to retry with a larger arena
+	UI_MSG_TABLE_GET_SORT_KEYS, // dp = pointer to UITableGetSortKeys; return 1 if handled
+	UI_MSG_TABLE_FILTER, // di = item index; return 1 to hide the item
+	UI_MSG_TABLE_SORTED, // sent when a sort started by UITableSort has been applied
 	UI_MSG_CODE_GET_MARGIN_COLOR, // di = line index (starts at 1); return color
 	UI_MSG_CODE_DECORATE_LINE, // dp = pointer to UICodeDecorateLine
+	UI_MSG_CODE_SEARCH_PROGRESS, // sent when new search hits arrive; di = 1 if the search has finished
+	UI_MSG_CODE_WRAP_PROGRESS, // sent when more lines have been measured for wrapping; di = 1 if all have been
 	UI_MSG_WINDOW_CLOSE, // return 1 to prevent default (process exit for UIWindow; close for UIMDIChild)
 	UI_MSG_TAB_SELECTED, // sent to the tab that was selected (not the tab pane itself)
 	UI_MSG_WINDOW_DROP_FILES, // di = count, dp = char ** of paths
 	UI_MSG_WINDOW_ACTIVATE,
+	_UI_MSG_WORKER_BATCH, // internal; handled by the message loop and never sent to elements
 
 	UI_MSG_USER,
 } UIMessage;
@@ -191,6 +214,7 @@ typedef struct UITheme {
 	uint32_t buttonNormal, buttonHovered, buttonPressed, buttonDisabled;
 	uint32_t textboxNormal, textboxFocused;
 	uint32_t codeFocused, codeBackground, codeDefault, codeComment, codeString, codeNumber, codeOperator, codePreprocessor;
+	uint32_t codeSearchHit;
 } UITheme;
 
 typedef struct UIPainter {
@@ -207,13 +231,46 @@ typedef struct UIFont {
 
 #ifdef UI_FREETYPE
 	bool isFreeType;
-	FT_Face font;
-	FT_Bitmap glyphs[128];
-	bool glyphsRendered[128];
-	int glyphOffsetsX[128], glyphOffsetsY[128];
+	FT_Face font; // NULL until a glyph is needed that isn't in the on-disk cache.
+	uint32_t size; // Rendered glyphs are cached by (font, code point, size); see UIGlyphCacheSetBudget.
+	bool proportional; // Glyphs have their own advances and kerning. UICode still lays text out in columns of glyphWidth.
+
+	// Internals:
+	int16_t advances[128]; // -1 until measured.
+	int8_t *kerning; // 128x128 pairs, -128 until measured. NULL if the font has no kerning.
+	struct UIFont *next;
+	char *path;
+	struct _UIFontWarmUp *warmUp;
+	const struct _UIGlyphFileHeader *glyphFile;
+	size_t glyphFileBytes;
+	bool glyphFileDirty;
+	struct UIFont *base, *scaled, *scaledNext; // Copies of the font for windows with a different scale.
 #endif
 } UIFont;
 
+#ifdef UI_FREETYPE
+typedef struct UIGlyphCacheStatistics {
+	size_t bytes, glyphs, pages; // Currently cached. Glyphs are packed into atlas pages, which are evicted whole.
+	uint64_t hits, misses, evictions;
+	uint64_t fileLoads; // Misses that were read from the on-disk cache instead of rendered.
+} UIGlyphCacheStatistics;
+#endif
+
+#ifdef UI_LINUX
+typedef struct UIEpollDispatchPtr {
+	void (*fp)(struct UIEpollDispatchPtr *ptr);
+} UIEpollDispatchPtr;
+
+typedef struct UITimer {
+	void (*invoke)(void *cp);
+	void *cp;
+
+	// Internals:
+	UIEpollDispatchPtr dispatch;
+	int fd;
+} UITimer;
+#endif
+
 typedef struct UIShortcut {
 	intptr_t code;
 	bool ctrl, shift, alt;
@@ -237,8 +294,25 @@ typedef struct UITableGetItem {
 	size_t bufferBytes;
 	int index, column;
 	bool isSelected;
+	const char *string; // Instead of copying into buffer, set this to text you own; it must stay valid until the paint finishes.
 } UITableGetItem;
 
+typedef struct UITableGetRange {
+	int from, to; // Rows, end exclusive.
+	const int *items; // If not NULL, the item shown in each row, indexed by row - from; otherwise rows are items.
+	int columnFrom, columnTo; // Columns, end exclusive.
+	char *arena; // Scratch space to format the cells into; valid until the next request.
+	size_t arenaBytes;
+	const char **strings; // Set these; indexed by (row - from) * (columnTo - columnFrom) + (column - columnFrom).
+	ptrdiff_t *bytes;
+	bool *isSelected; // Indexed by row - from.
+} UITableGetRange;
+
+typedef struct UITableGetSortKeys {
+	int column, from, to; // Items, end exclusive.
+	uint64_t *keys; // Set these; indexed by item - from. Items are shown in ascending order of key.
+} UITableGetSortKeys;
+
 typedef struct UICodeDecorateLine {
 	UIRectangle bounds;
 	int index; // Starting at 1!
@@ -370,7 +444,7 @@ typedef struct UIWindow {
 	UIShortcut *shortcuts;
 	size_t shortcutCount, shortcutAllocated;
 
-	float scale;
+	float scale; // Also scales the size of FreeType fonts; each size has its own glyphs, shared by all windows at that scale.
 
 	uint32_t *bits;
 	int width, height;
@@ -487,21 +561,102 @@ typedef struct UIScrollBar {
 	bool inDrag, horizontal;
 } UIScrollBar;
 
+#define UI_LEXER_MAX_STATES (32)
+#define UI_LEXER_MAX_CLASSES (16)
+#define UI_LEXER_BACK (0x80) // OR into a transition to give the previous character the new state's color.
+
+#define UI_LEXER_COLOR_DEFAULT (0)
+#define UI_LEXER_COLOR_COMMENT (1)
+#define UI_LEXER_COLOR_STRING (2)
+#define UI_LEXER_COLOR_NUMBER (3)
+#define UI_LEXER_COLOR_OPERATOR (4)
+#define UI_LEXER_COLOR_PREPROCESSOR (5)
+
+#define UI_LEXER_EMPTY (0)
+#define UI_LEXER_C (1)
+#define UI_LEXER_JSON (2)
+
+typedef struct UILexer {
+	// Each line is lexed from state 0. Every character is colored by the state it moves the lexer into.
+	uint8_t classes[256]; // Character class of each byte.
+	uint8_t transitions[UI_LEXER_MAX_STATES][UI_LEXER_MAX_CLASSES]; // Next state, optionally with UI_LEXER_BACK.
+	uint8_t colors[UI_LEXER_MAX_STATES]; // UI_LEXER_COLOR_... constant.
+
+	// Internals, set by UILexerFinish:
+#define _UI_LEXER_RUN_IDENTIFIER (1 << 0)
+#define _UI_LEXER_RUN_SPACE (1 << 1)
+	uint8_t runs[UI_LEXER_MAX_STATES];
+} UILexer;
+
 typedef struct UICodeLine {
 	int offset, bytes;
 } UICodeLine;
 
+typedef struct UICodeSearch {
+#define UI_CODE_SEARCH_MATCH_CASE (1 << 0)
+#define UI_CODE_SEARCH_REGEX (1 << 1) // Supports . * ^ $ and \ escapes; matches do not cross lines.
+	UICodeLine *hits; // Sorted ranges of the matches in content.
+	int hitCount, current;
+	bool finished;
+
+	// Internals:
+	struct UICode *code;
+	struct UICodeSearch *next;
+	char *query;
+	int queryBytes, hitsAllocated, hitsDropped, generation;
+	uint32_t flags;
+	size_t searched;
+	volatile int cancel;
+	bool threadRunning;
+	uintptr_t thread;
+	size_t threadFrom, threadTo;
+} UICodeSearch;
+
+typedef struct UICodeWrap {
+	int columns; // Width of a row in characters; 0 until the first layout.
+	int *rows; // Visual rows of each line, estimated as 1 until measured. Indexed by linesDropped + line.
+	int64_t rowCount;
+	bool finished;
+
+	// Internals:
+	struct UICode *code;
+	struct UICodeWrap *next;
+	int64_t *blocks; // Fenwick tree of the rows in each _UI_CODE_WRAP_BLOCK lines.
+	int blockCount, rowsAllocated, measured, generation;
+	volatile int cancel;
+	bool threadRunning;
+	uintptr_t thread;
+	int threadFrom, threadTo;
+	int paintLine, paintRow, paintStart, paintTabSize; // Where the first painted row of a line started, if it wasn't the line's first row.
+	const struct UILexer *paintLexer;
+	uint8_t paintState;
+} UICodeWrap;
+
 typedef struct UICode {
 #define UI_CODE_NO_MARGIN (1 << 0)
+#define UI_CODE_WRAP (1 << 1)
 	UIElement e;
 	UIScrollBar *vScroll;
 	UICodeLine *lines;
 	UIFont *font;
+	UILexer *lexer; // Set to NULL to use the builtin C lexer.
+	UICodeSearch *search; // NULL if there is no active search.
+	UICodeWrap *wrap; // NULL unless lines are wrapped.
 	int lineCount, focused;
 	bool moveScrollToFocusNextLayout;
 	char *content;
 	size_t contentBytes;
 	int tabSize;
+
+	// Streaming limits, 0 for none. UICodeInsertContent drops the oldest lines to stay within them, 
+	// and only follows the end of the content if the view was already scrolled there.
+	// The live text then starts at lines[0].offset rather than at the start of content.
+	size_t maximumBytes;
+	int maximumLines;
+
+	// Internals:
+	size_t contentAllocated;
+	int linesAllocated, linesDropped;
 } UICode;
 
 typedef struct UIGauge {
@@ -509,21 +664,87 @@ typedef struct UIGauge {
 	float position;
 } UIGauge;
 
+#define UI_TABLE_CACHE_CELLS (1 << 0) // Keep the text of painted rows until UITableInvalidate is called.
+#define UI_TABLE_SELECTION (1 << 1) // Clicking selects items; shift selects a range, ctrl toggles. Sends UI_MSG_VALUE_CHANGED.
+
+typedef struct UITableRange {
+	int from, to; // Items, end exclusive.
+} UITableRange;
+
+typedef struct UITableCachedRow {
+	int index;
+	uint32_t generation;
+	bool isSelected;
+	int columns;
+	ptrdiff_t *bytes;
+	char *text;
+	size_t textAllocated;
+} UITableCachedRow;
+
 typedef struct UITable {
 	UIElement e;
-	UIScrollBar *vScroll;
+	UIScrollBar *vScroll, *hScroll;
 	int itemCount;
 	char *columns;
 	int *columnWidths, columnCount, columnHighlight;
+	int sortColumn; // -1 if not sorted.
+	bool sortDescending;
+	UITableRange *selection; // Sorted and disjoint. Items in these ranges are shown selected, as well as those the application reports.
+	int selectionCount;
+
+	// Internals:
+	int columnsMeasured; // Rows measured by the idle-time column sizer; -1 if not auto-sized.
+	struct UITable *nextSizing; // In ui.sizingTables while the column sizer has rows left.
+	bool sizingQueued;
+	int selectionAllocated, selectionAnchor;
+	int64_t *columnOffsets; // Prefix sums of the column widths and gaps; columnCount + 1 entries.
+	int hovered;
+	uint32_t cacheGeneration;
+	UITableCachedRow *cache;
+	int cacheCount;
+	int *order, *rows, *rowOf; // All items in sort order, the items shown, and the row of each item; NULL until sorted or filtered.
+	bool *hidden, filtered;
+	uint64_t *sortKeys;
+	int rowCount, modelItemCount, modelAllocated;
+	int *itemHeights, itemHeightsCount; // Unscaled; 0 for the default. NULL until a height is set.
+	int64_t *heightTree;
+	int heightTreeCount, heightTreeAllocated;
+	struct _UITableSortJob *sortJob;
+	char *fetchArena, *fetchLong;
+	size_t fetchArenaBytes, fetchLongBytes;
+	const char **fetchStrings;
+	ptrdiff_t *fetchBytes;
+	bool *fetchSelected;
+	int fetchCellsAllocated, fetchRowsAllocated;
 } UITable;
 
+typedef struct UITextJournalEntry {
+	ptrdiff_t position, bytes, text; // text is the offset of the inserted or deleted bytes in the journal.
+	bool deletion, joined; // Joined entries are undone together with the entry before them.
+} UITextJournalEntry;
+
+typedef struct UITextJournal {
+	size_t maximumBytes; // The oldest steps are dropped to stay within this, though the latest step is always kept. 0 for no limit.
+
+	// Internals:
+	UITextJournalEntry *entries;
+	char *text;
+	int entryFirst, entryCurrent, entryCount, entriesAllocated;
+	size_t textFirst, textBytes, textAllocated;
+	bool mergeable;
+} UITextJournal;
+
 typedef struct UITextbox {
 	UIElement e;
-	char *string;
-	ptrdiff_t bytes;
+	char *buffer; // A gap buffer; the text isn't contiguous. Use UITextboxToCString to get it.
+	ptrdiff_t bytes; // Length of the text, not including the gap.
 	int carets[2];
 	int scroll;
 	bool rejectNextKey;
+	UITextJournal journal; // Undo history.
+
+	// Internals:
+	ptrdiff_t gapStart, gapBytes;
 } UITextbox;
 
 #define UI_MENU_PLACE_ABOVE (1 << 0)
@@ -636,17 +857,37 @@ UITextbox *UITextboxCreate(UIElement *parent, uint32_t flags);
 void UITextboxReplace(UITextbox *textbox, const char *text, ptrdiff_t bytes, bool sendChangedMessage);
 void UITextboxClear(UITextbox *textbox, bool sendChangedMessage);
 void UITextboxMoveCaret(UITextbox *textbox, bool backward, bool word);
+char *UITextboxToCString(UITextbox *textbox); // Free with UI_FREE.
+bool UITextboxUndo(UITextbox *textbox); // Returns false if there is nothing to undo.
+bool UITextboxRedo(UITextbox *textbox);
 
 UITable *UITableCreate(UIElement *parent, uint32_t flags, const char *columns /* separate with \t, terminate with \0 */);
 int UITableHitTest(UITable *table, int x, int y); // Returns item index. Returns -1 if not on an item.
 int UITableHeaderHitTest(UITable *table, int x, int y); // Returns column index or -1.
 bool UITableEnsureVisible(UITable *table, int index); // Returns false if the item was already visible.
 void UITableResizeColumns(UITable *table);
+void UITableInvalidate(UITable *table); // Call when the data changes, if using UI_TABLE_CACHE_CELLS.
+void UITableSetRowHeight(UITable *table, int index, int height); // Unscaled pixels; 0 for the default. Lines of text separated by \n are shown in tall rows. Call UIElementRefresh after setting the heights.
+bool UITableSort(UITable *table, int column, bool descending); // Sorts large tables on worker threads. Returns false if the application doesn't give keys. Pass -1 to unsort.
+void UITableFilter(UITable *table, bool narrowing); // Hides items with UI_MSG_TABLE_FILTER. If narrowing, only items that are shown are tested again.
+void UITableSelect(UITable *table, int from, int to, bool selected); // Items [from, to). Selecting or clearing every item at once is O(1).
+bool UITableIsSelected(UITable *table, int index); // By item index. O(log n) in the number of selected ranges.
+void UITableInsertRows(UITable *table, int index, int count); // Items [index, index + count) were inserted; updates itemCount and keeps the rows in view still.
+void UITableRemoveRows(UITable *table, int index, int count); // Items [index, index + count) were removed.
 
 UICode *UICodeCreate(UIElement *parent, uint32_t flags);
 void UICodeFocusLine(UICode *code, int index); // Line numbers are 1-indexed!!
 int UICodeHitTest(UICode *code, int x, int y); // Returns line number; negates if in margin. Returns 0 if not on a line.
 void UICodeInsertContent(UICode *code, const char *content, ptrdiff_t byteCount, bool replace);
+void UICodeSetSearch(UICode *code, const char *query, ptrdiff_t queryBytes, uint32_t flags); // Runs on a worker thread. Pass 0 bytes to stop.
+bool UICodeSearchNext(UICode *code, bool backwards); // Focuses the next hit. Returns false if there are none (yet).
+void UICodeSetWrap(UICode *code, bool wrap); // Long lines are measured on a worker thread.
+
+UILexer *UILexerCreate(int builtin); // UI_LEXER_EMPTY, UI_LEXER_C or UI_LEXER_JSON. Free with UI_FREE.
+void UILexerSetClass(UILexer *lexer, int from, int to, int characterClass); // Inclusive range of bytes.
+void UILexerSetTransition(UILexer *lexer, int state, int characterClass /* -1 for all */, int next);
+void UILexerSetState(UILexer *lexer, int state, int color, int copyTransitionsFrom /* -1 for none */);
+void UILexerFinish(UILexer *lexer); // Call after modifying the tables.
 
 void UIDrawBlock(UIPainter *painter, UIRectangle rectangle, uint32_t color);
 void UIDrawInvert(UIPainter *painter, UIRectangle rectangle);
@@ -658,8 +899,9 @@ void UIDrawRectangle(UIPainter *painter, UIRectangle r, uint32_t mainColor, uint
 void UIDrawBorder(UIPainter *painter, UIRectangle r, uint32_t borderColor, UIRectangle borderSize);
 void UIDrawString(UIPainter *painter, UIRectangle r, const char *string, ptrdiff_t bytes, uint32_t color, int align, UIStringSelection *selection);
 int UIDrawStringHighlighted(UIPainter *painter, UIRectangle r, const char *string, ptrdiff_t bytes, int tabSize);
+int UIDrawStringLexed(UIPainter *painter, UIRectangle r, const char *string, ptrdiff_t bytes, int tabSize, const UILexer *lexer);
 
-int UIMeasureStringWidth(const char *string, ptrdiff_t bytes);
+int UIMeasureStringWidth(const char *string, ptrdiff_t bytes); // Measures with the active font at the scale of the window handling the current message, or at 1 outside a message.
 int UIMeasureStringHeight();
 
 uint64_t UIAnimateClock(); // In ms.
@@ -692,8 +934,24 @@ void UIColorToRGB(float hue, float saturation, float value, uint32_t *rgb);
 char *UIStringCopy(const char *in, ptrdiff_t inBytes);
 
 UIFont *UIFontCreate(const char *cPath, uint32_t size);
+UIFont *UIFontCreateWithWarmUp(const char *cPath, uint32_t size, const uint32_t *codePoints, size_t codePointCount); // The glyphs are rendered on a worker thread ahead of the first paint.
 UIFont *UIFontActivate(UIFont *font); // Returns the previously active font.
 
+#ifdef UI_FREETYPE
+void UIGlyphCacheSetBudget(size_t maximumBytes); // Shared by all fonts; the least recently drawn atlas pages are evicted past this. 0 for no limit.
+UIGlyphCacheStatistics UIGlyphCacheGetStatistics();
+void UIGlyphCacheSetDirectory(const char *cPath); // Enables the on-disk cache. Call before UIInitialise to include the default font. Not copied.
+void UIGlyphCacheSave(); // Writes newly rendered glyphs to the on-disk cache. UIMessageLoop calls this before returning.
+#endif
+
+#ifdef UI_LINUX
+void UIEpollAdd(int fd, UIEpollDispatchPtr *ptr); // ptr->fp is called from the message loop whenever fd is readable, until it is removed.
+void UIEpollRemove(int fd);
+UITimer *UITimerCreate(uint32_t milliseconds, bool periodic, void (*invoke)(void *cp), void *cp); // invoke is called from the message loop.
+void UITimerSet(UITimer *timer, uint32_t milliseconds, bool periodic); // Restarts the timer; 0 milliseconds stops it.
+void UITimerDestroy(UITimer *timer); // Can be called from invoke.
+#endif
+
 #ifdef UI_DEBUG
 void UIInspectorLog(const char *cFormat, ...);
 #endif
@@ -713,6 +971,11 @@ struct {
 	UIElement *dialogOldFocus;
 
 	UIFont *activeFont;
+	UILexer *lexerC;
+	UICodeSearch *codeSearches;
+	UICodeWrap *codeWraps;
+	struct _UITableSortJob *tableSorts;
+	UITable *sizingTables;
 
 #ifdef UI_DEBUG
 	UIWindow *inspector;
@@ -731,11 +994,19 @@ struct {
 	Cursor cursors[UI_CURSOR_COUNT];
 	char *pasteText;
 	XEvent copyEvent;
+	int epollFD;
+
+	// Messages from UIWindowPostMessage, queued until postFD wakes up the message loop.
+	int postFD;
+	UIEpollDispatchPtr postDispatch;
+	pthread_mutex_t postMutex;
+	struct _UIX11PostedMessage *postedFirst, *postedLast;
 #endif
 
 #ifdef UI_WINDOWS
 	HCURSOR cursors[UI_CURSOR_COUNT];
 	HANDLE heap;
+	DWORD threadID; // The thread running the message loop, for messages posted without a window.
 	bool assertionFailure;
 #endif
 
@@ -748,6 +1019,15 @@ struct {
 
 #ifdef UI_FREETYPE
 	FT_Library ft;
+	struct _UIGlyph **glyphSlots;
+	struct _UIGlyphPage *glyphPagesNewest, *glyphPagesOldest, *glyphPageOpen;
+	size_t glyphSlotCount, glyphCacheBudget;
+	UIGlyphCacheStatistics glyphCache;
+	const char *glyphCacheDirectory;
+	UIFont *fonts;
+	float fontScale; // The scale of the window whose elements are being sent a message.
+	struct _UIStringWidth *stringWidths;
+	struct _UITextRun *textRuns;
 #endif
 } ui;
 
@@ -777,6 +1057,7 @@ UITheme _uiThemeClassic = {
 	.codeNumber = 0xFF213EF1,
 	.codeOperator = 0xFF7F0480,
 	.codePreprocessor = 0xFF545D70,
+	.codeSearchHit = 0xFFFFE680,
 };
 
 UITheme _uiThemeDark = {
@@ -805,6 +1086,7 @@ UITheme _uiThemeDark = {
 	.codeNumber = 0xFFC3F5D3,
 	.codeOperator = 0xFFF5D499,
 	.codePreprocessor = 0xFFF5F3D1,
+	.codeSearchHit = 0xFF6E5A1E,
 };
 
 // Taken from https://commons.wikimedia.org/wiki/File:Codepage-437.png
@@ -856,6 +1138,9 @@ bool _UIMessageLoopSingle(int *result);
 void _UIInspectorRefresh();
 void _UIUpdate();
 
+float _UIFontScaleEnter(UIWindow *window);
+void _UIFontScaleLeave(float previousScale);
+
 #ifdef UI_WINDOWS
 void *_UIHeapReAlloc(void *pointer, size_t size);
 #endif
@@ -1280,481 +1565,1486 @@ void UIDrawInvert(UIPainter *painter, UIRectangle rectangle) {
 	}
 }
 
-void UIDrawGlyph(UIPainter *painter, int x0, int y0, int c, uint32_t color) {
-#ifdef UI_FREETYPE
-	UIFont *font = ui.activeFont;
+typedef struct _UIWorkerBatch {
+	void (*merge)(struct _UIWorkerBatch *batch); // Called on the UI thread; frees the batch.
+} _UIWorkerBatch;
 
-	if (font->isFreeType) {
-		if (c < 0 || c > 127) c = '?';
-		if (c == '\r') c = ' ';
+void _UIWindowReceivePosted(UIWindow *window, UIMessage message, void *dp) {
+	// Results posted by worker threads are merged here instead of being sent to the window,
+	// so its messageUser never sees them.
+	if (message == _UI_MSG_WORKER_BATCH) {
+		_UIWorkerBatch *batch = (_UIWorkerBatch *) dp;
+		float previousScale = _UIFontScaleEnter(window);
+		batch->merge(batch);
+		_UIFontScaleLeave(previousScale);
+	} else {
+		UIElementMessage(&window->e, message, 0, dp);
+	}
+}
 
-		if (!font->glyphsRendered[c]) {
-			FT_Load_Char(font->font, c == 24 ? 0x2191 : c == 25 ? 0x2193 : c == 26 ? 0x2192 : c == 27 ? 0x2190 : c, FT_LOAD_DEFAULT);
-#ifdef UI_FREETYPE_SUBPIXEL
-			FT_Render_Glyph(font->font->glyph, FT_RENDER_MODE_LCD);
-#else
-			FT_Render_Glyph(font->font->glyph, FT_RENDER_MODE_NORMAL);
-#endif
-			FT_Bitmap_Copy(ui.ft, &font->font->glyph->bitmap, &font->glyphs[c]);
-			font->glyphOffsetsX[c] = font->font->glyph->bitmap_left;
-			font->glyphOffsetsY[c] = font->font->size->metrics.ascender / 64 - font->font->glyph->bitmap_top;
-			font->glyphsRendered[c] = true;
-		}
+#if defined(UI_LINUX) || defined(UI_WINDOWS)
+#define _UI_THREADS
 
-		FT_Bitmap *bitmap = &font->glyphs[c];
-		x0 += font->glyphOffsetsX[c], y0 += font->glyphOffsetsY[c];
+typedef struct _UIThreadStart {
+	void (*function)(void *cp);
+	void *cp;
+} _UIThreadStart;
 
-		for (int y = 0; y < (int) bitmap->rows; y++) {
-			if (y0 + y < painter->clip.t) continue;
-			if (y0 + y >= painter->clip.b) break;
+#ifdef UI_LINUX
+void *_UIThreadEntry(void *cp) {
+#else
+DWORD WINAPI _UIThreadEntry(void *cp) {
+#endif
+	_UIThreadStart start = *(_UIThreadStart *) cp;
+	UI_FREE(cp);
+	start.function(start.cp);
+	return 0;
+}
 
-			int width = bitmap->width;
-#ifdef UI_FREETYPE_SUBPIXEL
-			width /= 3;
+uintptr_t _UIThreadCreate(void (*function)(void *cp), void *cp) {
+	_UIThreadStart *start = (_UIThreadStart *) UI_MALLOC(sizeof(_UIThreadStart));
+	start->function = function, start->cp = cp;
+#ifdef UI_LINUX
+	pthread_t thread;
+	pthread_create(&thread, NULL, _UIThreadEntry, start);
+	return (uintptr_t) thread;
+#else
+	return (uintptr_t) CreateThread(NULL, 0, _UIThreadEntry, start, 0, NULL);
 #endif
+}
 
-			for (int x = 0; x < width; x++) {
-				if (x0 + x < painter->clip.l) continue;
-				if (x0 + x >= painter->clip.r) break;
+void _UIThreadJoin(uintptr_t thread) {
+#ifdef UI_LINUX
+	pthread_join((pthread_t) thread, NULL);
+#else
+	WaitForSingleObject((HANDLE) thread, INFINITE);
+	CloseHandle((HANDLE) thread);
+#endif
+}
 
-				uint32_t *destination = painter->bits + (x0 + x) + (y0 + y) * painter->width;
-				uint32_t original = *destination;
+#ifdef UI_LINUX
+#define _UI_ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define _UI_ATOMIC_STORE(x, y) __atomic_store_n(&(x), (y), __ATOMIC_RELEASE)
+#else
+#define _UI_ATOMIC_LOAD(x) InterlockedCompareExchange((volatile LONG *) &(x), 0, 0)
+#define _UI_ATOMIC_STORE(x, y) InterlockedExchange((volatile LONG *) &(x), (y))
+#endif
+#endif
 
+#ifdef UI_FREETYPE
 #ifdef UI_FREETYPE_SUBPIXEL
-				uint32_t ra = ((uint8_t *) bitmap->buffer)[x * 3 + y * bitmap->pitch + 0];
-				uint32_t ga = ((uint8_t *) bitmap->buffer)[x * 3 + y * bitmap->pitch + 1];
-				uint32_t ba = ((uint8_t *) bitmap->buffer)[x * 3 + y * bitmap->pitch + 2];
-				ra += (ga - ra) / 2, ba += (ga - ba) / 2;
+#define _UI_GLYPH_CHANNELS (3)
 #else
-				uint32_t ra = ((uint8_t *) bitmap->buffer)[x + y * bitmap->pitch];
-				uint32_t ga = ra, ba = ra;
+#define _UI_GLYPH_CHANNELS (1)
 #endif
-				uint32_t r2 = (255 - ra) * ((original & 0x000000FF) >> 0);
-				uint32_t g2 = (255 - ga) * ((original & 0x0000FF00) >> 8);
-				uint32_t b2 = (255 - ba) * ((original & 0x00FF0000) >> 16);
-				uint32_t r1 = ra * ((color & 0x000000FF) >> 0);
-				uint32_t g1 = ga * ((color & 0x0000FF00) >> 8);
-				uint32_t b1 = ba * ((color & 0x00FF0000) >> 16);
-
-				uint32_t result = 0xFF000000 | (0x00FF0000 & ((b1 + b2) << 8)) 
-					| (0x0000FF00 & ((g1 + g2) << 0)) 
-					| (0x000000FF & ((r1 + r2) >> 8));
-				*destination = result;
-			}
-		}
 
-		return;
+#define _UI_GLYPH_PAGE_SIZE (256)
+
+typedef struct _UIGlyph {
+	struct _UIGlyph *hashNext, *pageNext;
+	struct _UIGlyphPage *page;
+	UIFont *font;
+	uint32_t codePoint, size, hash;
+	int offsetX, offsetY;
+	int x, y, width, height; // Where the coverage is stored in the page, in pixels.
+} _UIGlyph;
+
+typedef struct _UIGlyphShelf {
+	int y, height, x; // x is where the next glyph on the shelf goes.
+} _UIGlyphShelf;
+
+typedef struct _UIGlyphPage {
+	struct _UIGlyphPage *newer, *older;
+	_UIGlyph *glyphs;
+	uint8_t *coverage; // _UI_GLYPH_CHANNELS bytes per pixel.
+	int width, height, stride;
+	_UIGlyphShelf *shelves;
+	int shelfCount, shelvesAllocated;
+} _UIGlyphPage;
+
+uint32_t _UIGlyphHash(UIFont *font, uint32_t codePoint, uint32_t size) {
+	uint64_t key = (uint64_t) (uintptr_t) font ^ ((uint64_t) size << 40) ^ ((uint64_t) codePoint << 8);
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (uint32_t) (key >> 32);
+}
+
+void _UIGlyphPageUnlink(_UIGlyphPage *page) {
+	if (page->newer) page->newer->older = page->older; else ui.glyphPagesNewest = page->older;
+	if (page->older) page->older->newer = page->newer; else ui.glyphPagesOldest = page->newer;
+	page->newer = page->older = NULL;
+}
+
+void _UIGlyphPageLinkNewest(_UIGlyphPage *page) {
+	page->older = ui.glyphPagesNewest;
+	if (ui.glyphPagesNewest) ui.glyphPagesNewest->newer = page; else ui.glyphPagesOldest = page;
+	ui.glyphPagesNewest = page;
+}
+
+_UIGlyphPage *_UIGlyphPageCreate(int width, int height) {
+	_UIGlyphPage *page = (_UIGlyphPage *) UI_CALLOC(sizeof(_UIGlyphPage));
+	page->width = width, page->height = height, page->stride = width * _UI_GLYPH_CHANNELS;
+	page->coverage = (uint8_t *) UI_MALLOC(page->stride * height);
+	_UIGlyphPageLinkNewest(page);
+	ui.glyphCache.bytes += sizeof(_UIGlyphPage) + page->stride * height;
+	ui.glyphCache.pages++;
+	return page;
+}
+
+void _UIGlyphPageEvict(_UIGlyphPage *page) {
+	// All the glyphs on a page are evicted together; the page is then freed.
+
+	for (_UIGlyph *glyph = page->glyphs, *next; glyph; glyph = next) {
+		next = glyph->pageNext;
+		_UIGlyph **link = &ui.glyphSlots[glyph->hash & (ui.glyphSlotCount - 1)];
+		while (*link != glyph) link = &(*link)->hashNext;
+		*link = glyph->hashNext;
+		UI_FREE(glyph);
+		ui.glyphCache.bytes -= sizeof(_UIGlyph);
+		ui.glyphCache.glyphs--;
+		ui.glyphCache.evictions++;
+	}
+
+	if (ui.glyphPageOpen == page) ui.glyphPageOpen = NULL;
+	_UIGlyphPageUnlink(page);
+	ui.glyphCache.bytes -= sizeof(_UIGlyphPage) + page->stride * page->height;
+	ui.glyphCache.pages--;
+	UI_FREE(page->coverage);
+	UI_FREE(page->shelves);
+	UI_FREE(page);
+}
+
+bool _UIGlyphPagePack(_UIGlyphPage *page, int width, int height, int *x, int *y) {
+	// Shelf packing: glyphs go left to right on shelves of similar height, and shelves are stacked top to bottom.
+
+	if (!width || !height) {
+		*x = *y = 0;
+		return true;
 	}
-#endif
 
-	if (c < 0 || c > 127) c = '?';
+	if (width > page->width || height > page->height) {
+		return false;
+	}
 
-	UIRectangle rectangle = UIRectangleIntersection(painter->clip, UI_RECT_4(x0, x0 + 8, y0, y0 + 16));
+	_UIGlyphShelf *fallback = NULL;
 
-	const uint8_t *data = (const uint8_t *) _uiFont + c * 16;
+	for (int i = 0; i < page->shelfCount; i++) {
+		_UIGlyphShelf *shelf = page->shelves + i;
+		if (shelf->height < height || shelf->x + width > page->width) continue;
+		if (shelf->height > height + height / 4 + 2) { if (!fallback) fallback = shelf; continue; }
+		*x = shelf->x, *y = shelf->y, shelf->x += width;
+		return true;
+	}
 
-	for (int i = rectangle.t; i < rectangle.b; i++) {
-		uint32_t *bits = painter->bits + i * painter->width + rectangle.l;
-		uint8_t byte = data[i - y0];
+	int top = page->shelfCount ? page->shelves[page->shelfCount - 1].y + page->shelves[page->shelfCount - 1].height : 0;
 
-		for (int j = rectangle.l; j < rectangle.r; j++) {
-			if (byte & (1 << (j - x0))) {
-				*bits = color;
-			}
+	if (top + height > page->height) {
+		if (!fallback) return false;
+		*x = fallback->x, *y = fallback->y, fallback->x += width;
+		return true;
+	}
 
-			bits++;
-		}
+	if (page->shelfCount == page->shelvesAllocated) {
+		page->shelvesAllocated = page->shelvesAllocated ? page->shelvesAllocated * 2 : 16;
+		page->shelves = (_UIGlyphShelf *) UI_REALLOC(page->shelves, sizeof(_UIGlyphShelf) * page->shelvesAllocated);
 	}
-}
 
-ptrdiff_t _UIStringLength(const char *cString) {
-	if (!cString) return 0;
-	ptrdiff_t length;
-	for (length = 0; cString[length]; length++);
-	return length;
+	_UIGlyphShelf *shelf = page->shelves + page->shelfCount++;
+	shelf->y = top, shelf->height = height, shelf->x = width;
+	*x = 0, *y = top;
+	return true;
 }
 
-char *UIStringCopy(const char *in, ptrdiff_t inBytes) {
-	if (inBytes == -1) {
-		inBytes = _UIStringLength(in);
-	}
-
-	char *buffer = (char *) UI_MALLOC(inBytes + 1);
-	
-	for (intptr_t i = 0; i < inBytes; i++) {
-		buffer[i] = in[i];
+void _UIGlyphCacheTrim(_UIGlyphPage *keep) {
+	while (ui.glyphCacheBudget && ui.glyphCache.bytes > ui.glyphCacheBudget 
+			&& ui.glyphPagesOldest && ui.glyphPagesOldest != keep) {
+		_UIGlyphPageEvict(ui.glyphPagesOldest);
 	}
-	
-	buffer[inBytes] = 0;
-	return buffer;
 }
 
-int UIMeasureStringWidth(const char *string, ptrdiff_t bytes) {
-	if (bytes == -1) {
-		bytes = _UIStringLength(string);
+void _UIGlyphCacheGrow() {
+	size_t slotCount = ui.glyphSlotCount ? ui.glyphSlotCount * 2 : 256;
+	_UIGlyph **slots = (_UIGlyph **) UI_CALLOC(sizeof(_UIGlyph *) * slotCount);
+
+	for (uintptr_t i = 0; i < ui.glyphSlotCount; i++) {
+		for (_UIGlyph *glyph = ui.glyphSlots[i], *next; glyph; glyph = next) {
+			next = glyph->hashNext;
+			_UIGlyph **slot = &slots[glyph->hash & (slotCount - 1)];
+			glyph->hashNext = *slot;
+			*slot = glyph;
+		}
 	}
-	
-	return bytes * ui.activeFont->glyphWidth;
+
+	UI_FREE(ui.glyphSlots);
+	ui.glyphSlots = slots;
+	ui.glyphSlotCount = slotCount;
 }
 
-int UIMeasureStringHeight() {
-	return ui.activeFont->glyphHeight;
+uint32_t _UIGlyphMapCharacter(uint32_t c) {
+	return c == 24 ? 0x2191 : c == 25 ? 0x2193 : c == 26 ? 0x2192 : c == 27 ? 0x2190 : c;
 }
 
-void UIDrawString(UIPainter *painter, UIRectangle r, const char *string, ptrdiff_t bytes, uint32_t color, int align, UIStringSelection *selection) {
-	UIRectangle oldClip = painter->clip;
-	painter->clip = UIRectangleIntersection(r, oldClip);
+void _UIGlyphRender(FT_Face face, uint32_t c) {
+	FT_Load_Char(face, _UIGlyphMapCharacter(c), FT_LOAD_DEFAULT);
+#ifdef UI_FREETYPE_SUBPIXEL
+	FT_Render_Glyph(face->glyph, FT_RENDER_MODE_LCD);
+#else
+	FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
+#endif
+}
 
-	if (!UI_RECT_VALID(painter->clip)) {
-		painter->clip = oldClip;
-		return;
+_UIGlyph *_UIGlyphFind(UIFont *font, uint32_t codePoint, uint32_t size, uint32_t hash) {
+	for (_UIGlyph *glyph = ui.glyphSlotCount ? ui.glyphSlots[hash & (ui.glyphSlotCount - 1)] : NULL; glyph; glyph = glyph->hashNext) {
+		if (glyph->font == font && glyph->codePoint == codePoint && glyph->size == size) {
+			return glyph;
+		}
 	}
 
-	if (bytes == -1) {
-		bytes = _UIStringLength(string);
+	return NULL;
+}
+
+_UIGlyph *_UIGlyphInsert(UIFont *font, uint32_t codePoint, uint32_t size, uint32_t hash, 
+		int offsetX, int offsetY, int width, int height, const uint8_t *coverage, int pitch) {
+	_UIGlyph *glyph = (_UIGlyph *) UI_CALLOC(sizeof(_UIGlyph));
+	glyph->font = font;
+	glyph->codePoint = codePoint;
+	glyph->size = size;
+	glyph->hash = hash;
+	glyph->offsetX = offsetX;
+	glyph->offsetY = offsetY;
+	glyph->width = width;
+	glyph->height = height;
+
+	_UIGlyphPage *page = ui.glyphPageOpen;
+
+	if (!page || !_UIGlyphPagePack(page, width, height, &glyph->x, &glyph->y)) {
+		if (width > _UI_GLYPH_PAGE_SIZE || height > _UI_GLYPH_PAGE_SIZE) {
+			// Too big to share a page; it gets one to itself.
+			page = _UIGlyphPageCreate(width, height);
+		} else {
+			page = ui.glyphPageOpen = _UIGlyphPageCreate(_UI_GLYPH_PAGE_SIZE, _UI_GLYPH_PAGE_SIZE);
+		}
+
+		_UIGlyphPagePack(page, width, height, &glyph->x, &glyph->y);
 	}
 
-	int width = UIMeasureStringWidth(string, bytes);
-	int height = UIMeasureStringHeight();
-	int x = align == UI_ALIGN_CENTER ? ((r.l + r.r - width) / 2) : align == UI_ALIGN_RIGHT ? (r.r - width) : r.l;
-	int y = (r.t + r.b - height) / 2;
-	int i = 0, j = 0;
+	for (int y = 0; y < height; y++) {
+		uint8_t *destination = page->coverage + (glyph->y + y) * page->stride + glyph->x * _UI_GLYPH_CHANNELS;
+		const uint8_t *source = coverage + y * pitch;
+		for (int x = 0; x < width * _UI_GLYPH_CHANNELS; x++) destination[x] = source[x];
+	}
 
-	int selectFrom = -1, selectTo = -1;
+	glyph->page = page;
+	glyph->pageNext = page->glyphs;
+	page->glyphs = glyph;
 
-	if (selection) {
-		selectFrom = selection->carets[0];
-		selectTo = selection->carets[1];
-		
-		if (selectFrom > selectTo) {
-			UI_SWAP(int, selectFrom, selectTo);
-		}
+	if (page != ui.glyphPagesNewest) {
+		_UIGlyphPageUnlink(page);
+		_UIGlyphPageLinkNewest(page);
 	}
 
-	for (; j < bytes; j++) {
-		char c = *string++;
-		uint32_t colorText = color;
+	if (ui.glyphCache.glyphs >= ui.glyphSlotCount) _UIGlyphCacheGrow();
+	_UIGlyph **slot = &ui.glyphSlots[hash & (ui.glyphSlotCount - 1)];
+	glyph->hashNext = *slot;
+	*slot = glyph;
+	ui.glyphCache.bytes += sizeof(_UIGlyph);
+	ui.glyphCache.glyphs++;
+	_UIGlyphCacheTrim(page);
+	return glyph;
+}
 
-		if (j >= selectFrom && j < selectTo) {
-			UIDrawBlock(painter, UI_RECT_4(x, x + ui.activeFont->glyphWidth, y, y + height), selection->colorBackground);
-			colorText = selection->colorText;
-		}
+#ifdef _UI_THREADS
+typedef struct _UIGlyphRendered {
+	uint32_t codePoint;
+	int offsetX, offsetY, width, height;
+	uint8_t *coverage; // width * _UI_GLYPH_CHANNELS bytes per row.
+} _UIGlyphRendered;
 
-		if (c != '\t') {
-			UIDrawGlyph(painter, x, y, c, colorText);
-		}
+typedef struct _UIFontWarmUp {
+	UIFont *font;
+	char *path;
+	uint32_t size;
+	_UIGlyphRendered *glyphs;
+	int glyphCount, merged;
+	int finished; // Written by the thread once each glyph is complete.
+	uintptr_t thread;
+} _UIFontWarmUp;
+
+typedef struct _UIFontWarmUpBatch {
+	_UIWorkerBatch header;
+	UIFont *font;
+} _UIFontWarmUpBatch;
+
+void _UIFontWarmUpMergeBatch(_UIWorkerBatch *header);
+
+void _UIFontWarmUpWork(void *cp) {
+	// FreeType faces can't be shared between threads, so the worker opens the font again in its own library.
+	_UIFontWarmUp *warmUp = (_UIFontWarmUp *) cp;
+	FT_Library library = NULL;
+	FT_Face face;
+
+	if (!FT_Init_FreeType(&library) && !FT_New_Face(library, warmUp->path, 0, &face)) {
+		FT_Set_Char_Size(face, 0, warmUp->size * 64, 100, 100);
+
+		for (int i = 0; i < warmUp->glyphCount; i++) {
+			_UIGlyphRendered *glyph = warmUp->glyphs + i;
+			_UIGlyphRender(face, glyph->codePoint);
+			FT_Bitmap *bitmap = &face->glyph->bitmap;
+			glyph->offsetX = face->glyph->bitmap_left;
+			glyph->offsetY = face->size->metrics.ascender / 64 - face->glyph->bitmap_top;
+			glyph->width = bitmap->width / _UI_GLYPH_CHANNELS;
+			glyph->height = bitmap->rows;
+			int rowBytes = glyph->width * _UI_GLYPH_CHANNELS;
+			glyph->coverage = (uint8_t *) UI_MALLOC(rowBytes * glyph->height + 1);
+
+			for (int y = 0; y < glyph->height; y++) {
+				const uint8_t *source = (const uint8_t *) bitmap->buffer + y * bitmap->pitch;
+				for (int x = 0; x < rowBytes; x++) glyph->coverage[y * rowBytes + x] = source[x];
+			}
 
-		if (selection && selection->carets[0] == j) {
-			UIDrawInvert(painter, UI_RECT_4(x, x + 1, y, y + height));
+			_UI_ATOMIC_STORE(warmUp->finished, i + 1);
 		}
 
-		x += ui.activeFont->glyphWidth, i++;
+		FT_Done_Face(face);
+	}
 
-		if (c == '\t') {
-			while (i & 3) x += ui.activeFont->glyphWidth, i++;
+	if (library) FT_Done_FreeType(library);
+	_UI_ATOMIC_STORE(warmUp->finished, warmUp->glyphCount);
+
+	// Wake up the message loop to merge the glyphs and join the thread, in case nothing is drawn that misses the cache.
+	// The batch isn't for a particular window, since the warm-up can start before any are created.
+	_UIFontWarmUpBatch *batch = (_UIFontWarmUpBatch *) UI_MALLOC(sizeof(_UIFontWarmUpBatch));
+	batch->header.merge = _UIFontWarmUpMergeBatch;
+	batch->font = warmUp->font;
+	UIWindowPostMessage(NULL, _UI_MSG_WORKER_BATCH, batch);
+}
+
+void _UIFontWarmUpMerge(UIFont *font, bool wait) {
+	// Move glyphs the thread has finished into the cache, unless they were drawn (and so rendered) in the meantime.
+	_UIFontWarmUp *warmUp = font->warmUp;
+	if (wait) _UIThreadJoin(warmUp->thread);
+	int finished = _UI_ATOMIC_LOAD(warmUp->finished);
+
+	for (; warmUp->merged < finished; warmUp->merged++) {
+		_UIGlyphRendered *glyph = warmUp->glyphs + warmUp->merged;
+		if (!glyph->coverage) continue;
+		uint32_t hash = _UIGlyphHash(font, glyph->codePoint, warmUp->size);
+
+		if (!_UIGlyphFind(font, glyph->codePoint, warmUp->size, hash)) {
+			_UIGlyphInsert(font, glyph->codePoint, warmUp->size, hash, glyph->offsetX, glyph->offsetY, 
+					glyph->width, glyph->height, glyph->coverage, glyph->width * _UI_GLYPH_CHANNELS);
+			font->glyphFileDirty = true;
 		}
+
+		UI_FREE(glyph->coverage);
 	}
 
-	if (selection && selection->carets[0] == j) {
-		UIDrawInvert(painter, UI_RECT_4(x, x + 1, y, y + height));
+	if (warmUp->merged == warmUp->glyphCount) {
+		if (!wait) _UIThreadJoin(warmUp->thread);
+		UI_FREE(warmUp->path);
+		UI_FREE(warmUp->glyphs);
+		UI_FREE(warmUp);
+		font->warmUp = NULL;
 	}
+}
 
-	painter->clip = oldClip;
+void _UIFontWarmUpMergeBatch(_UIWorkerBatch *header) {
+	// The warm-up has already gone if a cache miss or saving the glyph file merged it first.
+	_UIFontWarmUpBatch *batch = (_UIFontWarmUpBatch *) header;
+	if (batch->font->warmUp) _UIFontWarmUpMerge(batch->font, true);
+	UI_FREE(batch);
 }
 
-void UIDrawBorder(UIPainter *painter, UIRectangle r, uint32_t borderColor, UIRectangle borderSize) {
-	UIDrawBlock(painter, UI_RECT_4(r.l, r.r, r.t, r.t + borderSize.t), borderColor);
-	UIDrawBlock(painter, UI_RECT_4(r.l, r.l + borderSize.l, r.t + borderSize.t, r.b - borderSize.b), borderColor);
-	UIDrawBlock(painter, UI_RECT_4(r.r - borderSize.r, r.r, r.t + borderSize.t, r.b - borderSize.b), borderColor);
-	UIDrawBlock(painter, UI_RECT_4(r.l, r.r, r.b - borderSize.b, r.b), borderColor);
+void _UIFontWarmUpStart(UIFont *font, const char *cPath, const uint32_t *codePoints, size_t codePointCount) {
+	_UIFontWarmUp *warmUp = (_UIFontWarmUp *) UI_CALLOC(sizeof(_UIFontWarmUp));
+	warmUp->font = font;
+	warmUp->path = UIStringCopy(cPath, -1);
+	warmUp->size = font->size;
+	warmUp->glyphCount = codePointCount;
+	warmUp->glyphs = (_UIGlyphRendered *) UI_CALLOC(sizeof(_UIGlyphRendered) * codePointCount);
+	for (uintptr_t i = 0; i < codePointCount; i++) warmUp->glyphs[i].codePoint = codePoints[i];
+	font->warmUp = warmUp;
+	warmUp->thread = _UIThreadCreate(_UIFontWarmUpWork, warmUp);
 }
+#endif
 
-void UIDrawRectangle(UIPainter *painter, UIRectangle r, uint32_t mainColor, uint32_t borderColor, UIRectangle borderSize) {
-	UIDrawBorder(painter, r, borderColor, borderSize);
-	UIDrawBlock(painter, UI_RECT_4(r.l + borderSize.l, r.r - borderSize.r, r.t + borderSize.t, r.b - borderSize.b), mainColor);
+#if defined(UI_LINUX) || defined(UI_WINDOWS)
+#define _UI_GLYPH_FILES
+
+#define _UI_GLYPH_FILE_MAGIC (0x48504C47)
+#define _UI_GLYPH_FILE_VERSION (2)
+
+typedef struct _UIGlyphFileHeader {
+	uint32_t magic, version, freetypeVersion, channels, size;
+	uint32_t glyphWidth, glyphHeight, pathBytes, glyphCount, recordsOffset;
+	uint32_t flags, metricsOffset;
+	uint64_t fontModified, fontBytes;
+	// Followed by the font path, the advances and kerning pairs, the records sorted by code point, and the coverage.
+} _UIGlyphFileHeader;
+
+#define _UI_GLYPH_FILE_PROPORTIONAL (1 << 0)
+#define _UI_GLYPH_FILE_KERNING (1 << 1)
+
+typedef struct _UIGlyphFileRecord {
+	uint32_t codePoint, coverage; // coverage is the offset from the start of the file.
+	int32_t offsetX, offsetY;
+	uint32_t width, height;
+} _UIGlyphFileRecord;
+
+#ifdef UI_LINUX
+bool _UIFileGetInformation(const char *cPath, uint64_t *modified, uint64_t *bytes) {
+	struct stat s;
+	if (stat(cPath, &s)) return false;
+	*modified = (uint64_t) s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+	*bytes = s.st_size;
+	return true;
 }
 
-void UIElementMove(UIElement *element, UIRectangle bounds, bool alwaysLayout) {
-	UIRectangle oldClip = element->clip;
-	element->clip = UIRectangleIntersection(element->parent->clip, bounds);
+const void *_UIFileMap(const char *cPath, size_t *bytes) {
+	int fd = open(cPath, O_RDONLY);
+	if (fd == -1) return NULL;
+	struct stat s;
+	void *pointer = fstat(fd, &s) || !s.st_size ? MAP_FAILED : mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (pointer == MAP_FAILED) return NULL;
+	*bytes = s.st_size;
+	return pointer;
+}
 
-	if (!UIRectangleEquals(element->bounds, bounds) || !UIRectangleEquals(element->clip, oldClip) || alwaysLayout) {
-		element->bounds = bounds;
-		UIElementMessage(element, UI_MSG_LAYOUT, 0, 0);
-	}
+void _UIFileUnmap(const void *pointer, size_t bytes) {
+	munmap((void *) pointer, bytes);
 }
 
-int UIElementMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	if (message != UI_MSG_DESTROY && (element->flags & UI_ELEMENT_DESTROY)) {
-		return 0;
-	}
+bool _UIFileReplace(const char *cPath, const char *cTemporaryPath, const void *data, size_t bytes) {
+	int fd = open(cTemporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) return false;
+	const char *position = (const char *) data;
+	bool success = true;
 
-	if (message >= UI_MSG_INPUT_EVENTS_START && message <= UI_MSG_INPUT_EVENTS_END && (element->flags & UI_ELEMENT_DISABLED)) {
-		return 0;
+	while (bytes && success) {
+		ssize_t written = write(fd, position, bytes);
+		if (written <= 0) success = false;
+		else position += written, bytes -= written;
 	}
 
-	if (element->messageUser) {
-		int result = element->messageUser(element, message, di, dp);
+	if (close(fd)) success = false;
+	if (success && rename(cTemporaryPath, cPath)) success = false;
+	if (!success) unlink(cTemporaryPath);
+	return success;
+}
 
-		if (result) {
-			return result;
-		}
-	}
+uint32_t _UIProcessID() {
+	return getpid();
+}
+#endif
 
-	if (element->messageClass) {
-		return element->messageClass(element, message, di, dp);
-	} else {
-		return 0;
-	}
+#ifdef UI_WINDOWS
+bool _UIFileGetInformation(const char *cPath, uint64_t *modified, uint64_t *bytes) {
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(cPath, GetFileExInfoStandard, &data)) return false;
+	*modified = ((uint64_t) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	*bytes = ((uint64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	return true;
 }
 
-void UIElementChangeParent(UIElement *element, UIElement *newParent, UIElement *insertBefore) {
-	UIElement **link = &element->parent->children;
+const void *_UIFileMap(const char *cPath, size_t *bytes) {
+	HANDLE file = CreateFileA(cPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+	LARGE_INTEGER size = { 0 };
+	HANDLE mapping = GetFileSizeEx(file, &size) && size.QuadPart ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	const void *pointer = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (mapping) CloseHandle(mapping);
+	CloseHandle(file);
+	*bytes = size.QuadPart;
+	return pointer;
+}
 
-	while (true) {
-		if (*link == element) {
-			*link = element->next;
-			break;
-		} else {
-			link = &(*link)->next;
-		}
-	}
+void _UIFileUnmap(const void *pointer, size_t bytes) {
+	UnmapViewOfFile(pointer);
+}
 
-	link = &newParent->children;
-	element->next = insertBefore;
+bool _UIFileReplace(const char *cPath, const char *cTemporaryPath, const void *data, size_t bytes) {
+	HANDLE file = CreateFileA(cTemporaryPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	DWORD written = 0;
+	bool success = WriteFile(file, data, bytes, &written, NULL) && written == bytes;
+	CloseHandle(file);
+	if (success && !MoveFileExA(cTemporaryPath, cPath, MOVEFILE_REPLACE_EXISTING)) success = false;
+	if (!success) DeleteFileA(cTemporaryPath);
+	return success;
+}
 
-	while (true) {
-		if ((*link) == insertBefore) {
-			*link = element;
-			break;
-		} else {
-			link = &(*link)->next;
+uint32_t _UIProcessID() {
+	return GetCurrentProcessId();
+}
+#endif
+
+char *_UIGlyphFilePath(UIFont *font, bool temporary) {
+	// <directory>/<hash of font path, size and render mode>.glyphs; the rest of the key is checked against the header.
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (uintptr_t i = 0; font->path[i]; i++) hash = (hash ^ (uint8_t) font->path[i]) * 0x100000001B3ULL;
+	hash = (hash ^ font->size) * 0x100000001B3ULL;
+	hash = (hash ^ _UI_GLYPH_CHANNELS) * 0x100000001B3ULL;
+
+	size_t directoryBytes = 0;
+	while (ui.glyphCacheDirectory[directoryBytes]) directoryBytes++;
+	char *buffer = (char *) UI_MALLOC(directoryBytes + 40);
+	char *position = buffer;
+	for (uintptr_t i = 0; i < directoryBytes; i++) *position++ = ui.glyphCacheDirectory[i];
+	*position++ = '/';
+	for (int i = 60; i >= 0; i -= 4) *position++ = "0123456789abcdef"[(hash >> i) & 15];
+	const char *extension = ".glyphs";
+	while (*extension) *position++ = *extension++;
+
+	if (temporary) {
+		uint32_t id = _UIProcessID();
+		*position++ = '.';
+		for (int i = 28; i >= 0; i -= 4) *position++ = "0123456789abcdef"[(id >> i) & 15];
+	}
+
+	*position = 0;
+	return buffer;
+}
+
+void _UIFontUnmapGlyphFile(UIFont *font) {
+	if (font->glyphFile) _UIFileUnmap(font->glyphFile, font->glyphFileBytes);
+	font->glyphFile = NULL;
+	font->glyphFileBytes = 0;
+}
+
+void _UIFontMapGlyphFile(UIFont *font) {
+	uint64_t fontModified, fontBytes;
+	if (!_UIFileGetInformation(font->path, &fontModified, &fontBytes)) return;
+	char *cPath = _UIGlyphFilePath(font, false);
+	font->glyphFile = (const _UIGlyphFileHeader *) _UIFileMap(cPath, &font->glyphFileBytes);
+	UI_FREE(cPath);
+	if (!font->glyphFile) return;
+
+	const _UIGlyphFileHeader *header = font->glyphFile;
+	bool valid = font->glyphFileBytes >= sizeof(_UIGlyphFileHeader)
+		&& header->magic == _UI_GLYPH_FILE_MAGIC && header->version == _UI_GLYPH_FILE_VERSION
+		&& header->freetypeVersion == FREETYPE_MAJOR * 10000 + FREETYPE_MINOR * 100 + FREETYPE_PATCH
+		&& header->channels == _UI_GLYPH_CHANNELS && header->size == font->size
+		&& header->fontModified == fontModified && header->fontBytes == fontBytes
+		&& header->metricsOffset >= sizeof(_UIGlyphFileHeader) + header->pathBytes && (~header->metricsOffset & 1)
+		&& header->recordsOffset >= header->metricsOffset + sizeof(font->advances) 
+			+ ((header->flags & _UI_GLYPH_FILE_KERNING) ? 128 * 128 : 0)
+		&& header->recordsOffset + (uint64_t) header->glyphCount * sizeof(_UIGlyphFileRecord) <= font->glyphFileBytes;
+
+	for (uintptr_t i = 0; valid && i <= header->pathBytes; i++) {
+		char c = i == header->pathBytes ? 0 : ((const char *) (header + 1))[i];
+		if (c != font->path[i]) valid = false;
+	}
+
+	if (!valid) _UIFontUnmapGlyphFile(font);
+}
+
+const _UIGlyphFileRecord *_UIFontFindGlyphFileRecord(UIFont *font, uint32_t codePoint) {
+	if (!font->glyphFile) return NULL;
+	const _UIGlyphFileRecord *records = (const _UIGlyphFileRecord *) ((const uint8_t *) font->glyphFile + font->glyphFile->recordsOffset);
+	uintptr_t first = 0, last = font->glyphFile->glyphCount;
+
+	while (first < last) {
+		uintptr_t middle = (first + last) / 2;
+		if (records[middle].codePoint < codePoint) first = middle + 1;
+		else last = middle;
+	}
+
+	if (first == font->glyphFile->glyphCount || records[first].codePoint != codePoint) return NULL;
+	const _UIGlyphFileRecord *record = records + first;
+	if (record->width > 0xFFFF || record->height > 0xFFFF) return NULL;
+	if (record->offsetX < -0xFFFF || record->offsetX > 0xFFFF || record->offsetY < -0xFFFF || record->offsetY > 0xFFFF) return NULL;
+	if (record->coverage + (uint64_t) record->width * _UI_GLYPH_CHANNELS * record->height > font->glyphFileBytes) return NULL;
+	return record;
+}
+
+typedef struct _UIGlyphSaved {
+	uint32_t codePoint;
+	int offsetX, offsetY, width, height, pitch;
+	const uint8_t *coverage;
+} _UIGlyphSaved;
+
+void _UIFontSaveGlyphFile(UIFont *font) {
+	// Write the glyphs in the memory cache along with those from the old file, since the memory cache may have evicted some.
+	uint64_t fontModified, fontBytes;
+	if (!_UIFileGetInformation(font->path, &fontModified, &fontBytes)) return;
+	if (font->warmUp) _UIFontWarmUpMerge(font, true);
+
+	size_t fileGlyphCount = font->glyphFile ? font->glyphFile->glyphCount : 0;
+	_UIGlyphSaved *glyphs = (_UIGlyphSaved *) UI_MALLOC(sizeof(_UIGlyphSaved) * (ui.glyphCache.glyphs + fileGlyphCount + 1));
+	size_t glyphCount = 0, coverageBytes = 0;
+
+	for (uintptr_t i = 0; i < ui.glyphSlotCount; i++) {
+		for (_UIGlyph *glyph = ui.glyphSlots[i]; glyph; glyph = glyph->hashNext) {
+			if (glyph->font != font || glyph->size != font->size) continue;
+			_UIGlyphSaved *saved = glyphs + glyphCount++;
+			saved->codePoint = glyph->codePoint, saved->offsetX = glyph->offsetX, saved->offsetY = glyph->offsetY;
+			saved->width = glyph->width, saved->height = glyph->height, saved->pitch = glyph->page->stride;
+			saved->coverage = glyph->page->coverage + glyph->y * glyph->page->stride + glyph->x * _UI_GLYPH_CHANNELS;
+		}
+	}
+
+	for (uintptr_t i = 0; i < fileGlyphCount; i++) {
+		const _UIGlyphFileRecord *record = (const _UIGlyphFileRecord *) ((const uint8_t *) font->glyphFile + font->glyphFile->recordsOffset) + i;
+		if (record != _UIFontFindGlyphFileRecord(font, record->codePoint)) continue;
+		if (_UIGlyphFind(font, record->codePoint, font->size, _UIGlyphHash(font, record->codePoint, font->size))) continue;
+		_UIGlyphSaved *saved = glyphs + glyphCount++;
+		saved->codePoint = record->codePoint, saved->offsetX = record->offsetX, saved->offsetY = record->offsetY;
+		saved->width = record->width, saved->height = record->height, saved->pitch = record->width * _UI_GLYPH_CHANNELS;
+		saved->coverage = (const uint8_t *) font->glyphFile + record->coverage;
+	}
+
+	for (uintptr_t gap = glyphCount / 2; gap; gap /= 2) {
+		for (uintptr_t i = gap; i < glyphCount; i++) {
+			_UIGlyphSaved saved = glyphs[i];
+			uintptr_t j = i;
+			for (; j >= gap && glyphs[j - gap].codePoint > saved.codePoint; j -= gap) glyphs[j] = glyphs[j - gap];
+			glyphs[j] = saved;
+		}
+	}
+
+	for (uintptr_t i = 0; i < glyphCount; i++) coverageBytes += glyphs[i].width * _UI_GLYPH_CHANNELS * glyphs[i].height;
+	size_t pathBytes = 0;
+	while (font->path[pathBytes]) pathBytes++;
+	size_t metricsOffset = (sizeof(_UIGlyphFileHeader) + pathBytes + 7) & ~(size_t) 7;
+	size_t recordsOffset = (metricsOffset + sizeof(font->advances) + (font->kerning ? 128 * 128 : 0) + 7) & ~(size_t) 7;
+	size_t coverageOffset = recordsOffset + glyphCount * sizeof(_UIGlyphFileRecord);
+	size_t bytes = coverageOffset + coverageBytes;
+	uint8_t *buffer = (uint8_t *) UI_CALLOC(bytes);
+
+	_UIGlyphFileHeader *header = (_UIGlyphFileHeader *) buffer;
+	header->magic = _UI_GLYPH_FILE_MAGIC;
+	header->version = _UI_GLYPH_FILE_VERSION;
+	header->freetypeVersion = FREETYPE_MAJOR * 10000 + FREETYPE_MINOR * 100 + FREETYPE_PATCH;
+	header->channels = _UI_GLYPH_CHANNELS;
+	header->size = font->size;
+	header->glyphWidth = font->glyphWidth;
+	header->glyphHeight = font->glyphHeight;
+	header->pathBytes = pathBytes;
+	header->glyphCount = glyphCount;
+	header->recordsOffset = recordsOffset;
+	header->flags = (font->proportional ? _UI_GLYPH_FILE_PROPORTIONAL : 0) | (font->kerning ? _UI_GLYPH_FILE_KERNING : 0);
+	header->metricsOffset = metricsOffset;
+	header->fontModified = fontModified;
+	header->fontBytes = fontBytes;
+	for (uintptr_t i = 0; i < pathBytes; i++) buffer[sizeof(_UIGlyphFileHeader) + i] = font->path[i];
+	for (uintptr_t i = 0; i < 128; i++) ((int16_t *) (buffer + metricsOffset))[i] = font->advances[i];
+	for (uintptr_t i = 0; font->kerning && i < 128 * 128; i++) ((int8_t *) (buffer + metricsOffset + sizeof(font->advances)))[i] = font->kerning[i];
+
+	_UIGlyphFileRecord *records = (_UIGlyphFileRecord *) (buffer + recordsOffset);
+	uint8_t *coverage = buffer + coverageOffset;
+
+	for (uintptr_t i = 0; i < glyphCount; i++) {
+		_UIGlyphSaved *saved = glyphs + i;
+		_UIGlyphFileRecord *record = records + i;
+		record->codePoint = saved->codePoint, record->coverage = coverage - buffer;
+		record->offsetX = saved->offsetX, record->offsetY = saved->offsetY;
+		record->width = saved->width, record->height = saved->height;
+
+		for (int y = 0; y < saved->height; y++) {
+			for (int x = 0; x < saved->width * _UI_GLYPH_CHANNELS; x++) {
+				*coverage++ = saved->coverage[y * saved->pitch + x];
+			}
 		}
 	}
 
-	element->parent = newParent;
-	element->window = newParent->window;
+	UI_FREE(glyphs);
+	_UIFontUnmapGlyphFile(font); // Windows can't replace a mapped file.
+	char *cPath = _UIGlyphFilePath(font, false);
+	char *cTemporaryPath = _UIGlyphFilePath(font, true);
+	if (_UIFileReplace(cPath, cTemporaryPath, buffer, bytes)) font->glyphFileDirty = false;
+	UI_FREE(cTemporaryPath);
+	UI_FREE(cPath);
+	UI_FREE(buffer);
+	_UIFontMapGlyphFile(font);
 }
+#endif
 
-UIElement *UIElementCreate(size_t bytes, UIElement *parent, uint32_t flags, int (*message)(UIElement *, UIMessage, int, void *), const char *cClassName) {
-	UI_ASSERT(bytes >= sizeof(UIElement));
-	UIElement *element = (UIElement *) UI_CALLOC(bytes);
-	element->flags = flags;
-	element->messageClass = message;
+bool _UIFontOpenFace(UIFont *font) {
+	if (font->font) return true;
+	if (FT_New_Face(ui.ft, font->path, 0, &font->font)) return (font->font = NULL, false);
+	FT_Set_Char_Size(font->font, 0, font->size * 64, 100, 100);
+	return true;
+}
 
-	if (!parent && (~flags & UI_ELEMENT_WINDOW)) {
-		UI_ASSERT(ui.parentStackCount);
-		parent = ui.parentStack[ui.parentStackCount - 1];
+int _UIFontAdvance(UIFont *font, char c) {
+	int i = c < 0 ? '?' : c == '\r' ? ' ' : c; // Matching UIDrawGlyph.
+
+	if (font->advances[i] == -1) {
+		if (_UIFontOpenFace(font) && !FT_Load_Char(font->font, _UIGlyphMapCharacter(i), FT_LOAD_DEFAULT)) {
+			font->advances[i] = font->font->glyph->advance.x / 64;
+		} else {
+			font->advances[i] = font->glyphWidth;
+		}
+
+		font->glyphFileDirty = true;
 	}
 
-	if ((~flags & UI_ELEMENT_NON_CLIENT) && parent) {
-		UIElementMessage(parent, UI_MSG_CLIENT_PARENT, 0, &parent);
+	return font->advances[i];
+}
+
+int _UIFontKerning(UIFont *font, char left, char right) {
+	if (!font->kerning || left == '\t' || right == '\t') return 0;
+	int l = left < 0 ? '?' : left == '\r' ? ' ' : left;
+	int r = right < 0 ? '?' : right == '\r' ? ' ' : right;
+	int8_t *pair = font->kerning + l * 128 + r;
+
+	if (*pair == -128) {
+		FT_Vector delta = { 0 };
+
+		if (_UIFontOpenFace(font)) {
+			FT_Get_Kerning(font->font, FT_Get_Char_Index(font->font, _UIGlyphMapCharacter(l)), 
+					FT_Get_Char_Index(font->font, _UIGlyphMapCharacter(r)), FT_KERNING_DEFAULT, &delta);
+		}
+
+		int kerning = delta.x / 64;
+		*pair = kerning < -127 ? -127 : kerning > 127 ? 127 : kerning;
+		font->glyphFileDirty = true;
 	}
 
-	if (parent) {
-		element->window = parent->window;
-		element->parent = parent;
+	return *pair;
+}
 
-		if (parent->children) {
-			UIElement *sibling = parent->children;
+_UIGlyph *_UIGlyphLookup(UIFont *font, uint32_t codePoint) {
+	uint32_t hash = _UIGlyphHash(font, codePoint, font->size);
+	_UIGlyph *glyph = _UIGlyphFind(font, codePoint, font->size, hash);
 
-			while (sibling->next) {
-				sibling = sibling->next;
-			}
+#ifdef _UI_THREADS
+	if (!glyph && font->warmUp) {
+		_UIFontWarmUpMerge(font, false);
+		glyph = _UIGlyphFind(font, codePoint, font->size, hash);
+	}
+#endif
 
-			sibling->next = element;
-		} else {
-			parent->children = element;
+	if (glyph) {
+		ui.glyphCache.hits++;
+
+		if (glyph->page != ui.glyphPagesNewest) {
+			_UIGlyphPageUnlink(glyph->page);
+			_UIGlyphPageLinkNewest(glyph->page);
 		}
 
-		UI_ASSERT(~parent->flags & UI_ELEMENT_DESTROY);
+		return glyph;
 	}
 
-	element->cClassName = cClassName;
-	static uint32_t id = 0;
-	element->id = ++id;
+	ui.glyphCache.misses++;
 
-#ifdef UI_DEBUG
-	_UIInspectorRefresh();
+#ifdef _UI_GLYPH_FILES
+	const _UIGlyphFileRecord *record = _UIFontFindGlyphFileRecord(font, codePoint);
+
+	if (record) {
+		ui.glyphCache.fileLoads++;
+		return _UIGlyphInsert(font, codePoint, font->size, hash, record->offsetX, record->offsetY, record->width, record->height, 
+				(const uint8_t *) font->glyphFile + record->coverage, record->width * _UI_GLYPH_CHANNELS);
+	}
 #endif
 
-	if (flags & UI_ELEMENT_PARENT_PUSH) {
-		UIParentPush(element);
+	if (!_UIFontOpenFace(font)) {
+		return _UIGlyphInsert(font, codePoint, font->size, hash, 0, 0, 0, 0, NULL, 0);
 	}
 
-	return element;
+	_UIGlyphRender(font->font, codePoint);
+	FT_GlyphSlot slot = font->font->glyph;
+	font->glyphFileDirty = true;
+	return _UIGlyphInsert(font, codePoint, font->size, hash, slot->bitmap_left, font->font->size->metrics.ascender / 64 - slot->bitmap_top, 
+			slot->bitmap.width / _UI_GLYPH_CHANNELS, slot->bitmap.rows, (const uint8_t *) slot->bitmap.buffer, slot->bitmap.pitch);
 }
 
-UIElement *UIParentPush(UIElement *element) {
-	UI_ASSERT(ui.parentStackCount != sizeof(ui.parentStack) / sizeof(ui.parentStack[0]));
-	ui.parentStack[ui.parentStackCount++] = element;
-	return element;
+void UIGlyphCacheSetBudget(size_t maximumBytes) {
+	ui.glyphCacheBudget = maximumBytes;
+	_UIGlyphCacheTrim(NULL);
 }
 
-UIElement *UIParentPop() {
-	UI_ASSERT(ui.parentStackCount);
-	ui.parentStackCount--;
-	return ui.parentStack[ui.parentStackCount];
+UIGlyphCacheStatistics UIGlyphCacheGetStatistics() {
+	return ui.glyphCache;
 }
 
-int _UIPanelMeasure(UIPanel *panel) {
-	bool horizontal = panel->e.flags & UI_PANEL_HORIZONTAL;
-	int size = 0;
-	UIElement *child = panel->e.children;
+void UIGlyphCacheSetDirectory(const char *cPath) {
+	ui.glyphCacheDirectory = cPath;
+}
 
-	while (child) {
-		if (~child->flags & UI_ELEMENT_HIDE) {
-			if (horizontal) {
-				int height = UIElementMessage(child, UI_MSG_GET_HEIGHT, 0, 0);
+void UIGlyphCacheSave() {
+#ifdef _UI_GLYPH_FILES
+	if (!ui.glyphCacheDirectory) return;
 
-				if (height > size) {
-					size = height;
-				}
-			} else {
-				int width = UIElementMessage(child, UI_MSG_GET_WIDTH, 0, 0);
+	for (UIFont *font = ui.fonts; font; font = font->next) {
+		if (font->glyphFileDirty) _UIFontSaveGlyphFile(font);
+	}
+#endif
+}
 
-				if (width > size) {
-					size = width;
-				}
-			}
-		}
+void _UIDrawGlyphCoverage(UIPainter *painter, int x0, int y0, _UIGlyph *glyph, uint32_t color) {
+	_UIGlyphPage *page = glyph->page;
+	x0 += glyph->offsetX, y0 += glyph->offsetY;
 
-		child = child->next;
-	}
+	for (int y = 0; y < glyph->height; y++) {
+		if (y0 + y < painter->clip.t) continue;
+		if (y0 + y >= painter->clip.b) break;
 
-	int border = 0;
+		const uint8_t *coverage = page->coverage + (glyph->y + y) * page->stride + glyph->x * _UI_GLYPH_CHANNELS;
 
-	if (horizontal) {
-		border = panel->border.t + panel->border.b;
-	} else {
-		border = panel->border.l + panel->border.r;
-	}
+		for (int x = 0; x < glyph->width; x++) {
+			if (x0 + x < painter->clip.l) continue;
+			if (x0 + x >= painter->clip.r) break;
 
-	return size + border * panel->e.window->scale;
+			uint32_t *destination = painter->bits + (x0 + x) + (y0 + y) * painter->width;
+			uint32_t original = *destination;
+
+#ifdef UI_FREETYPE_SUBPIXEL
+			uint32_t ra = coverage[x * 3 + 0];
+			uint32_t ga = coverage[x * 3 + 1];
+			uint32_t ba = coverage[x * 3 + 2];
+			ra += (ga - ra) / 2, ba += (ga - ba) / 2;
+#else
+			uint32_t ra = coverage[x];
+			uint32_t ga = ra, ba = ra;
+#endif
+			uint32_t r2 = (255 - ra) * ((original & 0x000000FF) >> 0);
+			uint32_t g2 = (255 - ga) * ((original & 0x0000FF00) >> 8);
+			uint32_t b2 = (255 - ba) * ((original & 0x00FF0000) >> 16);
+			uint32_t r1 = ra * ((color & 0x000000FF) >> 0);
+			uint32_t g1 = ga * ((color & 0x0000FF00) >> 8);
+			uint32_t b1 = ba * ((color & 0x00FF0000) >> 16);
+
+			uint32_t result = 0xFF000000 | (0x00FF0000 & ((b1 + b2) << 8)) 
+				| (0x0000FF00 & ((g1 + g2) << 0)) 
+				| (0x000000FF & ((r1 + r2) >> 8));
+			*destination = result;
+		}
+	}
 }
+#endif
 
-int _UIPanelLayout(UIPanel *panel, UIRectangle bounds, bool measure) {
-	bool horizontal = panel->e.flags & UI_PANEL_HORIZONTAL;
-	float scale = panel->e.window->scale;
-	int position = (horizontal ? panel->border.l : panel->border.t) * scale;
-	if (panel->scrollBar && !measure) position -= panel->scrollBar->position;
-	int hSpace = UI_RECT_WIDTH(bounds) - UI_RECT_TOTAL_H(panel->border) * scale;
-	int vSpace = UI_RECT_HEIGHT(bounds) - UI_RECT_TOTAL_V(panel->border) * scale;
+void UIDrawGlyph(UIPainter *painter, int x0, int y0, int c, uint32_t color) {
+#ifdef UI_FREETYPE
+	UIFont *font = ui.activeFont;
 
-	int available = horizontal ? hSpace : vSpace;
-	int fill = 0, count = 0, perFill = 0;
+	if (font->isFreeType) {
+		if (c < 0 || c > 0x10FFFF) c = '?';
+		if (c == '\r') c = ' ';
+		_UIDrawGlyphCoverage(painter, x0, y0, _UIGlyphLookup(font, c), color);
+		return;
+	}
+#endif
 
-	for (UIElement *child = panel->e.children; child; child = child->next) {
-		if (child->flags & (UI_ELEMENT_HIDE | UI_ELEMENT_NON_CLIENT)) {
-			continue;
-		}
+	if (c < 0 || c > 127) c = '?';
 
-		count++;
+	UIRectangle rectangle = UIRectangleIntersection(painter->clip, UI_RECT_4(x0, x0 + 8, y0, y0 + 16));
 
-		if (horizontal) {
-			if (child->flags & UI_ELEMENT_H_FILL) {
-				fill++;
-			} else if (available > 0) {
-				available -= UIElementMessage(child, UI_MSG_GET_WIDTH, vSpace, 0);
-			}
-		} else {
-			if (child->flags & UI_ELEMENT_V_FILL) {
-				fill++;
-			} else if (available > 0) {
-				available -= UIElementMessage(child, UI_MSG_GET_HEIGHT, hSpace, 0);
+	const uint8_t *data = (const uint8_t *) _uiFont + c * 16;
+
+	for (int i = rectangle.t; i < rectangle.b; i++) {
+		uint32_t *bits = painter->bits + i * painter->width + rectangle.l;
+		uint8_t byte = data[i - y0];
+
+		for (int j = rectangle.l; j < rectangle.r; j++) {
+			if (byte & (1 << (j - x0))) {
+				*bits = color;
 			}
+
+			bits++;
 		}
 	}
+}
 
-	if (count) {
-		available -= (count - 1) * (int) (panel->gap * scale);
+ptrdiff_t _UIStringLength(const char *cString) {
+	if (!cString) return 0;
+	ptrdiff_t length;
+	for (length = 0; cString[length]; length++);
+	return length;
+}
+
+char *UIStringCopy(const char *in, ptrdiff_t inBytes) {
+	if (inBytes == -1) {
+		inBytes = _UIStringLength(in);
 	}
 
-	if (available > 0 && fill) {
-		perFill = available / fill;
+	char *buffer = (char *) UI_MALLOC(inBytes + 1);
+	
+	for (intptr_t i = 0; i < inBytes; i++) {
+		buffer[i] = in[i];
 	}
+	
+	buffer[inBytes] = 0;
+	return buffer;
+}
 
-	bool expand = panel->e.flags & UI_PANEL_EXPAND;
-	int scaledBorder2 = (horizontal ? panel->border.t : panel->border.l) * panel->e.window->scale;
+ptrdiff_t _UIStringSkipColumns(const char *string, ptrdiff_t bytes, int columns, int tabSize, int *column) {
+	// Returns the index of the first byte at or after the given column, and updates *column to its column.
+	ptrdiff_t i = 0;
+	int ti = *column;
 
-	for (UIElement *child = panel->e.children; child; child = child->next) {
-		if (child->flags & (UI_ELEMENT_HIDE | UI_ELEMENT_NON_CLIENT)) {
+	while (i < bytes && ti < columns) {
+#ifdef UI_SSE2
+		if (ti + 16 <= columns && i + 16 <= bytes 
+				&& !_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (string + i)), _mm_set1_epi8('\t')))) {
+			i += 16, ti += 16;
 			continue;
 		}
+#endif
 
-		if (horizontal) {
-			int height = ((child->flags & UI_ELEMENT_V_FILL) || expand) ? vSpace : UIElementMessage(child, UI_MSG_GET_HEIGHT, 0, 0);
-			int width = (child->flags & UI_ELEMENT_H_FILL) ? perFill : UIElementMessage(child, UI_MSG_GET_WIDTH, height, 0);
-			UIRectangle relative = UI_RECT_4(position, position + width, 
-					scaledBorder2 + (vSpace - height) / 2, 
-					scaledBorder2 + (vSpace + height) / 2);
-			if (!measure) UIElementMove(child, UIRectangleTranslate(relative, bounds), false);
-			position += width + panel->gap * scale;
+		if (string[i] == '\t') {
+			ti++;
+			while (ti % tabSize) ti++;
 		} else {
-			int width = ((child->flags & UI_ELEMENT_H_FILL) || expand) ? hSpace : UIElementMessage(child, UI_MSG_GET_WIDTH, 0, 0);
-			int height = (child->flags & UI_ELEMENT_V_FILL) ? perFill : UIElementMessage(child, UI_MSG_GET_HEIGHT, width, 0);
-			UIRectangle relative = UI_RECT_4(scaledBorder2 + (hSpace - width) / 2, 
-					scaledBorder2 + (hSpace + width) / 2, position, position + height);
-			if (!measure) UIElementMove(child, UIRectangleTranslate(relative, bounds), false);
-			position += height + panel->gap * scale;
+			ti++;
 		}
+
+		i++;
 	}
 
-	return position - panel->gap * scale + (horizontal ? panel->border.r : panel->border.b) * scale;
+	*column = ti;
+	return i;
 }
 
-int _UIPanelMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UIPanel *panel = (UIPanel *) element;
-	bool horizontal = element->flags & UI_PANEL_HORIZONTAL;
+#ifdef UI_FREETYPE
+#define _UI_STRING_WIDTH_CACHE_SIZE (256)
 
-	if (message == UI_MSG_LAYOUT) {
-		int scrollBarWidth = panel->scrollBar ? (UI_SIZE_SCROLL_BAR * element->window->scale) : 0;
-		UIRectangle bounds = element->bounds;
-		bounds.r -= scrollBarWidth;
+typedef struct _UIStringWidth {
+	UIFont *font;
+	uint32_t size;
+	int width;
+	ptrdiff_t bytes;
+	uint64_t hash;
+} _UIStringWidth;
 
-		if (panel->scrollBar) {
-			UIRectangle scrollBarBounds = element->bounds;
-			scrollBarBounds.l = scrollBarBounds.r - scrollBarWidth;
-			panel->scrollBar->maximum = _UIPanelLayout(panel, bounds, true);
-			panel->scrollBar->page = UI_RECT_HEIGHT(element->bounds);
-			UIElementMove(&panel->scrollBar->e, scrollBarBounds, true);
-		}
+int _UIMeasureStringProportional(UIFont *font, const char *string, ptrdiff_t bytes) {
+	// Tabs go to the next multiple of 4 glyphWidths, like UIDrawString.
+	int x = 0, tabStop = font->glyphWidth * 4;
 
-		_UIPanelLayout(panel, bounds, false);
-	} else if (message == UI_MSG_GET_WIDTH) {
-		if (horizontal) {
-			return _UIPanelLayout(panel, UI_RECT_4(0, 0, 0, di), true);
-		} else {
-			return _UIPanelMeasure(panel);
-		}
-	} else if (message == UI_MSG_GET_HEIGHT) {
-		if (horizontal) {
-			return _UIPanelMeasure(panel);
+	for (ptrdiff_t i = 0; i < bytes; i++) {
+		if (string[i] == '\t') {
+			x += tabStop - x % tabStop;
 		} else {
-			int width = di && panel->scrollBar ? (di - UI_SIZE_SCROLL_BAR * element->window->scale) : di;
-			return _UIPanelLayout(panel, UI_RECT_4(0, width, 0, 0), true);
-		}
-	} else if (message == UI_MSG_PAINT) {
-		if (element->flags & UI_PANEL_GRAY) {
-			UIDrawBlock((UIPainter *) dp, element->bounds, ui.theme.panel1);
-		} else if (element->flags & UI_PANEL_WHITE) {
-			UIDrawBlock((UIPainter *) dp, element->bounds, ui.theme.panel2);
-		} 
-		
-		if (element->flags & UI_PANEL_BORDER) {
-			UIDrawBorder((UIPainter *) dp, element->bounds, ui.theme.border, UI_RECT_1((int) element->window->scale));
+			if (i) x += _UIFontKerning(font, string[i - 1], string[i]);
+			x += _UIFontAdvance(font, string[i]);
 		}
-	} else if (message == UI_MSG_MOUSE_WHEEL && panel->scrollBar) {
-		return UIElementMessage(&panel->scrollBar->e, message, di, dp);
-	} else if (message == UI_MSG_SCROLLED) {
-		UIElementRefresh(element);
 	}
 
-	return 0;
+	return x;
 }
 
-UIPanel *UIPanelCreate(UIElement *parent, uint32_t flags) {
-	UIPanel *panel = (UIPanel *) UIElementCreate(sizeof(UIPanel), parent, flags, _UIPanelMessage, "Panel");
+uint64_t _UIStringHash(UIFont *font, const char *string, ptrdiff_t bytes) {
+	uint64_t hash = 0xCBF29CE484222325ULL ^ (uint64_t) (uintptr_t) font;
+	for (ptrdiff_t i = 0; i < bytes; i++) hash = (hash ^ (uint8_t) string[i]) * 0x100000001B3ULL;
+	return hash;
+}
+#endif
+
+int UIMeasureStringWidth(const char *string, ptrdiff_t bytes) {
+	if (bytes == -1) {
+		bytes = _UIStringLength(string);
+	}
+
+#ifdef UI_FREETYPE
+	UIFont *font = ui.activeFont;
+
+	if (font->isFreeType && font->proportional) {
+		// Labels are measured on every layout, so the widths of recently measured strings are kept.
+		uint64_t hash = _UIStringHash(font, string, bytes);
+
+		if (!ui.stringWidths) {
+			ui.stringWidths = (_UIStringWidth *) UI_CALLOC(sizeof(_UIStringWidth) * _UI_STRING_WIDTH_CACHE_SIZE);
+		}
+
+		_UIStringWidth *entry = ui.stringWidths + ((hash ^ (hash >> 32)) & (_UI_STRING_WIDTH_CACHE_SIZE - 1));
+
+		if (entry->font != font || entry->size != font->size || entry->bytes != bytes || entry->hash != hash) {
+			entry->font = font, entry->size = font->size, entry->bytes = bytes, entry->hash = hash;
+			entry->width = _UIMeasureStringProportional(font, string, bytes);
+		}
+
+		return entry->width;
+	}
+#endif
+	
+	return bytes * ui.activeFont->glyphWidth;
+}
+
+int UIMeasureStringHeight() {
+	return ui.activeFont->glyphHeight;
+}
+
+#ifdef UI_FREETYPE
+#define _UI_TEXT_RUN_CACHE_SIZE (128)
+#define _UI_TEXT_RUN_MAXIMUM_BYTES (64)
+
+typedef struct _UITextRun {
+	UIFont *font;
+	uint32_t size;
+	int width, glyphCount;
+	ptrdiff_t bytes;
+	uint64_t hash;
+	uint64_t evictions; // The glyph pointers are only valid until the glyph cache next evicts a page.
+	_UIGlyph *glyphs[_UI_TEXT_RUN_MAXIMUM_BYTES];
+	int positions[_UI_TEXT_RUN_MAXIMUM_BYTES]; // Pen position of each glyph from the start of the run.
+} _UITextRun;
+
+_UITextRun *_UITextRunGet(UIFont *font, const char *string, ptrdiff_t bytes) {
+	// Labels, buttons and menu items draw the same short strings on every paint,
+	// so their glyphs and pen positions are kept and replayed without any lookups.
+
+	uint64_t hash = _UIStringHash(font, string, bytes);
+
+	if (!ui.textRuns) {
+		ui.textRuns = (_UITextRun *) UI_CALLOC(sizeof(_UITextRun) * _UI_TEXT_RUN_CACHE_SIZE);
+	}
+
+	_UITextRun *run = ui.textRuns + ((hash ^ (hash >> 32)) & (_UI_TEXT_RUN_CACHE_SIZE - 1));
+
+	if (run->font == font && run->size == font->size && run->bytes == bytes 
+			&& run->hash == hash && run->evictions == ui.glyphCache.evictions) {
+		for (int i = 0; i < run->glyphCount; i++) {
+			if (run->glyphs[i]->page != ui.glyphPagesNewest) {
+				_UIGlyphPageUnlink(run->glyphs[i]->page);
+				_UIGlyphPageLinkNewest(run->glyphs[i]->page);
+			}
+		}
+
+		return run;
+	}
+
+	uint64_t evictions = ui.glyphCache.evictions;
+	int x = 0, column = 0, tabStop = font->glyphWidth * 4;
+	run->font = NULL;
+	run->width = UIMeasureStringWidth(string, bytes);
+	run->glyphCount = 0;
+
+	for (ptrdiff_t i = 0; i < bytes; i++) {
+		char c = string[i];
+
+		if (c == '\t') {
+			if (font->proportional) x += tabStop - x % tabStop;
+			else do x += font->glyphWidth, column++; while (column & 3);
+			continue;
+		}
+
+		if (font->proportional && i) x += _UIFontKerning(font, string[i - 1], c);
+		run->positions[run->glyphCount] = x;
+		run->glyphs[run->glyphCount++] = _UIGlyphLookup(font, c < 0 ? '?' : c == '\r' ? ' ' : c);
+		x += font->proportional ? _UIFontAdvance(font, c) : font->glyphWidth;
+		column++;
+	}
+
+	if (ui.glyphCache.evictions != evictions) {
+		// Making room for a later glyph evicted an earlier one.
+		return NULL;
+	}
+
+	run->font = font, run->size = font->size, run->bytes = bytes, run->hash = hash, run->evictions = evictions;
+	return run;
+}
+
+void _UITextRunDraw(UIPainter *painter, _UITextRun *run, int x, int y, uint32_t color) {
+	for (int i = 0; i < run->glyphCount; i++) {
+		int x0 = x + run->positions[i];
+		_UIGlyph *glyph = run->glyphs[i];
+		if (x0 >= painter->clip.r + run->font->glyphWidth) break;
+		if (x0 + glyph->offsetX + glyph->width <= painter->clip.l) continue;
+		_UIDrawGlyphCoverage(painter, x0, y, glyph, color);
+	}
+}
+#endif
+
+void UIDrawString(UIPainter *painter, UIRectangle r, const char *string, ptrdiff_t bytes, uint32_t color, int align, UIStringSelection *selection) {
+	UIRectangle oldClip = painter->clip;
+	painter->clip = UIRectangleIntersection(r, oldClip);
+
+	if (!UI_RECT_VALID(painter->clip)) {
+		painter->clip = oldClip;
+		return;
+	}
+
+	if (bytes == -1) {
+		bytes = _UIStringLength(string);
+	}
+
+#ifdef UI_FREETYPE
+	_UITextRun *run = !selection && ui.activeFont->isFreeType && bytes <= _UI_TEXT_RUN_MAXIMUM_BYTES 
+		? _UITextRunGet(ui.activeFont, string, bytes) : NULL;
+	int width = run ? run->width : UIMeasureStringWidth(string, bytes);
+#else
+	int width = UIMeasureStringWidth(string, bytes);
+#endif
+	int height = UIMeasureStringHeight();
+	int x = align == UI_ALIGN_CENTER ? ((r.l + r.r - width) / 2) : align == UI_ALIGN_RIGHT ? (r.r - width) : r.l;
+	int y = (r.t + r.b - height) / 2;
+	int i = 0, j = 0;
+	int glyphWidth = ui.activeFont->glyphWidth;
+#ifdef UI_FREETYPE
+	if (run) {
+		_UITextRunDraw(painter, run, x, y, color);
+		painter->clip = oldClip;
+		return;
+	}
+
+	UIFont *font = ui.activeFont;
+	bool proportional = font->isFreeType && font->proportional;
+	int x0 = x, tabStop = glyphWidth * 4;
+#else
+	bool proportional = false;
+#endif
+
+	if (!proportional && painter->clip.l - x > glyphWidth) {
+		// Skip the glyphs left of the clip, keeping one in case it overhangs.
+		ptrdiff_t skipped = _UIStringSkipColumns(string, bytes, (painter->clip.l - x) / glyphWidth - 1, 4, &i);
+		string += skipped, j = skipped, x += i * glyphWidth;
+	}
+
+	int selectFrom = -1, selectTo = -1;
+
+	if (selection) {
+		selectFrom = selection->carets[0];
+		selectTo = selection->carets[1];
+		
+		if (selectFrom > selectTo) {
+			UI_SWAP(int, selectFrom, selectTo);
+		}
+	}
+
+	for (; j < bytes && x < painter->clip.r + glyphWidth; j++) {
+		char c = *string++;
+		uint32_t colorText = color;
+		int advance = glyphWidth;
+
+#ifdef UI_FREETYPE
+		if (proportional && c == '\t') {
+			advance = tabStop - (x - x0) % tabStop;
+		} else if (proportional) {
+			if (j) x += _UIFontKerning(font, string[-2], c);
+			advance = _UIFontAdvance(font, c);
+		}
+#endif
+
+		if (j >= selectFrom && j < selectTo) {
+			UIDrawBlock(painter, UI_RECT_4(x, x + advance, y, y + height), selection->colorBackground);
+			colorText = selection->colorText;
+		}
+
+		if (c != '\t') {
+			UIDrawGlyph(painter, x, y, c, colorText);
+		}
+
+		if (selection && selection->carets[0] == j) {
+			UIDrawInvert(painter, UI_RECT_4(x, x + 1, y, y + height));
+		}
+
+		x += advance, i++;
+
+		if (c == '\t' && !proportional) {
+			while (i & 3) x += glyphWidth, i++;
+		}
+	}
+
+	if (selection && selection->carets[0] == j) {
+		UIDrawInvert(painter, UI_RECT_4(x, x + 1, y, y + height));
+	}
+
+	painter->clip = oldClip;
+}
+
+void UIDrawBorder(UIPainter *painter, UIRectangle r, uint32_t borderColor, UIRectangle borderSize) {
+	UIDrawBlock(painter, UI_RECT_4(r.l, r.r, r.t, r.t + borderSize.t), borderColor);
+	UIDrawBlock(painter, UI_RECT_4(r.l, r.l + borderSize.l, r.t + borderSize.t, r.b - borderSize.b), borderColor);
+	UIDrawBlock(painter, UI_RECT_4(r.r - borderSize.r, r.r, r.t + borderSize.t, r.b - borderSize.b), borderColor);
+	UIDrawBlock(painter, UI_RECT_4(r.l, r.r, r.b - borderSize.b, r.b), borderColor);
+}
+
+void UIDrawRectangle(UIPainter *painter, UIRectangle r, uint32_t mainColor, uint32_t borderColor, UIRectangle borderSize) {
+	UIDrawBorder(painter, r, borderColor, borderSize);
+	UIDrawBlock(painter, UI_RECT_4(r.l + borderSize.l, r.r - borderSize.r, r.t + borderSize.t, r.b - borderSize.b), mainColor);
+}
+
+void UIElementMove(UIElement *element, UIRectangle bounds, bool alwaysLayout) {
+	UIRectangle oldClip = element->clip;
+	element->clip = UIRectangleIntersection(element->parent->clip, bounds);
+
+	if (!UIRectangleEquals(element->bounds, bounds) || !UIRectangleEquals(element->clip, oldClip) || alwaysLayout) {
+		element->bounds = bounds;
+		UIElementMessage(element, UI_MSG_LAYOUT, 0, 0);
+	}
+}
+
+int UIElementMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	if (message != UI_MSG_DESTROY && (element->flags & UI_ELEMENT_DESTROY)) {
+		return 0;
+	}
+
+	if (message >= UI_MSG_INPUT_EVENTS_START && message <= UI_MSG_INPUT_EVENTS_END && (element->flags & UI_ELEMENT_DISABLED)) {
+		return 0;
+	}
+
+#ifdef UI_FREETYPE
+	if (element->window && element->window->scale != ui.fontScale) {
+		// Text is measured and drawn at the scale of the element's window.
+		float previousScale = _UIFontScaleEnter(element->window);
+		int result = UIElementMessage(element, message, di, dp);
+		_UIFontScaleLeave(previousScale);
+		return result;
+	}
+#endif
+
+	if (element->messageUser) {
+		int result = element->messageUser(element, message, di, dp);
+
+		if (result) {
+			return result;
+		}
+	}
+
+	if (element->messageClass) {
+		return element->messageClass(element, message, di, dp);
+	} else {
+		return 0;
+	}
+}
+
+void UIElementChangeParent(UIElement *element, UIElement *newParent, UIElement *insertBefore) {
+	UIElement **link = &element->parent->children;
+
+	while (true) {
+		if (*link == element) {
+			*link = element->next;
+			break;
+		} else {
+			link = &(*link)->next;
+		}
+	}
+
+	link = &newParent->children;
+	element->next = insertBefore;
+
+	while (true) {
+		if ((*link) == insertBefore) {
+			*link = element;
+			break;
+		} else {
+			link = &(*link)->next;
+		}
+	}
+
+	element->parent = newParent;
+	element->window = newParent->window;
+}
+
+UIElement *UIElementCreate(size_t bytes, UIElement *parent, uint32_t flags, int (*message)(UIElement *, UIMessage, int, void *), const char *cClassName) {
+	UI_ASSERT(bytes >= sizeof(UIElement));
+	UIElement *element = (UIElement *) UI_CALLOC(bytes);
+	element->flags = flags;
+	element->messageClass = message;
+
+	if (!parent && (~flags & UI_ELEMENT_WINDOW)) {
+		UI_ASSERT(ui.parentStackCount);
+		parent = ui.parentStack[ui.parentStackCount - 1];
+	}
+
+	if ((~flags & UI_ELEMENT_NON_CLIENT) && parent) {
+		UIElementMessage(parent, UI_MSG_CLIENT_PARENT, 0, &parent);
+	}
+
+	if (parent) {
+		element->window = parent->window;
+		element->parent = parent;
+
+		if (parent->children) {
+			UIElement *sibling = parent->children;
+
+			while (sibling->next) {
+				sibling = sibling->next;
+			}
+
+			sibling->next = element;
+		} else {
+			parent->children = element;
+		}
+
+		UI_ASSERT(~parent->flags & UI_ELEMENT_DESTROY);
+	}
+
+	element->cClassName = cClassName;
+	static uint32_t id = 0;
+	element->id = ++id;
+
+#ifdef UI_DEBUG
+	_UIInspectorRefresh();
+#endif
+
+	if (flags & UI_ELEMENT_PARENT_PUSH) {
+		UIParentPush(element);
+	}
+
+	return element;
+}
+
+UIElement *UIParentPush(UIElement *element) {
+	UI_ASSERT(ui.parentStackCount != sizeof(ui.parentStack) / sizeof(ui.parentStack[0]));
+	ui.parentStack[ui.parentStackCount++] = element;
+	return element;
+}
+
+UIElement *UIParentPop() {
+	UI_ASSERT(ui.parentStackCount);
+	ui.parentStackCount--;
+	return ui.parentStack[ui.parentStackCount];
+}
+
+int _UIPanelMeasure(UIPanel *panel) {
+	bool horizontal = panel->e.flags & UI_PANEL_HORIZONTAL;
+	int size = 0;
+	UIElement *child = panel->e.children;
+
+	while (child) {
+		if (~child->flags & UI_ELEMENT_HIDE) {
+			if (horizontal) {
+				int height = UIElementMessage(child, UI_MSG_GET_HEIGHT, 0, 0);
+
+				if (height > size) {
+					size = height;
+				}
+			} else {
+				int width = UIElementMessage(child, UI_MSG_GET_WIDTH, 0, 0);
+
+				if (width > size) {
+					size = width;
+				}
+			}
+		}
+
+		child = child->next;
+	}
+
+	int border = 0;
+
+	if (horizontal) {
+		border = panel->border.t + panel->border.b;
+	} else {
+		border = panel->border.l + panel->border.r;
+	}
+
+	return size + border * panel->e.window->scale;
+}
+
+int _UIPanelLayout(UIPanel *panel, UIRectangle bounds, bool measure) {
+	bool horizontal = panel->e.flags & UI_PANEL_HORIZONTAL;
+	float scale = panel->e.window->scale;
+	int position = (horizontal ? panel->border.l : panel->border.t) * scale;
+	if (panel->scrollBar && !measure) position -= panel->scrollBar->position;
+	int hSpace = UI_RECT_WIDTH(bounds) - UI_RECT_TOTAL_H(panel->border) * scale;
+	int vSpace = UI_RECT_HEIGHT(bounds) - UI_RECT_TOTAL_V(panel->border) * scale;
+
+	int available = horizontal ? hSpace : vSpace;
+	int fill = 0, count = 0, perFill = 0;
+
+	for (UIElement *child = panel->e.children; child; child = child->next) {
+		if (child->flags & (UI_ELEMENT_HIDE | UI_ELEMENT_NON_CLIENT)) {
+			continue;
+		}
+
+		count++;
+
+		if (horizontal) {
+			if (child->flags & UI_ELEMENT_H_FILL) {
+				fill++;
+			} else if (available > 0) {
+				available -= UIElementMessage(child, UI_MSG_GET_WIDTH, vSpace, 0);
+			}
+		} else {
+			if (child->flags & UI_ELEMENT_V_FILL) {
+				fill++;
+			} else if (available > 0) {
+				available -= UIElementMessage(child, UI_MSG_GET_HEIGHT, hSpace, 0);
+			}
+		}
+	}
+
+	if (count) {
+		available -= (count - 1) * (int) (panel->gap * scale);
+	}
+
+	if (available > 0 && fill) {
+		perFill = available / fill;
+	}
+
+	bool expand = panel->e.flags & UI_PANEL_EXPAND;
+	int scaledBorder2 = (horizontal ? panel->border.t : panel->border.l) * panel->e.window->scale;
+
+	for (UIElement *child = panel->e.children; child; child = child->next) {
+		if (child->flags & (UI_ELEMENT_HIDE | UI_ELEMENT_NON_CLIENT)) {
+			continue;
+		}
+
+		if (horizontal) {
+			int height = ((child->flags & UI_ELEMENT_V_FILL) || expand) ? vSpace : UIElementMessage(child, UI_MSG_GET_HEIGHT, 0, 0);
+			int width = (child->flags & UI_ELEMENT_H_FILL) ? perFill : UIElementMessage(child, UI_MSG_GET_WIDTH, height, 0);
+			UIRectangle relative = UI_RECT_4(position, position + width, 
+					scaledBorder2 + (vSpace - height) / 2, 
+					scaledBorder2 + (vSpace + height) / 2);
+			if (!measure) UIElementMove(child, UIRectangleTranslate(relative, bounds), false);
+			position += width + panel->gap * scale;
+		} else {
+			int width = ((child->flags & UI_ELEMENT_H_FILL) || expand) ? hSpace : UIElementMessage(child, UI_MSG_GET_WIDTH, 0, 0);
+			int height = (child->flags & UI_ELEMENT_V_FILL) ? perFill : UIElementMessage(child, UI_MSG_GET_HEIGHT, width, 0);
+			UIRectangle relative = UI_RECT_4(scaledBorder2 + (hSpace - width) / 2, 
+					scaledBorder2 + (hSpace + width) / 2, position, position + height);
+			if (!measure) UIElementMove(child, UIRectangleTranslate(relative, bounds), false);
+			position += height + panel->gap * scale;
+		}
+	}
+
+	return position - panel->gap * scale + (horizontal ? panel->border.r : panel->border.b) * scale;
+}
+
+int _UIPanelMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UIPanel *panel = (UIPanel *) element;
+	bool horizontal = element->flags & UI_PANEL_HORIZONTAL;
+
+	if (message == UI_MSG_LAYOUT) {
+		int scrollBarWidth = panel->scrollBar ? (UI_SIZE_SCROLL_BAR * element->window->scale) : 0;
+		UIRectangle bounds = element->bounds;
+		bounds.r -= scrollBarWidth;
+
+		if (panel->scrollBar) {
+			UIRectangle scrollBarBounds = element->bounds;
+			scrollBarBounds.l = scrollBarBounds.r - scrollBarWidth;
+			panel->scrollBar->maximum = _UIPanelLayout(panel, bounds, true);
+			panel->scrollBar->page = UI_RECT_HEIGHT(element->bounds);
+			UIElementMove(&panel->scrollBar->e, scrollBarBounds, true);
+		}
+
+		_UIPanelLayout(panel, bounds, false);
+	} else if (message == UI_MSG_GET_WIDTH) {
+		if (horizontal) {
+			return _UIPanelLayout(panel, UI_RECT_4(0, 0, 0, di), true);
+		} else {
+			return _UIPanelMeasure(panel);
+		}
+	} else if (message == UI_MSG_GET_HEIGHT) {
+		if (horizontal) {
+			return _UIPanelMeasure(panel);
+		} else {
+			int width = di && panel->scrollBar ? (di - UI_SIZE_SCROLL_BAR * element->window->scale) : di;
+			return _UIPanelLayout(panel, UI_RECT_4(0, width, 0, 0), true);
+		}
+	} else if (message == UI_MSG_PAINT) {
+		if (element->flags & UI_PANEL_GRAY) {
+			UIDrawBlock((UIPainter *) dp, element->bounds, ui.theme.panel1);
+		} else if (element->flags & UI_PANEL_WHITE) {
+			UIDrawBlock((UIPainter *) dp, element->bounds, ui.theme.panel2);
+		} 
+		
+		if (element->flags & UI_PANEL_BORDER) {
+			UIDrawBorder((UIPainter *) dp, element->bounds, ui.theme.border, UI_RECT_1((int) element->window->scale));
+		}
+	} else if (message == UI_MSG_MOUSE_WHEEL && panel->scrollBar) {
+		return UIElementMessage(&panel->scrollBar->e, message, di, dp);
+	} else if (message == UI_MSG_SCROLLED) {
+		UIElementRefresh(element);
+	}
+
+	return 0;
+}
+
+UIPanel *UIPanelCreate(UIElement *parent, uint32_t flags) {
+	UIPanel *panel = (UIPanel *) UIElementCreate(sizeof(UIPanel), parent, flags, _UIPanelMessage, "Panel");
 
 	if (flags & UI_PANEL_MEDIUM_SPACING) {
 		panel->border = UI_RECT_1(UI_SIZE_PANE_MEDIUM_BORDER);
@@ -1764,1185 +3054,3792 @@ UIPanel *UIPanelCreate(UIElement *parent, uint32_t flags) {
 		panel->gap = UI_SIZE_PANE_SMALL_GAP;
 	}
 
-	if (flags & UI_PANEL_SCROLL) {
-		panel->scrollBar = UIScrollBarCreate(&panel->e, UI_ELEMENT_NON_CLIENT);
+	if (flags & UI_PANEL_SCROLL) {
+		panel->scrollBar = UIScrollBarCreate(&panel->e, UI_ELEMENT_NON_CLIENT);
+	}
+
+	return panel;
+}
+
+void _UIWrapPanelLayoutRow(UIWrapPanel *panel, UIElement *child, UIElement *rowEnd, int rowY, int rowHeight) {
+	int rowPosition = 0;
+
+	while (child != rowEnd) {
+		int height = UIElementMessage(child, UI_MSG_GET_HEIGHT, 0, 0);
+		int width = UIElementMessage(child, UI_MSG_GET_WIDTH, 0, 0);
+		UIRectangle relative = UI_RECT_4(rowPosition, rowPosition + width, rowY + rowHeight / 2 - height / 2, rowY + rowHeight / 2 + height / 2);
+		UIElementMove(child, UIRectangleTranslate(relative, panel->e.bounds), false);
+		child = child->next;
+		rowPosition += width;
+	}
+}
+
+int _UIWrapPanelMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UIWrapPanel *panel = (UIWrapPanel *) element;
+	bool horizontal = element->flags & UI_PANEL_HORIZONTAL;
+
+	if (message == UI_MSG_LAYOUT || message == UI_MSG_GET_HEIGHT) {
+		int totalHeight = 0;
+		int rowPosition = 0;
+		int rowHeight = 0;
+		int rowLimit = message == UI_MSG_LAYOUT ? UI_RECT_WIDTH(element->bounds) : di;
+
+		UIElement *child = panel->e.children;
+		UIElement *rowStart = child;
+
+		while (child) {
+			if (~child->flags & UI_ELEMENT_HIDE) {
+				int height = UIElementMessage(child, UI_MSG_GET_HEIGHT, 0, 0);
+				int width = UIElementMessage(child, UI_MSG_GET_WIDTH, 0, 0);
+
+				if (rowLimit && rowPosition + width > rowLimit) {
+					_UIWrapPanelLayoutRow(panel, rowStart, child, totalHeight, rowHeight);
+					totalHeight += rowHeight;
+					rowPosition = rowHeight = 0;
+					rowStart = child;
+				}
+
+				if (height > rowHeight) {
+					rowHeight = height;
+				}
+
+				rowPosition += width;
+			}
+
+			child = child->next;
+		}
+
+		if (message == UI_MSG_GET_HEIGHT) {
+			return totalHeight + rowHeight;
+		} else {
+			_UIWrapPanelLayoutRow(panel, rowStart, child, totalHeight, rowHeight);
+		}
+	}
+
+	return 0;
+}
+
+UIWrapPanel *UIWrapPanelCreate(UIElement *parent, uint32_t flags) {
+	return (UIWrapPanel *) UIElementCreate(sizeof(UIWrapPanel), parent, flags, _UIWrapPanelMessage, "Wrap Panel");
+}
+
+void _UIButtonCalculateColors(UIElement *element, uint32_t *color, uint32_t *textColor) {
+	bool disabled = element->flags & UI_ELEMENT_DISABLED;
+	bool focused = element == element->window->focused;
+	bool pressed = element == element->window->pressed;
+	bool hovered = element == element->window->hovered;
+	*color = disabled ? ui.theme.buttonDisabled
+		: (pressed && hovered) ? ui.theme.buttonPressed 
+		: (pressed || hovered) ? ui.theme.buttonHovered 
+		: focused ? ui.theme.selected : ui.theme.buttonNormal;
+	*textColor = disabled ? ui.theme.textDisabled 
+		: *color == ui.theme.selected ? ui.theme.textSelected : ui.theme.text;
+}
+
+
+int _UIButtonMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UIButton *button = (UIButton *) element;
+	bool isMenuItem = element->flags & UI_BUTTON_MENU_ITEM;
+	bool isDropDown = element->flags & UI_BUTTON_DROP_DOWN;
+	
+	if (message == UI_MSG_GET_HEIGHT) {
+		if (isMenuItem) {
+			return UI_SIZE_MENU_ITEM_HEIGHT * element->window->scale;
+		} else {
+			return UI_SIZE_BUTTON_HEIGHT * element->window->scale;
+		}
+	} else if (message == UI_MSG_GET_WIDTH) {
+		int labelSize = UIMeasureStringWidth(button->label, button->labelBytes);
+		int paddedSize = labelSize + UI_SIZE_BUTTON_PADDING * element->window->scale;
+		if (isDropDown) paddedSize += ui.activeFont->glyphWidth * 2;
+		int minimumSize = ((element->flags & UI_BUTTON_SMALL) ? 0 
+				: isMenuItem ? UI_SIZE_MENU_ITEM_MINIMUM_WIDTH 
+				: UI_SIZE_BUTTON_MINIMUM_WIDTH) 
+			* element->window->scale;
+		return paddedSize > minimumSize ? paddedSize : minimumSize;
+	} else if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+
+		uint32_t color, textColor;
+		_UIButtonCalculateColors(element, &color, &textColor);
+
+		UIDrawRectangle(painter, element->bounds, color, ui.theme.border, UI_RECT_1(isMenuItem ? 0 : 1));
+
+		if (element->flags & UI_BUTTON_CHECKED) {
+			UIDrawBlock(painter, UIRectangleAdd(element->bounds, 
+				UI_RECT_1I((int) (UI_SIZE_BUTTON_CHECKED_AREA * element->window->scale))), ui.theme.buttonPressed);
+		}
+
+		UIRectangle bounds = UIRectangleAdd(element->bounds, UI_RECT_2I((int) (UI_SIZE_MENU_ITEM_MARGIN * element->window->scale), 0));
+
+		if (isMenuItem) {
+			if (button->labelBytes == -1) {
+				button->labelBytes = _UIStringLength(button->label);
+			}
+
+			int tab = 0;
+			for (; tab < button->labelBytes && button->label[tab] != '\t'; tab++);
+
+			UIDrawString(painter, bounds, button->label, tab, textColor, UI_ALIGN_LEFT, NULL);
+
+			if (button->labelBytes > tab) {
+				UIDrawString(painter, bounds, button->label + tab + 1, button->labelBytes - tab - 1, textColor, UI_ALIGN_RIGHT, NULL);
+			}
+		} else if (isDropDown) {
+			UIDrawString(painter, bounds, button->label, button->labelBytes, textColor, UI_ALIGN_LEFT, NULL);
+			UIDrawString(painter, bounds, "\x19", 1, textColor, UI_ALIGN_RIGHT, NULL);
+		} else {
+			UIDrawString(painter, element->bounds, button->label, button->labelBytes, textColor, UI_ALIGN_CENTER, NULL);
+		}
+	} else if (message == UI_MSG_UPDATE) {
+		UIElementRepaint(element, NULL);
+	} else if (message == UI_MSG_DESTROY) {
+		UI_FREE(button->label);
+	} else if (message == UI_MSG_LEFT_DOWN) {
+		if (element->flags & UI_BUTTON_CAN_FOCUS) {
+			UIElementFocus(element);
+		}
+	} else if (message == UI_MSG_KEY_TYPED) {
+		UIKeyTyped *m = (UIKeyTyped *) dp;
+		
+		if (m->textBytes == 1 && m->text[0] == ' ') {
+			UIElementMessage(element, UI_MSG_CLICKED, 0, 0);
+			UIElementRepaint(element, NULL);
+		}
+	} else if (message == UI_MSG_CLICKED) {
+		if (button->invoke) {
+			button->invoke(element->cp);
+		}
+	}
+
+	return 0;
+}
+
+UIButton *UIButtonCreate(UIElement *parent, uint32_t flags, const char *label, ptrdiff_t labelBytes) {
+	UIButton *button = (UIButton *) UIElementCreate(sizeof(UIButton), parent, flags | UI_ELEMENT_TAB_STOP, _UIButtonMessage, "Button");
+	button->label = UIStringCopy(label, (button->labelBytes = labelBytes));
+	return button;
+}
+
+int _UICheckboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UICheckbox *box = (UICheckbox *) element;
+	
+	if (message == UI_MSG_GET_HEIGHT) {
+		return UI_SIZE_BUTTON_HEIGHT * element->window->scale;
+	} else if (message == UI_MSG_GET_WIDTH) {
+		int labelSize = UIMeasureStringWidth(box->label, box->labelBytes);
+		return (labelSize + UI_SIZE_CHECKBOX_BOX + UI_SIZE_CHECKBOX_GAP) * element->window->scale;
+	} else if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+		uint32_t color, textColor;
+		_UIButtonCalculateColors(element, &color, &textColor);
+		int midY = (element->bounds.t + element->bounds.b) / 2;
+		UIRectangle boxBounds = UI_RECT_4(element->bounds.l, element->bounds.l + UI_SIZE_CHECKBOX_BOX, 
+				midY - UI_SIZE_CHECKBOX_BOX / 2, midY + UI_SIZE_CHECKBOX_BOX / 2);
+		UIDrawRectangle(painter, boxBounds, color, ui.theme.border, UI_RECT_1(1));
+		UIDrawString(painter, UIRectangleAdd(boxBounds, UI_RECT_4(1, 0, 0, 0)), 
+				box->check == UI_CHECK_CHECKED ? "*" : box->check == UI_CHECK_INDETERMINATE ? "-" : " ", -1, 
+				textColor, UI_ALIGN_CENTER, NULL);
+		UIDrawString(painter, UIRectangleAdd(element->bounds, UI_RECT_4(UI_SIZE_CHECKBOX_BOX + UI_SIZE_CHECKBOX_GAP, 0, 0, 0)), 
+				box->label, box->labelBytes, textColor, UI_ALIGN_LEFT, NULL);
+	} else if (message == UI_MSG_UPDATE) {
+		UIElementRepaint(element, NULL);
+	} else if (message == UI_MSG_DESTROY) {
+		UI_FREE(box->label);
+	} else if (message == UI_MSG_KEY_TYPED) {
+		UIKeyTyped *m = (UIKeyTyped *) dp;
+		
+		if (m->textBytes == 1 && m->text[0] == ' ') {
+			UIElementMessage(element, UI_MSG_CLICKED, 0, 0);
+			UIElementRepaint(element, NULL);
+		}
+	} else if (message == UI_MSG_CLICKED) {
+		box->check = (box->check + 1) % ((element->flags & UI_CHECKBOX_ALLOW_INDETERMINATE) ? 3 : 2);
+		UIElementRepaint(element, NULL);
+		if (box->invoke) box->invoke(element->cp);
+	}
+
+	return 0;
+}
+
+UICheckbox *UICheckboxCreate(UIElement *parent, uint32_t flags, const char *label, ptrdiff_t labelBytes) {
+	UICheckbox *box = (UICheckbox *) UIElementCreate(sizeof(UICheckbox), parent, flags | UI_ELEMENT_TAB_STOP, _UICheckboxMessage, "Checkbox");
+	box->label = UIStringCopy(label, (box->labelBytes = labelBytes));
+	return box;
+}
+
+int _UILabelMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UILabel *label = (UILabel *) element;
+	
+	if (message == UI_MSG_GET_HEIGHT) {
+		return UIMeasureStringHeight();
+	} else if (message == UI_MSG_GET_WIDTH) {
+		return UIMeasureStringWidth(label->label, label->labelBytes);
+	} else if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+		UIDrawString(painter, element->bounds, label->label, label->labelBytes, ui.theme.text, UI_ALIGN_LEFT, NULL);
+	} else if (message == UI_MSG_DESTROY) {
+		UI_FREE(label->label);
+	}
+
+	return 0;
+}
+
+void UILabelSetContent(UILabel *label, const char *string, ptrdiff_t stringBytes) {
+	UI_FREE(label->label);
+	label->label = UIStringCopy(string, (label->labelBytes = stringBytes));
+}
+
+UILabel *UILabelCreate(UIElement *parent, uint32_t flags, const char *string, ptrdiff_t stringBytes) {
+	UILabel *label = (UILabel *) UIElementCreate(sizeof(UILabel), parent, flags, _UILabelMessage, "Label");
+	label->label = UIStringCopy(string, (label->labelBytes = stringBytes));
+	return label;
+}
+
+int _UISplitPaneMessage(UIElement *element, UIMessage message, int di, void *dp);
+
+int _UISplitterMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UISplitPane *splitPane = (UISplitPane *) element->parent;
+	bool vertical = splitPane->e.flags & UI_SPLIT_PANE_VERTICAL;
+
+	if (message == UI_MSG_PAINT) {
+		UIRectangle borders = vertical ? UI_RECT_2(0, 1) : UI_RECT_2(1, 0);
+		UIDrawRectangle((UIPainter *) dp, element->bounds, ui.theme.buttonNormal, ui.theme.border, borders);
+	} else if (message == UI_MSG_GET_CURSOR) {
+		return vertical ? UI_CURSOR_SPLIT_V : UI_CURSOR_SPLIT_H;
+	} else if (message == UI_MSG_MOUSE_DRAG) {
+		int cursor = vertical ? element->window->cursorY : element->window->cursorX;
+		int splitterSize = UI_SIZE_SPLITTER * element->window->scale;
+		int space = (vertical ? UI_RECT_HEIGHT(splitPane->e.bounds) : UI_RECT_WIDTH(splitPane->e.bounds)) - splitterSize;
+		float oldWeight = splitPane->weight;
+		splitPane->weight = (float) (cursor - splitterSize / 2 - (vertical ? splitPane->e.bounds.t : splitPane->e.bounds.l)) / space;
+		if (splitPane->weight < 0.05f) splitPane->weight = 0.05f;
+		if (splitPane->weight > 0.95f) splitPane->weight = 0.95f;
+
+		if (element->next->next->messageClass == _UISplitPaneMessage 
+				&& (element->next->next->flags & UI_SPLIT_PANE_VERTICAL) == (splitPane->e.flags & UI_SPLIT_PANE_VERTICAL)) {
+			UISplitPane *subSplitPane = (UISplitPane *) element->next->next;
+			subSplitPane->weight = (splitPane->weight - oldWeight - subSplitPane->weight + oldWeight * subSplitPane->weight) / (-1 + splitPane->weight);
+			if (subSplitPane->weight < 0.05f) subSplitPane->weight = 0.05f;
+			if (subSplitPane->weight > 0.95f) subSplitPane->weight = 0.95f;
+		}
+
+		UIElementRefresh(&splitPane->e);
+	}
+
+	return 0;
+}
+
+int _UISplitPaneMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UISplitPane *splitPane = (UISplitPane *) element;
+	bool vertical = splitPane->e.flags & UI_SPLIT_PANE_VERTICAL;
+
+	if (message == UI_MSG_LAYOUT) {
+		UIElement *splitter = element->children;
+		UI_ASSERT(splitter);
+		UIElement *left = splitter->next;
+		UI_ASSERT(left);
+		UIElement *right = left->next;
+		UI_ASSERT(right);
+		UI_ASSERT(!right->next);
+
+		int splitterSize = UI_SIZE_SPLITTER * element->window->scale;
+		int space = (vertical ? UI_RECT_HEIGHT(element->bounds) : UI_RECT_WIDTH(element->bounds)) - splitterSize;
+		int leftSize = space * splitPane->weight;
+		int rightSize = space - leftSize;
+
+		if (vertical) {
+			UIElementMove(left, UI_RECT_4(element->bounds.l, element->bounds.r, element->bounds.t, element->bounds.t + leftSize), false);
+			UIElementMove(splitter, UI_RECT_4(element->bounds.l, element->bounds.r, element->bounds.t + leftSize, element->bounds.t + leftSize + splitterSize), false);
+			UIElementMove(right, UI_RECT_4(element->bounds.l, element->bounds.r, element->bounds.b - rightSize, element->bounds.b), false);
+		} else {
+			UIElementMove(left, UI_RECT_4(element->bounds.l, element->bounds.l + leftSize, element->bounds.t, element->bounds.b), false);
+			UIElementMove(splitter, UI_RECT_4(element->bounds.l + leftSize, element->bounds.l + leftSize + splitterSize, element->bounds.t, element->bounds.b), false);
+			UIElementMove(right, UI_RECT_4(element->bounds.r - rightSize, element->bounds.r, element->bounds.t, element->bounds.b), false);
+		}
+	}
+
+	return 0;
+}
+
+UISplitPane *UISplitPaneCreate(UIElement *parent, uint32_t flags, float weight) {
+	UISplitPane *splitPane = (UISplitPane *) UIElementCreate(sizeof(UISplitPane), parent, flags, _UISplitPaneMessage, "Split Pane");
+	splitPane->weight = weight;
+	UIElementCreate(sizeof(UIElement), &splitPane->e, 0, _UISplitterMessage, "Splitter");
+	return splitPane;
+}
+
+int _UITabPaneMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UITabPane *tabPane = (UITabPane *) element;
+	
+	if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+		UIRectangle top = element->bounds;
+		top.b = top.t + UI_SIZE_BUTTON_HEIGHT * element->window->scale;
+		UIDrawRectangle(painter, top, ui.theme.panel1, ui.theme.border, UI_RECT_4(0, 0, 0, 1));
+
+		UIRectangle tab = top;
+		tab.l += UI_SIZE_TAB_PANE_SPACE_LEFT * element->window->scale;
+		tab.t += UI_SIZE_TAB_PANE_SPACE_TOP * element->window->scale;
+
+		int position = 0;
+		int index = 0;
+
+		while (true) {
+			int end = position;
+			for (; tabPane->tabs[end] != '\t' && tabPane->tabs[end]; end++);
+
+			int width = UIMeasureStringWidth(tabPane->tabs, end - position);
+			tab.r = tab.l + width + UI_SIZE_BUTTON_PADDING;
+
+			uint32_t color = tabPane->active == index ? ui.theme.buttonPressed : ui.theme.buttonNormal;
+
+			UIRectangle t = tab;
+
+			if (tabPane->active == index) {
+				t.b++;
+				t.t--;
+			} else {
+				t.t++;
+			}
+
+			UIDrawRectangle(painter, t, color, ui.theme.border, UI_RECT_1(1));
+			UIDrawString(painter, tab, tabPane->tabs + position, end - position, ui.theme.text, UI_ALIGN_CENTER, NULL);
+			tab.l = tab.r - 1;
+
+			if (tabPane->tabs[end] == '\t') {
+				position = end + 1;
+				index++;
+			} else {
+				break;
+			}
+		}
+	} else if (message == UI_MSG_LEFT_DOWN) {
+		UIRectangle tab = element->bounds;
+		tab.b = tab.t + UI_SIZE_BUTTON_HEIGHT * element->window->scale;
+		tab.l += UI_SIZE_TAB_PANE_SPACE_LEFT * element->window->scale;
+		tab.t += UI_SIZE_TAB_PANE_SPACE_TOP * element->window->scale;
+
+		int position = 0;
+		int index = 0;
+
+		while (true) {
+			int end = position;
+			for (; tabPane->tabs[end] != '\t' && tabPane->tabs[end]; end++);
+
+			int width = UIMeasureStringWidth(tabPane->tabs, end - position);
+			tab.r = tab.l + width + UI_SIZE_BUTTON_PADDING;
+
+			if (UIRectangleContains(tab, element->window->cursorX, element->window->cursorY)) {
+				tabPane->active = index;
+				UIElementMessage(element, UI_MSG_LAYOUT, 0, 0);
+				UIElementRepaint(element, NULL);
+				break;
+			}
+
+			tab.l = tab.r - 1;
+
+			if (tabPane->tabs[end] == '\t') {
+				position = end + 1;
+				index++;
+			} else {
+				break;
+			}
+		}
+	} else if (message == UI_MSG_LAYOUT) {
+		UIElement *child = element->children;
+		int index = 0;
+
+		UIRectangle content = element->bounds;
+		content.t += UI_SIZE_BUTTON_HEIGHT * element->window->scale;
+
+		while (child) {
+			if (tabPane->active == index) {
+				child->flags &= ~UI_ELEMENT_HIDE;
+				UIElementMove(child, content, false);
+				UIElementMessage(child, UI_MSG_TAB_SELECTED, 0, 0);
+			} else {
+				child->flags |= UI_ELEMENT_HIDE;
+			}
+
+			child = child->next;
+			index++;
+		}
+	} else if (message == UI_MSG_GET_HEIGHT) {
+		UIElement *child = element->children;
+		int index = 0;
+		int baseHeight = UI_SIZE_BUTTON_HEIGHT * element->window->scale;
+
+		while (child) {
+			if (tabPane->active == index) {
+				return baseHeight + UIElementMessage(child, UI_MSG_GET_HEIGHT, di, dp);
+			}
+
+			child = child->next;
+			index++;
+		}
+	} else if (message == UI_MSG_DESTROY) {
+		UI_FREE(tabPane->tabs);
+	}
+
+	return 0;
+}
+
+UITabPane *UITabPaneCreate(UIElement *parent, uint32_t flags, const char *tabs) {
+	UITabPane *tabPane = (UITabPane *) UIElementCreate(sizeof(UITabPane), parent, flags, _UITabPaneMessage, "Tab Pane");
+	tabPane->tabs = UIStringCopy(tabs, -1);
+	return tabPane;
+}
+
+int _UISpacerMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UISpacer *spacer = (UISpacer *) element;
+	
+	if (message == UI_MSG_GET_HEIGHT) {
+		return spacer->height * element->window->scale;
+	} else if (message == UI_MSG_GET_WIDTH) {
+		return spacer->width * element->window->scale;
+	} else if (message == UI_MSG_PAINT && (element->flags & UI_SPACER_LINE)) {
+		UIDrawBlock((UIPainter *) dp, element->bounds, ui.theme.border);
+	}
+
+	return 0;
+}
+
+UISpacer *UISpacerCreate(UIElement *parent, uint32_t flags, int width, int height) {
+	UISpacer *spacer = (UISpacer *) UIElementCreate(sizeof(UISpacer), parent, flags, _UISpacerMessage, "Spacer");
+	spacer->width = width;
+	spacer->height = height;
+	return spacer;
+}
+
+int _UIScrollBarMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UIScrollBar *scrollBar = (UIScrollBar *) element;
+
+	if (message == UI_MSG_GET_WIDTH || message == UI_MSG_GET_HEIGHT) {
+		return UI_SIZE_SCROLL_BAR * element->window->scale;
+	} else if (message == UI_MSG_LAYOUT) {
+		UIElement *up = element->children;
+		UIElement *thumb = up->next;
+		UIElement *down = thumb->next;
+
+		if (scrollBar->page >= scrollBar->maximum || scrollBar->maximum <= 0 || scrollBar->page <= 0) {
+			up->flags |= UI_ELEMENT_HIDE;
+			thumb->flags |= UI_ELEMENT_HIDE;
+			down->flags |= UI_ELEMENT_HIDE;
+
+			scrollBar->position = 0;
+		} else {
+			up->flags &= ~UI_ELEMENT_HIDE;
+			thumb->flags &= ~UI_ELEMENT_HIDE;
+			down->flags &= ~UI_ELEMENT_HIDE;
+
+			int size = scrollBar->horizontal ? UI_RECT_WIDTH(element->bounds) : UI_RECT_HEIGHT(element->bounds);
+			int thumbSize = size * scrollBar->page / scrollBar->maximum;
+
+			if (thumbSize < UI_SIZE_SCROLL_MINIMUM_THUMB * element->window->scale) {
+				thumbSize = UI_SIZE_SCROLL_MINIMUM_THUMB * element->window->scale;
+			}
+
+			if (scrollBar->position < 0) {
+				scrollBar->position = 0;
+			} else if (scrollBar->position > scrollBar->maximum - scrollBar->page) {
+				scrollBar->position = scrollBar->maximum - scrollBar->page;
+			}
+
+			int thumbPosition = scrollBar->position / (scrollBar->maximum - scrollBar->page) * (size - thumbSize);
+
+			if (scrollBar->position == scrollBar->maximum - scrollBar->page) {
+				thumbPosition = size - thumbSize;
+			}
+
+			if (scrollBar->horizontal) {
+				UIRectangle r = element->bounds;
+				r.r = r.l + thumbPosition;
+				UIElementMove(up, r, false);
+				r.l = r.r, r.r = r.l + thumbSize;
+				UIElementMove(thumb, r, false);
+				r.l = r.r, r.r = element->bounds.r;
+				UIElementMove(down, r, false);
+			} else {
+				UIRectangle r = element->bounds;
+				r.b = r.t + thumbPosition;
+				UIElementMove(up, r, false);
+				r.t = r.b, r.b = r.t + thumbSize;
+				UIElementMove(thumb, r, false);
+				r.t = r.b, r.b = element->bounds.b;
+				UIElementMove(down, r, false);
+			}
+		}
+	} else if (message == UI_MSG_PAINT) {
+		if (scrollBar->page >= scrollBar->maximum || scrollBar->maximum <= 0 || scrollBar->page <= 0) {
+			UIDrawBlock((UIPainter *) dp, element->bounds, ui.theme.panel1);
+		}
+	} else if (message == UI_MSG_MOUSE_WHEEL) {
+		scrollBar->position += di;
+		UIElementRefresh(element);
+		UIElementMessage(element->parent, UI_MSG_SCROLLED, 0, 0);
+		return 1;
+	}
+
+	return 0;
+}
+
+int _UIScrollUpDownMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UIScrollBar *scrollBar = (UIScrollBar *) element->parent;
+	bool isDown = element->cp;
+
+	if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+		uint32_t color = element == element->window->pressed ? ui.theme.buttonPressed 
+			: element == element->window->hovered ? ui.theme.buttonHovered : ui.theme.panel2;
+		UIDrawRectangle(painter, element->bounds, color, ui.theme.border, UI_RECT_1(0));
+		
+		if (scrollBar->horizontal) {
+			UIDrawGlyph(painter, isDown ? (element->bounds.r - ui.activeFont->glyphWidth - 2 * element->window->scale) 
+					: (element->bounds.l + 2 * element->window->scale), 
+				(element->bounds.t + element->bounds.b - ui.activeFont->glyphHeight) / 2,
+				isDown ? 26 : 27, ui.theme.text);
+		} else {
+			UIDrawGlyph(painter, (element->bounds.l + element->bounds.r - ui.activeFont->glyphWidth) / 2 + 1, 
+				isDown ? (element->bounds.b - ui.activeFont->glyphHeight - 2 * element->window->scale) 
+					: (element->bounds.t + 2 * element->window->scale), 
+				isDown ? 25 : 24, ui.theme.text);
+		}
+	} else if (message == UI_MSG_UPDATE) {
+		UIElementRepaint(element, NULL);
+	} else if (message == UI_MSG_LEFT_DOWN) {
+		UIElementAnimate(element, false);
+		scrollBar->lastAnimateTime = UI_CLOCK();
+	} else if (message == UI_MSG_LEFT_UP) {
+		UIElementAnimate(element, true);
+	} else if (message == UI_MSG_ANIMATE) {
+		UI_CLOCK_T previous = scrollBar->lastAnimateTime;
+		UI_CLOCK_T current = UI_CLOCK();
+		UI_CLOCK_T delta = current - previous;
+		double deltaSeconds = (double) delta / UI_CLOCKS_PER_SECOND;
+		if (deltaSeconds > 0.1) deltaSeconds = 0.1;
+		double deltaPixels = deltaSeconds * scrollBar->page * 3;
+		scrollBar->lastAnimateTime = current;
+		if (isDown) scrollBar->position += deltaPixels;
+		else scrollBar->position -= deltaPixels;
+		UIElementRefresh(&scrollBar->e);
+		UIElementMessage(scrollBar->e.parent, UI_MSG_SCROLLED, 0, 0);
+	}
+
+	return 0;
+}
+
+int _UIScrollThumbMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UIScrollBar *scrollBar = (UIScrollBar *) element->parent;
+
+	if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+		uint32_t color = element == element->window->pressed ? ui.theme.buttonPressed 
+			: element == element->window->hovered ? ui.theme.buttonHovered : ui.theme.buttonNormal;
+		UIDrawRectangle(painter, element->bounds, color, ui.theme.border, UI_RECT_1(2));
+	} else if (message == UI_MSG_UPDATE) {
+		UIElementRepaint(element, NULL);
+	} else if (message == UI_MSG_MOUSE_DRAG && element->window->pressedButton == 1) {
+		if (!scrollBar->inDrag) {
+			scrollBar->inDrag = true;
+			
+			if (scrollBar->horizontal) {
+				scrollBar->dragOffset = element->bounds.l - scrollBar->e.bounds.l - element->window->cursorX;
+			} else {
+				scrollBar->dragOffset = element->bounds.t - scrollBar->e.bounds.t - element->window->cursorY;
+			}
+		}
+
+		int thumbPosition = (scrollBar->horizontal ? element->window->cursorX : element->window->cursorY) + scrollBar->dragOffset;
+		int size = scrollBar->horizontal ? (UI_RECT_WIDTH(scrollBar->e.bounds) - UI_RECT_WIDTH(element->bounds))
+				: (UI_RECT_HEIGHT(scrollBar->e.bounds) - UI_RECT_HEIGHT(element->bounds));
+		scrollBar->position = (double) thumbPosition / size * (scrollBar->maximum - scrollBar->page);
+		UIElementRefresh(&scrollBar->e);
+		UIElementMessage(scrollBar->e.parent, UI_MSG_SCROLLED, 0, 0);
+	} else if (message == UI_MSG_LEFT_UP) {
+		scrollBar->inDrag = false;
+	}
+
+	return 0;
+}
+
+UIScrollBar *UIScrollBarCreate(UIElement *parent, uint32_t flags) {
+	UIScrollBar *scrollBar = (UIScrollBar *) UIElementCreate(sizeof(UIScrollBar), parent, flags, _UIScrollBarMessage, "Scroll Bar");
+	bool horizontal = scrollBar->horizontal = flags & UI_SCROLL_BAR_HORIZONTAL;
+	UIElementCreate(sizeof(UIElement), &scrollBar->e, flags, _UIScrollUpDownMessage, !horizontal ? "Scroll Up" : "Scroll Left")->cp = (void *) (uintptr_t) 0;
+	UIElementCreate(sizeof(UIElement), &scrollBar->e, flags, _UIScrollThumbMessage, "Scroll Thumb");
+	UIElementCreate(sizeof(UIElement), &scrollBar->e, flags, _UIScrollUpDownMessage, !horizontal ? "Scroll Down" : "Scroll Right")->cp = (void *) (uintptr_t) 1;
+	return scrollBar;
+}
+
+bool _UICharIsAlpha(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+bool _UICharIsDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+bool _UICharIsAlphaOrDigitOrUnderscore(char c) {
+	return _UICharIsAlpha(c) || _UICharIsDigit(c) || c == '_';
+}
+
+void UILexerSetClass(UILexer *lexer, int from, int to, int characterClass) {
+	UI_ASSERT(characterClass >= 0 && characterClass < UI_LEXER_MAX_CLASSES);
+
+	for (int i = from; i <= to; i++) {
+		lexer->classes[(uint8_t) i] = characterClass;
+	}
+}
+
+void UILexerSetTransition(UILexer *lexer, int state, int characterClass, int next) {
+	UI_ASSERT(state >= 0 && state < UI_LEXER_MAX_STATES && (next & ~UI_LEXER_BACK) < UI_LEXER_MAX_STATES);
+
+	if (characterClass == -1) {
+		for (int i = 0; i < UI_LEXER_MAX_CLASSES; i++) {
+			lexer->transitions[state][i] = next;
+		}
+	} else {
+		lexer->transitions[state][characterClass] = next;
+	}
+}
+
+void UILexerSetState(UILexer *lexer, int state, int color, int copyTransitionsFrom) {
+	lexer->colors[state] = color;
+
+	if (copyTransitionsFrom != -1) {
+		for (int i = 0; i < UI_LEXER_MAX_CLASSES; i++) {
+			lexer->transitions[state][i] = lexer->transitions[copyTransitionsFrom][i];
+		}
+	}
+}
+
+void UILexerFinish(UILexer *lexer) {
+	// Find the states that identifier characters and spaces can't leave, 
+	// so that UIDrawStringLexed can skip over runs of them without going through the tables.
+
+	for (int i = 0; i < UI_LEXER_MAX_STATES; i++) {
+		lexer->runs[i] = 0;
+
+		if (lexer->transitions[i][lexer->classes[' ']] == i) {
+			lexer->runs[i] |= _UI_LEXER_RUN_SPACE;
+		}
+
+		bool identifier = true;
+
+		for (int c = 0; c < 256; c++) {
+			if (_UICharIsAlphaOrDigitOrUnderscore(c) && lexer->transitions[i][lexer->classes[c]] != i) {
+				identifier = false;
+				break;
+			}
+		}
+
+		if (identifier) {
+			lexer->runs[i] |= _UI_LEXER_RUN_IDENTIFIER;
+		}
+	}
+}
+
+void _UILexerBuildC(UILexer *lexer) {
+	enum { OTHER, SPACE, ALPHA, DIGIT, SLASH, STAR, DOUBLE_QUOTE, SINGLE_QUOTE, BACKSLASH, HASH };
+	enum { DEFAULT, IDENTIFIER, NUMBER, OPERATOR, SLASH_START, LINE_COMMENT, BLOCK_COMMENT, BLOCK_STAR, BLOCK_END, 
+		STRING, STRING_ESCAPE, STRING_END, CHAR, CHAR_ESCAPE, CHAR_END, PREPROCESSOR };
+
+	UILexerSetClass(lexer, 0, 255, OTHER);
+	UILexerSetClass(lexer, ' ', ' ', SPACE);
+	UILexerSetClass(lexer, '\t', '\t', SPACE);
+	UILexerSetClass(lexer, '\r', '\r', SPACE);
+	UILexerSetClass(lexer, 'a', 'z', ALPHA);
+	UILexerSetClass(lexer, 'A', 'Z', ALPHA);
+	UILexerSetClass(lexer, '_', '_', ALPHA);
+	UILexerSetClass(lexer, 0x80, 0xFF, ALPHA);
+	UILexerSetClass(lexer, '0', '9', DIGIT);
+	UILexerSetClass(lexer, '/', '/', SLASH);
+	UILexerSetClass(lexer, '*', '*', STAR);
+	UILexerSetClass(lexer, '"', '"', DOUBLE_QUOTE);
+	UILexerSetClass(lexer, '\'', '\'', SINGLE_QUOTE);
+	UILexerSetClass(lexer, '\\', '\\', BACKSLASH);
+	UILexerSetClass(lexer, '#', '#', HASH);
+
+	UILexerSetState(lexer, DEFAULT, UI_LEXER_COLOR_DEFAULT, -1);
+	UILexerSetTransition(lexer, DEFAULT, -1, OPERATOR);
+	UILexerSetTransition(lexer, DEFAULT, SPACE, DEFAULT);
+	UILexerSetTransition(lexer, DEFAULT, ALPHA, IDENTIFIER);
+	UILexerSetTransition(lexer, DEFAULT, DIGIT, NUMBER);
+	UILexerSetTransition(lexer, DEFAULT, SLASH, SLASH_START);
+	UILexerSetTransition(lexer, DEFAULT, DOUBLE_QUOTE, STRING);
+	UILexerSetTransition(lexer, DEFAULT, SINGLE_QUOTE, CHAR);
+	UILexerSetTransition(lexer, DEFAULT, HASH, PREPROCESSOR);
+
+	UILexerSetState(lexer, IDENTIFIER, UI_LEXER_COLOR_DEFAULT, DEFAULT);
+	UILexerSetTransition(lexer, IDENTIFIER, ALPHA, IDENTIFIER);
+	UILexerSetTransition(lexer, IDENTIFIER, DIGIT, IDENTIFIER);
+
+	UILexerSetState(lexer, NUMBER, UI_LEXER_COLOR_NUMBER, DEFAULT);
+	UILexerSetTransition(lexer, NUMBER, ALPHA, NUMBER);
+	UILexerSetTransition(lexer, NUMBER, DIGIT, NUMBER);
+
+	UILexerSetState(lexer, OPERATOR, UI_LEXER_COLOR_OPERATOR, DEFAULT);
+
+	UILexerSetState(lexer, SLASH_START, UI_LEXER_COLOR_OPERATOR, DEFAULT);
+	UILexerSetTransition(lexer, SLASH_START, SLASH, LINE_COMMENT | UI_LEXER_BACK);
+	UILexerSetTransition(lexer, SLASH_START, STAR, BLOCK_COMMENT | UI_LEXER_BACK);
+
+	UILexerSetState(lexer, LINE_COMMENT, UI_LEXER_COLOR_COMMENT, -1);
+	UILexerSetTransition(lexer, LINE_COMMENT, -1, LINE_COMMENT);
+
+	UILexerSetState(lexer, BLOCK_COMMENT, UI_LEXER_COLOR_COMMENT, -1);
+	UILexerSetTransition(lexer, BLOCK_COMMENT, -1, BLOCK_COMMENT);
+	UILexerSetTransition(lexer, BLOCK_COMMENT, STAR, BLOCK_STAR);
+	UILexerSetState(lexer, BLOCK_STAR, UI_LEXER_COLOR_COMMENT, BLOCK_COMMENT);
+	UILexerSetTransition(lexer, BLOCK_STAR, SLASH, BLOCK_END);
+	UILexerSetState(lexer, BLOCK_END, UI_LEXER_COLOR_COMMENT, DEFAULT);
+
+	UILexerSetState(lexer, STRING, UI_LEXER_COLOR_STRING, -1);
+	UILexerSetTransition(lexer, STRING, -1, STRING);
+	UILexerSetTransition(lexer, STRING, DOUBLE_QUOTE, STRING_END);
+	UILexerSetTransition(lexer, STRING, BACKSLASH, STRING_ESCAPE);
+	UILexerSetState(lexer, STRING_ESCAPE, UI_LEXER_COLOR_STRING, -1);
+	UILexerSetTransition(lexer, STRING_ESCAPE, -1, STRING);
+	UILexerSetState(lexer, STRING_END, UI_LEXER_COLOR_STRING, DEFAULT);
+
+	UILexerSetState(lexer, CHAR, UI_LEXER_COLOR_STRING, -1);
+	UILexerSetTransition(lexer, CHAR, -1, CHAR);
+	UILexerSetTransition(lexer, CHAR, SINGLE_QUOTE, CHAR_END);
+	UILexerSetTransition(lexer, CHAR, BACKSLASH, CHAR_ESCAPE);
+	UILexerSetState(lexer, CHAR_ESCAPE, UI_LEXER_COLOR_STRING, -1);
+	UILexerSetTransition(lexer, CHAR_ESCAPE, -1, CHAR);
+	UILexerSetState(lexer, CHAR_END, UI_LEXER_COLOR_STRING, DEFAULT);
+
+	UILexerSetState(lexer, PREPROCESSOR, UI_LEXER_COLOR_PREPROCESSOR, -1);
+	UILexerSetTransition(lexer, PREPROCESSOR, -1, PREPROCESSOR);
+}
+
+void _UILexerBuildJSON(UILexer *lexer) {
+	enum { OTHER, SPACE, ALPHA, DIGIT, NUMBER_SIGN, DOUBLE_QUOTE, BACKSLASH };
+	enum { DEFAULT, LITERAL, NUMBER, OPERATOR, STRING, STRING_ESCAPE, STRING_END };
+
+	UILexerSetClass(lexer, 0, 255, OTHER);
+	UILexerSetClass(lexer, ' ', ' ', SPACE);
+	UILexerSetClass(lexer, '\t', '\t', SPACE);
+	UILexerSetClass(lexer, '\r', '\r', SPACE);
+	UILexerSetClass(lexer, 'a', 'z', ALPHA);
+	UILexerSetClass(lexer, 'A', 'Z', ALPHA);
+	UILexerSetClass(lexer, '_', '_', ALPHA);
+	UILexerSetClass(lexer, 0x80, 0xFF, ALPHA);
+	UILexerSetClass(lexer, '0', '9', DIGIT);
+	UILexerSetClass(lexer, '-', '-', NUMBER_SIGN);
+	UILexerSetClass(lexer, '+', '+', NUMBER_SIGN);
+	UILexerSetClass(lexer, '.', '.', NUMBER_SIGN);
+	UILexerSetClass(lexer, '"', '"', DOUBLE_QUOTE);
+	UILexerSetClass(lexer, '\\', '\\', BACKSLASH);
+
+	UILexerSetState(lexer, DEFAULT, UI_LEXER_COLOR_DEFAULT, -1);
+	UILexerSetTransition(lexer, DEFAULT, -1, OPERATOR);
+	UILexerSetTransition(lexer, DEFAULT, SPACE, DEFAULT);
+	UILexerSetTransition(lexer, DEFAULT, ALPHA, LITERAL);
+	UILexerSetTransition(lexer, DEFAULT, DIGIT, NUMBER);
+	UILexerSetTransition(lexer, DEFAULT, NUMBER_SIGN, NUMBER);
+	UILexerSetTransition(lexer, DEFAULT, DOUBLE_QUOTE, STRING);
+
+	UILexerSetState(lexer, LITERAL, UI_LEXER_COLOR_NUMBER, DEFAULT);
+	UILexerSetTransition(lexer, LITERAL, ALPHA, LITERAL);
+	UILexerSetTransition(lexer, LITERAL, DIGIT, LITERAL);
+
+	UILexerSetState(lexer, NUMBER, UI_LEXER_COLOR_NUMBER, DEFAULT);
+	UILexerSetTransition(lexer, NUMBER, ALPHA, NUMBER);
+	UILexerSetTransition(lexer, NUMBER, DIGIT, NUMBER);
+	UILexerSetTransition(lexer, NUMBER, NUMBER_SIGN, NUMBER);
+
+	UILexerSetState(lexer, OPERATOR, UI_LEXER_COLOR_OPERATOR, DEFAULT);
+
+	UILexerSetState(lexer, STRING, UI_LEXER_COLOR_STRING, -1);
+	UILexerSetTransition(lexer, STRING, -1, STRING);
+	UILexerSetTransition(lexer, STRING, DOUBLE_QUOTE, STRING_END);
+	UILexerSetTransition(lexer, STRING, BACKSLASH, STRING_ESCAPE);
+	UILexerSetState(lexer, STRING_ESCAPE, UI_LEXER_COLOR_STRING, -1);
+	UILexerSetTransition(lexer, STRING_ESCAPE, -1, STRING);
+	UILexerSetState(lexer, STRING_END, UI_LEXER_COLOR_STRING, DEFAULT);
+}
+
+UILexer *UILexerCreate(int builtin) {
+	UILexer *lexer = (UILexer *) UI_CALLOC(sizeof(UILexer));
+	if (builtin == UI_LEXER_C) _UILexerBuildC(lexer);
+	if (builtin == UI_LEXER_JSON) _UILexerBuildJSON(lexer);
+	UILexerFinish(lexer);
+	return lexer;
+}
+
+ptrdiff_t _UILexerSpan(const char *string, ptrdiff_t bytes, int runs) {
+	// Count the leading characters that are in one of the run sets.
+	ptrdiff_t i = 0;
+
+#ifdef UI_SSE2
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (string + i));
+		__m128i match = _mm_setzero_si128();
+
+		if (runs & _UI_LEXER_RUN_SPACE) {
+			match = _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+		}
+
+		if (runs & _UI_LEXER_RUN_IDENTIFIER) {
+			// Bytes >= 0x80 are negative, so they fail the signed range checks.
+			__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+			__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+			__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+			match = _mm_or_si128(match, _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+		}
+
+		int mask = _mm_movemask_epi8(match);
+
+		if (mask != 0xFFFF) {
+			while (mask & 1) i++, mask >>= 1;
+			return i;
+		}
+	}
+#endif
+
+	for (; i < bytes; i++) {
+		char c = string[i];
+		bool inRun = ((runs & _UI_LEXER_RUN_SPACE) && c == ' ') || ((runs & _UI_LEXER_RUN_IDENTIFIER) && _UICharIsAlphaOrDigitOrUnderscore(c));
+		if (!inRun) break;
+	}
+
+	return i;
+}
+
+uint8_t _UILexerAdvance(const UILexer *lexer, uint8_t state, const char *string, ptrdiff_t bytes) {
+	for (ptrdiff_t i = 0; i < bytes; ) {
+		state = lexer->transitions[state][lexer->classes[(uint8_t) string[i++]]] & ~UI_LEXER_BACK;
+		if (lexer->runs[state]) i += _UILexerSpan(string + i, bytes - i, lexer->runs[state]);
+	}
+
+	return state;
+}
+
+int _UIDrawStringLexed(UIPainter *painter, UIRectangle lineBounds, const char *string, ptrdiff_t bytes, int tabSize, const UILexer *lexer, uint8_t *lexerState) {
+	// If lexerState is not NULL, lexing starts from and updates it, so a line can be drawn in pieces.
+	if (bytes == -1) bytes = _UIStringLength(string);
+
+	uint32_t colors[] = {
+		ui.theme.codeDefault,
+		ui.theme.codeComment,
+		ui.theme.codeString,
+		ui.theme.codeNumber,
+		ui.theme.codeOperator,
+		ui.theme.codePreprocessor,
+	};
+
+	int x = lineBounds.l;
+	int y = (lineBounds.t + lineBounds.b - UIMeasureStringHeight()) / 2;
+	int glyphWidth = ui.activeFont->glyphWidth;
+	int ti = 0;
+	uint8_t state = lexerState ? *lexerState : 0;
+	ptrdiff_t i = 0;
+
+	if (painter->clip.l - x > glyphWidth) {
+		// The glyphs left of the clip only need to advance the lexer state.
+		// One is kept in case it overhangs.
+		int skip = (painter->clip.l - x) / glyphWidth - 1;
+
+		while (i < bytes && ti < skip) {
+			char c = string[i++];
+			state = lexer->transitions[state][lexer->classes[(uint8_t) c]] & ~UI_LEXER_BACK;
+
+			if (c == '\t') {
+				ti++;
+				while (ti % tabSize) ti++;
+			} else {
+				ti++;
+			}
+
+			if (lexer->runs[state] && ti < skip) {
+				ptrdiff_t run = _UILexerSpan(string + i, bytes - i < skip - ti ? bytes - i : skip - ti, lexer->runs[state]);
+				i += run, ti += run;
+			}
+		}
+
+		x += ti * glyphWidth;
+	}
+
+	// Each character is drawn one step late, so that a UI_LEXER_BACK transition can still change its color.
+	char previous = ' ';
+	int previousX = 0;
+	uint32_t previousColor = 0;
+
+	for (; i < bytes && x < painter->clip.r + glyphWidth; i++) {
+		char c = string[i];
+		uint8_t next = lexer->transitions[state][lexer->classes[(uint8_t) c]];
+		state = next & ~UI_LEXER_BACK;
+		if (next & UI_LEXER_BACK) previousColor = colors[lexer->colors[state]];
+		if (previous != ' ' && previous != '\t') UIDrawGlyph(painter, previousX, y, previous, previousColor);
+		previous = c, previousX = x, previousColor = colors[lexer->colors[state]];
+
+		if (c == '\t') {
+			x += glyphWidth, ti++;
+			while (ti % tabSize) x += glyphWidth, ti++;
+		} else {
+			x += glyphWidth, ti++;
+		}
+
+		if (lexer->runs[state]) {
+			ptrdiff_t visible = (painter->clip.r - x) / glyphWidth + 1;
+			ptrdiff_t run = _UILexerSpan(string + i + 1, bytes - i - 1 < visible ? bytes - i - 1 : visible, lexer->runs[state]);
+
+			for (ptrdiff_t j = 0; j < run; j++) {
+				if (previous != ' ' && previous != '\t') UIDrawGlyph(painter, previousX, y, previous, previousColor);
+				previous = string[i + 1 + j], previousX = x;
+				x += glyphWidth, ti++;
+			}
+
+			i += run;
+		}
+	}
+
+	if (previous != ' ' && previous != '\t') UIDrawGlyph(painter, previousX, y, previous, previousColor);
+	if (lexerState) *lexerState = _UILexerAdvance(lexer, state, string + i, bytes - i);
+	return x;
+}
+
+int UIDrawStringLexed(UIPainter *painter, UIRectangle lineBounds, const char *string, ptrdiff_t bytes, int tabSize, const UILexer *lexer) {
+	return _UIDrawStringLexed(painter, lineBounds, string, bytes, tabSize, lexer, NULL);
+}
+
+int UIDrawStringHighlighted(UIPainter *painter, UIRectangle lineBounds, const char *string, ptrdiff_t bytes, int tabSize) {
+	return UIDrawStringLexed(painter, lineBounds, string, bytes, tabSize, ui.lexerC);
+}
+
+typedef struct _UICodeSearchBatch {
+	_UIWorkerBatch header;
+	UICodeSearch *search;
+	int generation, hitCount;
+	size_t searched;
+	bool finished;
+	UICodeLine *hits;
+} _UICodeSearchBatch;
+
+void _UICodeSearchMerge(_UIWorkerBatch *header);
+
+#define _UI_CODE_SEARCH_CHUNK_BYTES (4000000)
+
+char _UICodeSearchFold(char c) {
+	return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+}
+
+bool _UICodeSearchLiteralAt(UICodeSearch *search, const char *text) {
+	if (search->flags & UI_CODE_SEARCH_MATCH_CASE) {
+		for (int i = 0; i < search->queryBytes; i++) if (text[i] != search->query[i]) return false;
+	} else {
+		for (int i = 0; i < search->queryBytes; i++) if (_UICodeSearchFold(text[i]) != _UICodeSearchFold(search->query[i])) return false;
+	}
+
+	return true;
+}
+
+bool _UIRegexMatchToken(const char *regex, char c, bool matchCase) {
+	if (regex[0] == '\\' && regex[1]) return matchCase ? c == regex[1] : _UICodeSearchFold(c) == _UICodeSearchFold(regex[1]);
+	if (regex[0] == '.') return true;
+	return matchCase ? c == regex[0] : _UICodeSearchFold(c) == _UICodeSearchFold(regex[0]);
+}
+
+const char *_UIRegexMatchHere(const char *regex, const char *text, const char *end, bool matchCase) {
+	// Returns the end of the match, or NULL.
+	if (!regex[0]) return text;
+	if (regex[0] == '$' && !regex[1]) return text == end ? text : NULL;
+	int tokenBytes = regex[0] == '\\' && regex[1] ? 2 : 1;
+
+	if (regex[tokenBytes] == '*') {
+		ptrdiff_t count = 0;
+		while (text + count < end && _UIRegexMatchToken(regex, text[count], matchCase)) count++;
+
+		for (; count >= 0; count--) {
+			const char *result = _UIRegexMatchHere(regex + tokenBytes + 1, text + count, end, matchCase);
+			if (result) return result;
+		}
+
+		return NULL;
+	}
+
+	if (text < end && _UIRegexMatchToken(regex, *text, matchCase)) {
+		return _UIRegexMatchHere(regex + tokenBytes, text + 1, end, matchCase);
+	}
+
+	return NULL;
+}
+
+void _UICodeSearchAddHit(UICodeLine **hits, int *hitCount, int *hitsAllocated, int offset, int bytes) {
+	if (*hitCount == *hitsAllocated) {
+		*hitsAllocated = *hitsAllocated ? *hitsAllocated * 2 : 64;
+		*hits = (UICodeLine *) UI_REALLOC(*hits, sizeof(UICodeLine) * *hitsAllocated);
+	}
+
+	UICodeLine hit = { 0 };
+	hit.offset = offset, hit.bytes = bytes;
+	(*hits)[(*hitCount)++] = hit;
+}
+
+size_t _UICodeSearchScan(UICodeSearch *search, size_t from, size_t to, UICodeLine **hits, int *hitCount, int *hitsAllocated) {
+	// Finds the matches starting in [from, to). Returns the position the next scan should start from.
+	// Called on the worker thread; the UI thread stops it before modifying the content.
+	UICode *code = search->code;
+	const char *text = code->content;
+	bool matchCase = search->flags & UI_CODE_SEARCH_MATCH_CASE;
+
+	if (search->flags & UI_CODE_SEARCH_REGEX) {
+		const char *regex = search->query;
+		bool anchored = regex[0] == '^';
+		if (anchored) regex++;
+
+		int lo = 0, hi = code->lineCount;
+
+		while (hi - lo > 1) {
+			int mid = (lo + hi) / 2;
+			if ((size_t) code->lines[mid].offset <= from) lo = mid;
+			else hi = mid;
+		}
+
+		size_t searched = from;
+
+		for (int i = lo; i < code->lineCount && (size_t) code->lines[i].offset < to; i++) {
+			const char *start = text + code->lines[i].offset, *end = start + code->lines[i].bytes;
+
+			for (const char *position = start; position <= end; ) {
+				if (search->cancel) return searched;
+				const char *match = _UIRegexMatchHere(regex, position, end, matchCase);
+
+				if (match && match != position) {
+					_UICodeSearchAddHit(hits, hitCount, hitsAllocated, position - text, match - position);
+					position = match;
+				} else {
+					position++;
+				}
+
+				if (anchored) break;
+			}
+
+			searched = code->lines[i].offset + code->lines[i].bytes + 1;
+		}
+
+		return searched > code->contentBytes ? code->contentBytes : searched;
+	}
+
+	// Positions too close to the end for a match aren't tested, and are searched again when more content is appended.
+	size_t end = code->contentBytes, i = from, next = from, n = search->queryBytes;
+	if (n > end) return from;
+	if (to > end + 1 - n) to = end + 1 - n;
+	if (to < from) to = from;
+	char first = search->query[0];
+
+#ifdef UI_SSE2
+	char last = search->query[n - 1];
+
+	// Compare the first and last bytes of the query against 16 positions at once,
+	// and only check the candidates where both match. Folding case by setting bit 5 
+	// gives some false positives for non-letters, which the full comparison rejects.
+	bool foldFirst = !matchCase && _UICodeSearchFold(first) >= 'a' && _UICodeSearchFold(first) <= 'z';
+	bool foldLast = !matchCase && _UICodeSearchFold(last) >= 'a' && _UICodeSearchFold(last) <= 'z';
+	__m128i firstBits = _mm_set1_epi8(foldFirst ? 0x20 : 0), lastBits = _mm_set1_epi8(foldLast ? 0x20 : 0);
+	__m128i firstByte = _mm_set1_epi8(foldFirst ? _UICodeSearchFold(first) : first);
+	__m128i lastByte = _mm_set1_epi8(foldLast ? _UICodeSearchFold(last) : last);
+
+	for (; i + 16 <= to; i += 16) {
+		if (search->cancel) return i;
+		__m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *) (text + i)), firstBits);
+		__m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *) (text + i + n - 1)), lastBits);
+		int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, firstByte), _mm_cmpeq_epi8(b, lastByte)));
+
+		for (int j = 0; mask; j++, mask >>= 1) {
+			if ((~mask & 1) || i + j < next || !_UICodeSearchLiteralAt(search, text + i + j)) continue;
+			_UICodeSearchAddHit(hits, hitCount, hitsAllocated, i + j, n);
+			next = i + j + n;
+		}
+	}
+#endif
+
+	for (; i < to; i++) {
+		if ((i & 4095) == 0 && search->cancel) return i;
+		if (i < next || (matchCase ? text[i] != first : _UICodeSearchFold(text[i]) != _UICodeSearchFold(first))) continue;
+		if (!_UICodeSearchLiteralAt(search, text + i)) continue;
+		_UICodeSearchAddHit(hits, hitCount, hitsAllocated, i, n);
+		next = i + n;
+	}
+
+	// Positions that overlap the last hit are skipped, so the next scan mustn't test them either.
+	return next > to ? next : to;
+}
+
+void _UICodeSearchWork(void *cp) {
+	UICodeSearch *search = (UICodeSearch *) cp;
+	size_t from = search->threadFrom, to = search->threadTo;
+	UIWindow *window = search->code->e.window;
+
+	while (!search->cancel) {
+		UICodeLine *hits = NULL;
+		int hitCount = 0, hitsAllocated = 0;
+		size_t chunkTo = to - from > _UI_CODE_SEARCH_CHUNK_BYTES ? from + _UI_CODE_SEARCH_CHUNK_BYTES : to;
+		size_t searched = _UICodeSearchScan(search, from, chunkTo, &hits, &hitCount, &hitsAllocated);
+		if (search->cancel) { UI_FREE(hits); break; }
+
+		_UICodeSearchBatch *batch = (_UICodeSearchBatch *) UI_MALLOC(sizeof(_UICodeSearchBatch) + sizeof(UICodeLine) * hitCount);
+		batch->header.merge = _UICodeSearchMerge;
+		batch->search = search;
+		batch->generation = search->generation;
+		batch->hitCount = hitCount;
+		batch->searched = searched;
+		batch->finished = chunkTo == to || searched >= to;
+		batch->hits = (UICodeLine *) (batch + 1);
+		for (int i = 0; i < hitCount; i++) batch->hits[i] = hits[i];
+		UI_FREE(hits);
+
+		UIWindowPostMessage(window, _UI_MSG_WORKER_BATCH, batch);
+		if (batch->finished) break;
+		from = searched;
+	}
+}
+
+void _UICodeSearchJoin(UICodeSearch *search) {
+	if (!search->threadRunning) return;
+#ifdef _UI_THREADS
+	_UIThreadJoin(search->thread);
+#endif
+	search->threadRunning = false;
+}
+
+void _UICodeSearchStop(UICodeSearch *search) {
+	// Batches that were posted but not yet received are discarded by bumping the generation.
+	search->cancel = 1;
+	_UICodeSearchJoin(search);
+	search->cancel = 0;
+	search->generation++;
+}
+
+void _UICodeSearchAddHits(UICodeSearch *search, UICodeLine *hits, int hitCount) {
+	if (search->hitsDropped + search->hitCount + hitCount > search->hitsAllocated) {
+		UICodeLine *base = search->hits - search->hitsDropped;
+
+		if (search->hitsDropped && search->hitsDropped >= search->hitCount) {
+			for (int i = 0; i < search->hitCount; i++) base[i] = search->hits[i];
+			search->hits = base;
+			search->hitsDropped = 0;
+		}
+
+		if (search->hitsDropped + search->hitCount + hitCount > search->hitsAllocated) {
+			search->hitsAllocated *= 2;
+			if (search->hitsAllocated < search->hitsDropped + search->hitCount + hitCount) search->hitsAllocated = search->hitsDropped + search->hitCount + hitCount;
+			base = (UICodeLine *) UI_REALLOC(base, sizeof(UICodeLine) * search->hitsAllocated);
+			search->hits = base + search->hitsDropped;
+		}
+	}
+
+	for (int i = 0; i < hitCount; i++) search->hits[search->hitCount++] = hits[i];
+}
+
+void _UICodeSearchMerge(_UIWorkerBatch *header) {
+	_UICodeSearchBatch *batch = (_UICodeSearchBatch *) header;
+	UICodeSearch *search = ui.codeSearches;
+	while (search && search != batch->search) search = search->next;
+
+	if (search && search->generation == batch->generation) {
+		_UICodeSearchAddHits(search, batch->hits, batch->hitCount);
+		search->searched = batch->searched;
+
+		if (batch->finished) {
+			_UICodeSearchJoin(search);
+			search->finished = true;
+		}
+
+		UIElementMessage(&search->code->e, UI_MSG_CODE_SEARCH_PROGRESS, search->finished, 0);
+		UIElementRepaint(&search->code->e, NULL);
+	}
+
+	UI_FREE(batch);
+}
+
+void _UICodeSearchResume(UICode *code) {
+	// Search the content after search->searched, on the UI thread if there is not much of it.
+	UICodeSearch *search = code->search;
+	size_t from = search->searched, to = code->contentBytes;
+	size_t start = code->lineCount ? code->lines[0].offset : code->contentBytes;
+	if (from < start) from = start;
+	search->finished = false;
+
+#ifdef _UI_THREADS
+	if (to > from && to - from > _UI_CODE_SEARCH_CHUNK_BYTES) {
+		search->threadFrom = from, search->threadTo = to;
+		search->threadRunning = true;
+		search->thread = _UIThreadCreate(_UICodeSearchWork, search);
+		return;
+	}
+#endif
+
+	if (to > from) {
+		UICodeLine *hits = NULL;
+		int hitCount = 0, hitsAllocated = 0;
+		search->searched = _UICodeSearchScan(search, from, to, &hits, &hitCount, &hitsAllocated);
+		_UICodeSearchAddHits(search, hits, hitCount);
+		UI_FREE(hits);
+	}
+
+	search->finished = true;
+	UIElementMessage(&code->e, UI_MSG_CODE_SEARCH_PROGRESS, 1, 0);
+}
+
+void _UICodeSearchFree(UICode *code) {
+	UICodeSearch *search = code->search;
+	if (!search) return;
+	_UICodeSearchStop(search);
+	UICodeSearch **link = &ui.codeSearches;
+	while (*link != search) link = &(*link)->next;
+	*link = search->next;
+	UI_FREE(search->hits - search->hitsDropped);
+	UI_FREE(search->query);
+	UI_FREE(search);
+	code->search = NULL;
+}
+
+#define _UI_CODE_WRAP_BLOCK (64)
+#define _UI_CODE_WRAP_CHUNK_BYTES (4000000)
+
+typedef struct _UICodeWrapBatch {
+	_UIWorkerBatch header;
+	UICodeWrap *wrap;
+	int generation, from, count;
+	bool finished;
+	int *rows;
+} _UICodeWrapBatch;
+
+void _UICodeWrapMerge(_UIWorkerBatch *header);
+
+int _UICodeWrapNext(const char *string, int bytes, int start, int columns, int tabSize) {
+	// Returns where the row starting at the given byte ends, breaking after a space if there is one.
+	int column = 0, lastBreak = -1;
+
+	for (int i = start; i < bytes; i++) {
+		int width = string[i] == '\t' ? tabSize - column % tabSize : 1;
+		if (column + width > columns && i > start) return lastBreak > start ? lastBreak : i;
+		column += width;
+		if (string[i] == ' ' || string[i] == '\t') lastBreak = i + 1;
+	}
+
+	return bytes;
+}
+
+int _UICodeWrapMeasure(UICode *code, int line, int columns, int64_t maximumRows, volatile int *cancel) {
+	// Stops counting at maximumRows, for lines that are only partly visible.
+	const char *string = code->content + code->lines[line].offset;
+	int bytes = code->lines[line].bytes, rows = 1;
+
+	for (int i = _UICodeWrapNext(string, bytes, 0, columns, code->tabSize); i < bytes && rows < maximumRows && !*cancel; rows++) {
+		i = _UICodeWrapNext(string, bytes, i, columns, code->tabSize);
+	}
+
+	return rows;
+}
+
+void _UICodeWrapSetRows(UICodeWrap *wrap, int from, int count, const int *rows, int fill) {
+	// Sets the rows of the lines [from, from + count), indexed from the start of the line allocation.
+	// The tree is updated once per block.
+	int64_t delta = 0;
+
+	for (int i = from; i < from + count; i++) {
+		int value = rows ? rows[i - from] : fill;
+		delta += value - wrap->rows[i];
+		wrap->rows[i] = value;
+
+		if ((i + 1) % _UI_CODE_WRAP_BLOCK == 0 || i + 1 == from + count) {
+			for (int k = i / _UI_CODE_WRAP_BLOCK + 1; delta && k <= wrap->blockCount; k += k & -k) wrap->blocks[k] += delta;
+			wrap->rowCount += delta;
+			delta = 0;
+		}
+	}
+}
+
+void _UICodeWrapSync(UICode *code, int shift) {
+	// Called when the line array is reallocated, or compacted by shift lines. Rebuilds the tree in O(n).
+	UICodeWrap *wrap = code->wrap;
+
+	if (shift) {
+		for (int i = 0; i < code->lineCount; i++) wrap->rows[i] = wrap->rows[i + shift];
+		wrap->measured = wrap->measured > shift ? wrap->measured - shift : 0;
+	}
+
+	if (code->linesAllocated > wrap->rowsAllocated) {
+		wrap->rows = (int *) UI_REALLOC(wrap->rows, sizeof(int) * code->linesAllocated);
+		for (int i = wrap->rowsAllocated; i < code->linesAllocated; i++) wrap->rows[i] = 0;
+		wrap->rowsAllocated = code->linesAllocated;
+	}
+
+	for (int i = code->linesDropped + code->lineCount; i < wrap->rowsAllocated; i++) wrap->rows[i] = 0;
+
+	wrap->blockCount = (wrap->rowsAllocated + _UI_CODE_WRAP_BLOCK - 1) / _UI_CODE_WRAP_BLOCK;
+	wrap->blocks = (int64_t *) UI_REALLOC(wrap->blocks, sizeof(int64_t) * (wrap->blockCount + 1));
+	wrap->rowCount = 0;
+	for (int k = 0; k <= wrap->blockCount; k++) wrap->blocks[k] = 0;
+
+	for (int i = 0; i < wrap->rowsAllocated; i++) {
+		wrap->blocks[i / _UI_CODE_WRAP_BLOCK + 1] += wrap->rows[i];
+		wrap->rowCount += wrap->rows[i];
+	}
+
+	for (int k = 1; k <= wrap->blockCount; k++) {
+		int parent = k + (k & -k);
+		if (parent <= wrap->blockCount) wrap->blocks[parent] += wrap->blocks[k];
+	}
+}
+
+int64_t _UICodeWrapRowOf(UICode *code, int line) {
+	// The first visual row of a line.
+	UICodeWrap *wrap = code->wrap;
+	int base = code->linesDropped + line, block = base / _UI_CODE_WRAP_BLOCK;
+	int64_t row = 0;
+	for (int k = block; k > 0; k -= k & -k) row += wrap->blocks[k];
+	for (int i = block * _UI_CODE_WRAP_BLOCK; i < base; i++) row += wrap->rows[i];
+	return row;
+}
+
+int _UICodeWrapLineAt(UICode *code, int64_t row, int64_t *lineRow) {
+	// The line containing a visual row, clamped to the last line; *lineRow is set to the line's first row.
+	// Descending the tree finds the block in O(log n); the block itself is scanned.
+	UICodeWrap *wrap = code->wrap;
+	int position = 0, step = 1;
+	int64_t remaining = row;
+	while (step * 2 <= wrap->blockCount) step *= 2;
+
+	for (; step; step >>= 1) {
+		if (position + step <= wrap->blockCount && wrap->blocks[position + step] <= remaining) {
+			position += step;
+			remaining -= wrap->blocks[position];
+		}
+	}
+
+	int base = position * _UI_CODE_WRAP_BLOCK, end = code->linesDropped + code->lineCount;
+	if (base > end - 1) base = end - 1, remaining = row - _UICodeWrapRowOf(code, base - code->linesDropped);
+	while (base < end - 1 && wrap->rows[base] <= remaining) remaining -= wrap->rows[base++];
+	*lineRow = row - remaining;
+	return base - code->linesDropped;
+}
+
+void _UICodeWrapWork(void *cp) {
+	// Measures lines on the worker thread; the UI thread stops it before modifying the content.
+	UICodeWrap *wrap = (UICodeWrap *) cp;
+	UICode *code = wrap->code;
+	int from = wrap->threadFrom;
+
+	while (!wrap->cancel && from < wrap->threadTo) {
+		int to = from;
+		size_t bytes = 0;
+
+		while (to < wrap->threadTo && bytes < _UI_CODE_WRAP_CHUNK_BYTES) {
+			bytes += code->lines[to - code->linesDropped].bytes + 1;
+			to++;
+		}
+
+		_UICodeWrapBatch *batch = (_UICodeWrapBatch *) UI_MALLOC(sizeof(_UICodeWrapBatch) + sizeof(int) * (to - from));
+		batch->header.merge = _UICodeWrapMerge;
+		batch->wrap = wrap;
+		batch->generation = wrap->generation;
+		batch->from = from;
+		batch->count = to - from;
+		batch->finished = to == wrap->threadTo;
+		batch->rows = (int *) (batch + 1);
+
+		for (int i = from; i < to && !wrap->cancel; i++) {
+			batch->rows[i - from] = _UICodeWrapMeasure(code, i - code->linesDropped, wrap->columns, 0x7FFFFFFF, &wrap->cancel);
+		}
+
+		if (wrap->cancel) {
+			UI_FREE(batch);
+			break;
+		}
+
+		UIWindowPostMessage(code->e.window, _UI_MSG_WORKER_BATCH, batch);
+		from = to;
+	}
+}
+
+void _UICodeWrapJoin(UICodeWrap *wrap) {
+	if (!wrap->threadRunning) return;
+#ifdef _UI_THREADS
+	_UIThreadJoin(wrap->thread);
+#endif
+	wrap->threadRunning = false;
+}
+
+void _UICodeWrapStop(UICodeWrap *wrap) {
+	wrap->cancel = 1;
+	_UICodeWrapJoin(wrap);
+	wrap->cancel = 0;
+	wrap->generation++;
+	wrap->paintRow = 0; // The lines or the columns are about to change.
+}
+
+void _UICodeWrapResume(UICode *code) {
+	// Measure the lines after wrap->measured, on the UI thread if there is not much to do.
+	UICodeWrap *wrap = code->wrap;
+	int from = wrap->measured > code->linesDropped ? wrap->measured : code->linesDropped;
+	int to = code->linesDropped + code->lineCount;
+	wrap->finished = false;
+
+	if (!wrap->columns) {
+		return;
+	} else if (from < to) {
+		UICodeLine *last = &code->lines[to - 1 - code->linesDropped];
+		size_t bytes = (size_t) last->offset + last->bytes - code->lines[from - code->linesDropped].offset;
+
+#ifdef _UI_THREADS
+		if (bytes > _UI_CODE_WRAP_CHUNK_BYTES) {
+			wrap->threadFrom = from, wrap->threadTo = to;
+			wrap->threadRunning = true;
+			wrap->thread = _UIThreadCreate(_UICodeWrapWork, wrap);
+			return;
+		}
+#endif
+
+		for (int i = from; i < to; i++) {
+			int rows = _UICodeWrapMeasure(code, i - code->linesDropped, wrap->columns, 0x7FFFFFFF, &wrap->cancel);
+			_UICodeWrapSetRows(wrap, i, 1, &rows, 0);
+		}
+
+		wrap->measured = to;
+	}
+
+	wrap->finished = true;
+}
+
+void _UICodeWrapMerge(_UIWorkerBatch *header) {
+	_UICodeWrapBatch *batch = (_UICodeWrapBatch *) header;
+	UICodeWrap *wrap = ui.codeWraps;
+	while (wrap && wrap != batch->wrap) wrap = wrap->next;
+
+	if (wrap && wrap->generation == batch->generation) {
+		UICode *code = wrap->code;
+		UIFont *previousFont = UIFontActivate(code->font);
+		int lineHeight = UIMeasureStringHeight();
+		UIFontActivate(previousFont);
+
+		// Keep following the end, or keep the line at the top of the view still.
+		bool follow = code->vScroll->position >= code->vScroll->maximum - code->vScroll->page;
+		int64_t lineRow = 0;
+		int top = code->lineCount ? _UICodeWrapLineAt(code, code->vScroll->position / lineHeight, &lineRow) : 0;
+
+		_UICodeWrapSetRows(wrap, batch->from, batch->count, batch->rows, 0);
+		wrap->measured = batch->from + batch->count;
+
+		if (follow) {
+			code->vScroll->position = wrap->rowCount * lineHeight;
+		} else if (code->lineCount) {
+			code->vScroll->position += (_UICodeWrapRowOf(code, top) - lineRow) * lineHeight;
+		}
+
+		if (batch->finished) {
+			_UICodeWrapJoin(wrap);
+			wrap->finished = true;
+		}
+
+		UIElementMessage(&code->e, UI_MSG_CODE_WRAP_PROGRESS, wrap->finished, 0);
+		UIElementRefresh(&code->e);
+	}
+
+	UI_FREE(batch);
+}
+
+void _UICodeWrapFree(UICode *code) {
+	UICodeWrap *wrap = code->wrap;
+	if (!wrap) return;
+	_UICodeWrapStop(wrap);
+	UICodeWrap **link = &ui.codeWraps;
+	while (*link != wrap) link = &(*link)->next;
+	*link = wrap->next;
+	UI_FREE(wrap->rows);
+	UI_FREE(wrap->blocks);
+	UI_FREE(wrap);
+	code->wrap = NULL;
+}
+
+void _UICodeWrapCreate(UICode *code) {
+	UICodeWrap *wrap = (UICodeWrap *) UI_CALLOC(sizeof(UICodeWrap));
+	wrap->code = code;
+	wrap->next = ui.codeWraps;
+	ui.codeWraps = wrap;
+	code->wrap = wrap;
+	_UICodeWrapSync(code, 0);
+	_UICodeWrapSetRows(wrap, code->linesDropped, code->lineCount, NULL, 1);
+}
+
+void _UICodeDrawHits(UICode *code, UIPainter *painter, UIRectangle bounds, int from, int to) {
+	// Highlights the search hits within the content range [from, to), drawn starting at bounds.l.
+	UICodeSearch *search = code->search;
+	int lo = 0, hi = search->hitCount;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (search->hits[mid].offset + search->hits[mid].bytes <= from) lo = mid + 1;
+		else hi = mid;
+	}
+
+	int column = 0, columnOffset = from;
+
+	for (int j = lo; j < search->hitCount && search->hits[j].offset < to; j++) {
+		int hitFrom = search->hits[j].offset > from ? search->hits[j].offset : from;
+		int hitTo = search->hits[j].offset + search->hits[j].bytes < to ? search->hits[j].offset + search->hits[j].bytes : to;
+		UIRectangle hitBounds = bounds;
+		columnOffset += _UIStringSkipColumns(code->content + columnOffset, hitFrom - columnOffset, 0x7FFFFFFF, code->tabSize, &column);
+		hitBounds.l = bounds.l + column * ui.activeFont->glyphWidth;
+		if (hitBounds.l >= painter->clip.r) break;
+		columnOffset += _UIStringSkipColumns(code->content + columnOffset, hitTo - columnOffset, 0x7FFFFFFF, code->tabSize, &column);
+		hitBounds.r = bounds.l + column * ui.activeFont->glyphWidth;
+		UIDrawBlock(painter, hitBounds, ui.theme.codeSearchHit);
+	}
+}
+
+void _UICodeDrawMargin(UICode *code, UIPainter *painter, UIRectangle lineBounds, int line) {
+	char string[16];
+	int p = 16;
+	int lineNumber = line + 1;
+
+	while (lineNumber) {
+		string[--p] = (lineNumber % 10) + '0';
+		lineNumber /= 10;
+	}
+
+	UIRectangle marginBounds = lineBounds;
+	marginBounds.r = marginBounds.l - UI_SIZE_CODE_MARGIN_GAP;
+	marginBounds.l -= UI_SIZE_CODE_MARGIN + UI_SIZE_CODE_MARGIN_GAP;
+
+	uint32_t marginColor = UIElementMessage(&code->e, UI_MSG_CODE_GET_MARGIN_COLOR, line + 1, 0);
+
+	if (marginColor) {
+		UIDrawBlock(painter, marginBounds, marginColor);
+	}
+
+	UIDrawString(painter, marginBounds, string + p, 16 - p, ui.theme.codeDefault, UI_ALIGN_RIGHT, NULL);
+}
+
+int UICodeHitTest(UICode *code, int x, int y) {
+	x -= code->e.bounds.l;
+
+	if (x < 0 || x >= UI_RECT_WIDTH(code->e.bounds) - UI_SIZE_SCROLL_BAR * code->e.window->scale) {
+		return 0;
+	}
+
+	y -= code->e.bounds.t - code->vScroll->position;
+
+	float previousScale = _UIFontScaleEnter(code->e.window);
+	UIFont *previousFont = UIFontActivate(code->font);
+	int lineHeight = UIMeasureStringHeight();
+	bool inMargin = x < UI_SIZE_CODE_MARGIN + UI_SIZE_CODE_MARGIN_GAP / 2 && (~code->e.flags & UI_CODE_NO_MARGIN);
+	UIFontActivate(previousFont);
+	_UIFontScaleLeave(previousScale);
+
+	if (y < 0 || y >= lineHeight * (code->wrap ? code->wrap->rowCount : code->lineCount)) {
+		return 0;
+	}
+
+	int64_t lineRow;
+	int line = (code->wrap ? _UICodeWrapLineAt(code, y / lineHeight, &lineRow) : y / lineHeight) + 1;
+	return inMargin ? -line : line;
+}
+
+int _UICodeMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UICode *code = (UICode *) element;
+	
+	if (message == UI_MSG_LAYOUT) {
+		UIFont *previousFont = UIFontActivate(code->font);
+		int lineHeight = UIMeasureStringHeight();
+
+		if (code->wrap) {
+			UICodeWrap *wrap = code->wrap;
+			int textWidth = UI_RECT_WIDTH(element->bounds) - UI_SIZE_SCROLL_BAR * code->e.window->scale
+				- ((~code->e.flags & UI_CODE_NO_MARGIN) ? UI_SIZE_CODE_MARGIN + UI_SIZE_CODE_MARGIN_GAP : 0);
+			int columns = textWidth / ui.activeFont->glyphWidth;
+			if (columns < 1) columns = 1;
+
+			if (columns != wrap->columns && code->lineCount) {
+				// Remeasure everything in the background, keeping the top line still.
+				int64_t lineRow;
+				int top = _UICodeWrapLineAt(code, code->vScroll->position / lineHeight, &lineRow);
+				double offset = code->vScroll->position - lineRow * lineHeight;
+				_UICodeWrapStop(wrap);
+				wrap->columns = columns;
+				wrap->measured = code->linesDropped;
+				_UICodeWrapResume(code);
+				code->vScroll->position = _UICodeWrapRowOf(code, top) * lineHeight + offset;
+			} else if (columns != wrap->columns) {
+				wrap->columns = columns;
+			}
+
+			if (code->moveScrollToFocusNextLayout && code->focused >= 0 && code->focused < code->lineCount) {
+				code->vScroll->position = (_UICodeWrapRowOf(code, code->focused) + 0.5) * lineHeight - UI_RECT_HEIGHT(code->e.bounds) / 2;
+			}
+
+			if (code->lineCount) {
+				// Measure the visible lines the worker has not reached yet, only as far as the view needs;
+				// the worker replaces these counts when it gets to them.
+				int64_t lineRow, row = code->vScroll->position > 0 ? code->vScroll->position / lineHeight : 0;
+				int64_t rowsNeeded = row + UI_RECT_HEIGHT(element->bounds) / lineHeight + 2;
+
+				for (int i = _UICodeWrapLineAt(code, row, &lineRow); i < code->lineCount && lineRow < rowsNeeded; i++) {
+					if (code->linesDropped + i >= wrap->measured) {
+						int rows = _UICodeWrapMeasure(code, i, wrap->columns, rowsNeeded - lineRow, &wrap->cancel);
+						_UICodeWrapSetRows(wrap, code->linesDropped + i, 1, &rows, 0);
+					}
+
+					lineRow += wrap->rows[code->linesDropped + i];
+				}
+			}
+
+			code->vScroll->maximum = wrap->rowCount * lineHeight;
+		} else {
+			if (code->moveScrollToFocusNextLayout) {
+				code->vScroll->position = (code->focused + 0.5) * lineHeight - UI_RECT_HEIGHT(code->e.bounds) / 2;
+			}
+
+			code->vScroll->maximum = code->lineCount * lineHeight;
+		}
+
+		UIRectangle scrollBarBounds = element->bounds;
+		scrollBarBounds.l = scrollBarBounds.r - UI_SIZE_SCROLL_BAR * code->e.window->scale;
+		code->vScroll->page = UI_RECT_HEIGHT(element->bounds);
+		UIFontActivate(previousFont);
+		UIElementMove(&code->vScroll->e, scrollBarBounds, true);
+	} else if (message == UI_MSG_PAINT) {
+		UIFont *previousFont = UIFontActivate(code->font);
+
+		UIPainter *painter = (UIPainter *) dp;
+		UIRectangle lineBounds = element->bounds;
+		lineBounds.r -= UI_SIZE_SCROLL_BAR * code->e.window->scale;
+
+		if (~code->e.flags & UI_CODE_NO_MARGIN) {
+			lineBounds.l += UI_SIZE_CODE_MARGIN + UI_SIZE_CODE_MARGIN_GAP;
+		}
+
+		int lineHeight = UIMeasureStringHeight();
+		int64_t firstRow = code->vScroll->position / lineHeight, lineRow = firstRow;
+		int i = firstRow;
+
+		if (code->wrap && code->lineCount) {
+			i = _UICodeWrapLineAt(code, firstRow, &lineRow);
+		}
+
+		lineBounds.t -= (int64_t) code->vScroll->position % lineHeight + (firstRow - lineRow) * lineHeight;
+		const UILexer *lexer = code->lexer ? code->lexer : ui.lexerC;
+
+		UIDrawBlock(painter, element->bounds, ui.theme.codeBackground);
+
+		for (; i < code->lineCount; i++) {
+			if (lineBounds.t > element->clip.b) {
+				break;
+			}
+
+			lineBounds.b = lineBounds.t + lineHeight;
+
+			if (~code->e.flags & UI_CODE_NO_MARGIN) {
+				_UICodeDrawMargin(code, painter, lineBounds, i);
+			}
+
+			const char *string = code->content + code->lines[i].offset;
+			int bytes = code->lines[i].bytes, x = lineBounds.l;
+			UIRectangle rowBounds = lineBounds;
+			uint8_t state = 0;
+			int start = 0, row = 0;
+			UICodeWrap *wrap = code->wrap;
+
+			if (wrap && wrap->paintRow && wrap->paintLine == code->linesDropped + i && wrap->paintTabSize == code->tabSize 
+					&& wrap->paintLexer == lexer && lineBounds.t + wrap->paintRow * lineHeight <= element->clip.t) {
+				// Continue from where the previous paint started in this line, rather than from the line's first row.
+				start = wrap->paintStart, row = wrap->paintRow, state = wrap->paintState;
+				rowBounds.t += row * lineHeight, rowBounds.b += row * lineHeight;
+			}
+
+			for (; rowBounds.t <= element->clip.b; row++) {
+				// Without wrapping, the line is a single row.
+				int end = wrap ? _UICodeWrapNext(string, bytes, start, wrap->columns, code->tabSize) : bytes;
+
+				if (rowBounds.b <= element->clip.t) {
+					state = _UILexerAdvance(lexer, state, string + start, end - start);
+				} else {
+					if (wrap && row && rowBounds.t <= element->clip.t) {
+						wrap->paintLine = code->linesDropped + i, wrap->paintRow = row, wrap->paintStart = start;
+						wrap->paintState = state, wrap->paintTabSize = code->tabSize, wrap->paintLexer = lexer;
+					}
+
+					if (code->focused == i) {
+						UIDrawBlock(painter, rowBounds, ui.theme.codeFocused);
+					}
+
+					if (code->search) {
+						_UICodeDrawHits(code, painter, rowBounds, code->lines[i].offset + start, code->lines[i].offset + end);
+					}
+
+					x = _UIDrawStringLexed(painter, rowBounds, string + start, end - start, code->tabSize, lexer, &state);
+				}
+
+				if (end == bytes) break;
+				start = end;
+				rowBounds.t += lineHeight, rowBounds.b += lineHeight;
+			}
+
+			UICodeDecorateLine m = { 0 };
+			m.x = x, m.y = (rowBounds.t + rowBounds.b - lineHeight) / 2, m.index = i + 1, m.painter = painter;
+			m.bounds = lineBounds, m.bounds.b = rowBounds.b;
+			UIElementMessage(element, UI_MSG_CODE_DECORATE_LINE, 0, &m);
+
+			lineBounds.t = rowBounds.b;
+		}
+
+		UIFontActivate(previousFont);
+	} else if (message == UI_MSG_SCROLLED) {
+		code->moveScrollToFocusNextLayout = false;
+		UIElementRefresh(element);
+	} else if (message == UI_MSG_MOUSE_WHEEL) {
+		return UIElementMessage(&code->vScroll->e, message, di, dp);
+	} else if (message == UI_MSG_GET_CURSOR) {
+		if (UICodeHitTest(code, element->window->cursorX, element->window->cursorY) < 0) {
+			return UI_CURSOR_FLIPPED_ARROW;
+		}
+	} else if (message == UI_MSG_DESTROY) {
+		_UICodeSearchFree(code);
+		_UICodeWrapFree(code);
+		UI_FREE(code->content);
+		UI_FREE(code->lines - code->linesDropped);
+	}
+
+	return 0;
+}
+
+void UICodeFocusLine(UICode *code, int index) {
+	code->focused = index - 1;
+	code->moveScrollToFocusNextLayout = true;
+}
+
+void _UICodeReserve(UICode *code, size_t byteCount, int lineCount) {
+	// Dropped lines leave dead space at the start of the buffers. 
+	// It is only reclaimed once it is at least as large as the live part, so each byte is moved O(1) times amortized.
+
+	if (code->contentBytes + byteCount > code->contentAllocated) {
+		size_t start = code->lineCount ? code->lines[0].offset : code->contentBytes;
+		size_t live = code->contentBytes - start;
+
+		if (start && start >= live) {
+			for (uintptr_t i = 0; i < live; i++) code->content[i] = code->content[start + i];
+			for (int i = 0; i < code->lineCount; i++) code->lines[i].offset -= start;
+			code->contentBytes = live;
+
+			if (code->search) {
+				for (int i = 0; i < code->search->hitCount; i++) code->search->hits[i].offset -= start;
+				code->search->searched = code->search->searched > start ? code->search->searched - start : 0;
+			}
+		}
+
+		if (code->contentBytes + byteCount > code->contentAllocated) {
+			code->contentAllocated *= 2;
+			if (code->contentAllocated < code->contentBytes + byteCount) code->contentAllocated = code->contentBytes + byteCount;
+			code->content = (char *) UI_REALLOC(code->content, code->contentAllocated);
+		}
+	}
+
+	if (code->linesDropped + code->lineCount + lineCount > code->linesAllocated) {
+		UICodeLine *base = code->lines - code->linesDropped;
+		int shift = 0;
+
+		if (code->linesDropped && code->linesDropped >= code->lineCount) {
+			for (int i = 0; i < code->lineCount; i++) base[i] = code->lines[i];
+			code->lines = base;
+			shift = code->linesDropped;
+			code->linesDropped = 0;
+		}
+
+		if (code->linesDropped + code->lineCount + lineCount > code->linesAllocated) {
+			code->linesAllocated *= 2;
+			if (code->linesAllocated < code->linesDropped + code->lineCount + lineCount) code->linesAllocated = code->linesDropped + code->lineCount + lineCount;
+			base = (UICodeLine *) UI_REALLOC(base, sizeof(UICodeLine) * code->linesAllocated);
+			code->lines = base + code->linesDropped;
+		}
+
+		if (code->wrap) {
+			_UICodeWrapSync(code, shift);
+		}
+	}
+}
+
+void UICodeInsertContent(UICode *code, const char *content, ptrdiff_t byteCount, bool replace) {
+	float previousScale = _UIFontScaleEnter(code->e.window);
+	UIFont *previousFont = UIFontActivate(code->font);
+	int lineHeight = UIMeasureStringHeight();
+	bool streaming = code->maximumBytes || code->maximumLines;
+	bool follow = !streaming || code->vScroll->position >= code->vScroll->maximum - code->vScroll->page;
+	if (code->search) _UICodeSearchStop(code->search);
+	if (code->wrap) _UICodeWrapStop(code->wrap);
+
+	if (byteCount == -1) {
+		byteCount = _UIStringLength(content);
+	}
+
+	if (byteCount > 1000000000) {
+		byteCount = 1000000000;
+	}
+
+	if (replace) {
+		UI_FREE(code->content);
+		UI_FREE(code->lines - code->linesDropped);
+		code->content = NULL;
+		code->lines = NULL;
+		code->contentBytes = code->contentAllocated = 0;
+		code->lineCount = code->linesAllocated = code->linesDropped = 0;
+
+		if (code->search) {
+			code->search->hits -= code->search->hitsDropped;
+			code->search->hitCount = code->search->hitsDropped = 0;
+			code->search->current = -1;
+			code->search->searched = 0;
+		}
+
+		if (code->wrap) {
+			code->wrap->measured = 0;
+			_UICodeWrapSync(code, 0);
+		}
+	}
+
+	if (!byteCount) {
+		if (code->search) _UICodeSearchResume(code);
+		if (code->wrap) _UICodeWrapResume(code);
+		UIFontActivate(previousFont);
+		_UIFontScaleLeave(previousScale);
+		return;
+	}
+
+	int lineCount = content[byteCount - 1] != '\n';
+
+	for (int i = 0; i < byteCount; i++) {
+		if (content[i] == '\n') {
+			lineCount++;
+		}
+	}
+
+	_UICodeReserve(code, byteCount, lineCount);
+
+	for (int i = 0; i < byteCount; i++) {
+		code->content[i + code->contentBytes] = content[i];
+	}
+
+	int offset = 0, lineIndex = 0;
+
+	for (intptr_t i = 0; i <= byteCount && lineIndex < lineCount; i++) {
+		if (i == byteCount || content[i] == '\n') {
+			UICodeLine line = { 0 };
+			line.offset = offset + code->contentBytes;
+			line.bytes = i - offset;
+			code->lines[code->lineCount + lineIndex] = line;
+			lineIndex++;
+			offset = i + 1;
+		}
+	}
+
+	if (code->wrap) {
+		_UICodeWrapSetRows(code->wrap, code->linesDropped + code->lineCount, lineCount, NULL, 1);
+	}
+
+	code->lineCount += lineCount;
+	code->contentBytes += byteCount;
+
+	if (streaming) {
+		int drop = 0;
+
+		while (drop < code->lineCount - 1) {
+			bool overLines = code->maximumLines && code->lineCount - drop > code->maximumLines;
+			bool overBytes = code->maximumBytes && code->contentBytes - code->lines[drop].offset > code->maximumBytes;
+			if (!overLines && !overBytes) break;
+			drop++;
+		}
+
+		int64_t droppedRows = drop;
+
+		if (code->wrap) {
+			droppedRows = _UICodeWrapRowOf(code, drop);
+			_UICodeWrapSetRows(code->wrap, code->linesDropped, drop, NULL, 0);
+		}
+
+		code->lines += drop;
+		code->lineCount -= drop;
+		code->linesDropped += drop;
+
+		if (code->focused != -1) {
+			code->focused = code->focused >= drop ? code->focused - drop : -1;
+		}
+
+		if (code->search) {
+			UICodeSearch *search = code->search;
+			int dropHits = 0;
+			while (dropHits < search->hitCount && search->hits[dropHits].offset < code->lines[0].offset) dropHits++;
+			search->hits += dropHits;
+			search->hitCount -= dropHits;
+			search->hitsDropped += dropHits;
+			if (search->current != -1) search->current = search->current >= dropHits ? search->current - dropHits : -1;
+		}
+
+		if (!follow) {
+			// Keep the same text in view.
+			code->vScroll->position -= droppedRows * lineHeight;
+			if (code->vScroll->position < 0) code->vScroll->position = 0;
+		}
+	}
+
+	if (code->search) {
+		_UICodeSearchResume(code);
+	}
+
+	if (code->wrap) {
+		_UICodeWrapResume(code);
+	}
+
+	if (!replace && follow) {
+		code->vScroll->position = (code->wrap ? code->wrap->rowCount : code->lineCount) * lineHeight;
+	}
+
+	UIFontActivate(previousFont);
+	_UIFontScaleLeave(previousScale);
+}
+
+void UICodeSetSearch(UICode *code, const char *query, ptrdiff_t queryBytes, uint32_t flags) {
+	if (queryBytes == -1) queryBytes = _UIStringLength(query);
+	_UICodeSearchFree(code);
+
+	if (queryBytes) {
+		UICodeSearch *search = (UICodeSearch *) UI_CALLOC(sizeof(UICodeSearch));
+		search->code = code;
+		search->query = UIStringCopy(query, queryBytes);
+		search->queryBytes = queryBytes;
+		search->flags = flags;
+		search->current = -1;
+		search->next = ui.codeSearches;
+		ui.codeSearches = search;
+		code->search = search;
+		_UICodeSearchResume(code);
+	}
+
+	UIElementRepaint(&code->e, NULL);
+}
+
+bool UICodeSearchNext(UICode *code, bool backwards) {
+	UICodeSearch *search = code->search;
+	if (!search || !search->hitCount) return false;
+
+	if (search->current == -1) {
+		// Start from the focused line, or the top of the view.
+		float previousScale = _UIFontScaleEnter(code->e.window);
+		UIFont *previousFont = UIFontActivate(code->font);
+		int64_t row = code->vScroll->position / UIMeasureStringHeight(), lineRow;
+		int line = code->focused != -1 ? code->focused : code->wrap && code->lineCount ? _UICodeWrapLineAt(code, row, &lineRow) : row;
+		UIFontActivate(previousFont);
+		_UIFontScaleLeave(previousScale);
+		int offset = line < code->lineCount ? code->lines[line].offset : code->contentBytes;
+		int lo = 0, hi = search->hitCount;
+
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (search->hits[mid].offset < offset) lo = mid + 1;
+			else hi = mid;
+		}
+
+		search->current = backwards ? lo - 1 : lo;
+	} else {
+		search->current += backwards ? -1 : 1;
+	}
+
+	if (search->current < 0) search->current = search->hitCount - 1;
+	if (search->current >= search->hitCount) search->current = 0;
+
+	int lo = 0, hi = code->lineCount;
+
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		if (code->lines[mid].offset <= search->hits[search->current].offset) lo = mid;
+		else hi = mid;
+	}
+
+	UICodeFocusLine(code, lo + 1);
+	UIElementRefresh(&code->e);
+	return true;
+}
+
+UICode *UICodeCreate(UIElement *parent, uint32_t flags) {
+	UICode *code = (UICode *) UIElementCreate(sizeof(UICode), parent, flags, _UICodeMessage, "Code");
+	code->font = ui.activeFont;
+	code->vScroll = UIScrollBarCreate(&code->e, 0);
+	code->focused = -1;
+	code->tabSize = 4;
+	if (flags & UI_CODE_WRAP) _UICodeWrapCreate(code);
+	return code;
+}
+
+void UICodeSetWrap(UICode *code, bool wrap) {
+	if (wrap == !!code->wrap) return;
+	if (wrap) _UICodeWrapCreate(code);
+	else _UICodeWrapFree(code);
+	UIElementRefresh(&code->e);
+}
+
+int _UIGaugeMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UIGauge *gauge = (UIGauge *) element;
+
+	if (message == UI_MSG_GET_HEIGHT) {
+		return UI_SIZE_GAUGE_HEIGHT * element->window->scale;
+	} else if (message == UI_MSG_GET_WIDTH) {
+		return UI_SIZE_GAUGE_WIDTH * element->window->scale;
+	} else if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+		UIDrawRectangle(painter, element->bounds, ui.theme.buttonNormal, ui.theme.border, UI_RECT_1(1));
+		UIRectangle filled = UIRectangleAdd(element->bounds, UI_RECT_1I(1));
+		filled.r = filled.l + UI_RECT_WIDTH(filled) * gauge->position;
+		UIDrawBlock(painter, filled, ui.theme.selected);
+	}
+
+	return 0;
+}
+
+UIGauge *UIGaugeCreate(UIElement *parent, uint32_t flags) {
+	return (UIGauge *) UIElementCreate(sizeof(UIGauge), parent, flags, _UIGaugeMessage, "Gauge");
+}
+
+int _UISliderMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UISlider *slider = (UISlider *) element;
+
+	if (message == UI_MSG_GET_HEIGHT) {
+		return UI_SIZE_SLIDER_HEIGHT * element->window->scale;
+	} else if (message == UI_MSG_GET_WIDTH) {
+		return UI_SIZE_SLIDER_WIDTH * element->window->scale;
+	} else if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+		UIRectangle bounds = element->bounds;
+		int centerY = (bounds.t + bounds.b) / 2;
+		int trackSize = UI_SIZE_SLIDER_TRACK * element->window->scale;
+		int thumbSize = UI_SIZE_SLIDER_THUMB * element->window->scale;
+		int thumbPosition = (UI_RECT_WIDTH(bounds) - thumbSize) * slider->position;
+		UIRectangle track = UI_RECT_4(bounds.l, bounds.r, centerY - (trackSize + 1) / 2, centerY + trackSize / 2);
+		UIDrawRectangle(painter, track, ui.theme.buttonNormal, ui.theme.border, UI_RECT_1(1));
+		bool pressed = element == element->window->pressed;
+		bool hovered = element == element->window->hovered;
+		bool disabled = element->flags & UI_ELEMENT_DISABLED;
+		uint32_t color = disabled ? ui.theme.buttonDisabled : pressed ? ui.theme.buttonPressed : hovered ? ui.theme.buttonHovered : ui.theme.buttonNormal;
+		UIRectangle thumb = UI_RECT_4(bounds.l + thumbPosition, bounds.l + thumbPosition + thumbSize, centerY - (thumbSize + 1) / 2, centerY + thumbSize / 2);
+		UIDrawRectangle(painter, thumb, color, ui.theme.border, UI_RECT_1(1));
+	} else if (message == UI_MSG_LEFT_DOWN || (message == UI_MSG_MOUSE_DRAG && element->window->pressedButton == 1)) {
+		UIRectangle bounds = element->bounds;
+		int thumbSize = UI_SIZE_SLIDER_THUMB * element->window->scale;
+		slider->position = (float) (element->window->cursorX - thumbSize / 2 - bounds.l) / (UI_RECT_WIDTH(bounds) - thumbSize);
+		if (slider->steps > 1) slider->position = (int) (slider->position * (slider->steps - 1) + 0.5f) / (float) (slider->steps - 1);
+		if (slider->position < 0) slider->position = 0;
+		if (slider->position > 1) slider->position = 1;
+		UIElementMessage(element, UI_MSG_VALUE_CHANGED, 0, 0);
+		UIElementRepaint(element, NULL);
+	} else if (message == UI_MSG_UPDATE) {
+		UIElementRepaint(element, NULL);
+	}
+
+	return 0;
+}
+
+UISlider *UISliderCreate(UIElement *parent, uint32_t flags) {
+	return (UISlider *) UIElementCreate(sizeof(UISlider), parent, flags, _UISliderMessage, "Slider");
+}
+
+#define _UI_TABLE_SORT_PARTS (4)
+#define _UI_TABLE_SORT_THREADED_ITEMS (65536)
+
+typedef struct _UITableSortJob {
+	struct _UITableSortJob *next;
+	UITable *table;
+	int generation, count;
+	uint64_t *keys, *scratchKeys;
+	int *items, *scratchItems;
+	volatile int cancel;
+	bool threadRunning;
+	uintptr_t thread;
+} _UITableSortJob;
+
+typedef struct _UITableSortPart {
+	uint64_t *keys, *scratchKeys;
+	int *items, *scratchItems;
+	int count;
+	volatile int *cancel;
+} _UITableSortPart;
+
+typedef struct _UITableSortBatch {
+	_UIWorkerBatch header;
+	_UITableSortJob *job;
+	int generation;
+} _UITableSortBatch;
+
+void _UITableSortMergeBatch(_UIWorkerBatch *header);
+
+void _UITableRadixSort(void *cp) {
+	// Stable LSD radix sort on 8-bit digits. Digits that are the same for every key are skipped.
+	_UITableSortPart *part = (_UITableSortPart *) cp;
+	uint64_t *keys = part->keys, *scratchKeys = part->scratchKeys;
+	int *items = part->items, *scratchItems = part->scratchItems;
+	int count = part->count;
+	if (!count) return;
+	int *histograms = (int *) UI_CALLOC(8 * 256 * sizeof(int));
+
+	for (int i = 0; i < count; i++) {
+		uint64_t key = keys[i];
+		for (int d = 0; d < 8; d++) histograms[d * 256 + ((key >> (d * 8)) & 0xFF)]++;
 	}
 
-	return panel;
+	for (int d = 0; d < 8 && !*part->cancel; d++) {
+		int *histogram = histograms + d * 256;
+		if (histogram[(keys[0] >> (d * 8)) & 0xFF] == count) continue;
+
+		for (int i = 0, total = 0; i < 256; i++) {
+			int n = histogram[i];
+			histogram[i] = total;
+			total += n;
+		}
+
+		for (int i = 0; i < count; i++) {
+			int position = histogram[(keys[i] >> (d * 8)) & 0xFF]++;
+			scratchKeys[position] = keys[i];
+			scratchItems[position] = items[i];
+		}
+
+		UI_SWAP(uint64_t *, keys, scratchKeys);
+		UI_SWAP(int *, items, scratchItems);
+	}
+
+	if (keys != part->keys) {
+		for (int i = 0; i < count; i++) part->keys[i] = keys[i], part->items[i] = items[i];
+	}
+
+	UI_FREE(histograms);
 }
 
-void _UIWrapPanelLayoutRow(UIWrapPanel *panel, UIElement *child, UIElement *rowEnd, int rowY, int rowHeight) {
-	int rowPosition = 0;
+void _UITableSortMerge(uint64_t *keys, int *items, int left, int count, uint64_t *outKeys, int *outItems) {
+	// Merges the sorted runs [0, left) and [left, count); ties take from the left run to keep the sort stable.
+	int i = 0, j = left, k = 0;
 
-	while (child != rowEnd) {
-		int height = UIElementMessage(child, UI_MSG_GET_HEIGHT, 0, 0);
-		int width = UIElementMessage(child, UI_MSG_GET_WIDTH, 0, 0);
-		UIRectangle relative = UI_RECT_4(rowPosition, rowPosition + width, rowY + rowHeight / 2 - height / 2, rowY + rowHeight / 2 + height / 2);
-		UIElementMove(child, UIRectangleTranslate(relative, panel->e.bounds), false);
-		child = child->next;
-		rowPosition += width;
+	while (i < left && j < count) {
+		if (keys[j] < keys[i]) outKeys[k] = keys[j], outItems[k++] = items[j++];
+		else outKeys[k] = keys[i], outItems[k++] = items[i++];
 	}
+
+	while (i < left) outKeys[k] = keys[i], outItems[k++] = items[i++];
+	while (j < count) outKeys[k] = keys[j], outItems[k++] = items[j++];
 }
 
-int _UIWrapPanelMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UIWrapPanel *panel = (UIWrapPanel *) element;
-	bool horizontal = element->flags & UI_PANEL_HORIZONTAL;
+void _UITableSortJobRun(_UITableSortJob *job) {
+	// Sort a quarter of the items on each thread, then merge the quarters into halves, and the halves back into the job.
+	int count = job->count;
+	_UITableSortPart parts[_UI_TABLE_SORT_PARTS];
+	int starts[_UI_TABLE_SORT_PARTS + 1];
 
-	if (message == UI_MSG_LAYOUT || message == UI_MSG_GET_HEIGHT) {
-		int totalHeight = 0;
-		int rowPosition = 0;
-		int rowHeight = 0;
-		int rowLimit = message == UI_MSG_LAYOUT ? UI_RECT_WIDTH(element->bounds) : di;
+	for (int i = 0; i <= _UI_TABLE_SORT_PARTS; i++) {
+		starts[i] = (int) ((int64_t) count * i / _UI_TABLE_SORT_PARTS);
+	}
 
-		UIElement *child = panel->e.children;
-		UIElement *rowStart = child;
+	for (int i = 0; i < _UI_TABLE_SORT_PARTS; i++) {
+		parts[i].keys = job->keys + starts[i], parts[i].scratchKeys = job->scratchKeys + starts[i];
+		parts[i].items = job->items + starts[i], parts[i].scratchItems = job->scratchItems + starts[i];
+		parts[i].count = starts[i + 1] - starts[i];
+		parts[i].cancel = &job->cancel;
+	}
 
-		while (child) {
-			if (~child->flags & UI_ELEMENT_HIDE) {
-				int height = UIElementMessage(child, UI_MSG_GET_HEIGHT, 0, 0);
-				int width = UIElementMessage(child, UI_MSG_GET_WIDTH, 0, 0);
+#ifdef _UI_THREADS
+	if (count >= _UI_TABLE_SORT_THREADED_ITEMS) {
+		uintptr_t threads[_UI_TABLE_SORT_PARTS];
+		for (int i = 1; i < _UI_TABLE_SORT_PARTS; i++) threads[i] = _UIThreadCreate(_UITableRadixSort, &parts[i]);
+		_UITableRadixSort(&parts[0]);
+		for (int i = 1; i < _UI_TABLE_SORT_PARTS; i++) _UIThreadJoin(threads[i]);
+	} else
+#endif
+	{
+		for (int i = 0; i < _UI_TABLE_SORT_PARTS; i++) _UITableRadixSort(&parts[i]);
+	}
 
-				if (rowLimit && rowPosition + width > rowLimit) {
-					_UIWrapPanelLayoutRow(panel, rowStart, child, totalHeight, rowHeight);
-					totalHeight += rowHeight;
-					rowPosition = rowHeight = 0;
-					rowStart = child;
-				}
+	if (job->cancel) return;
+	int half = starts[_UI_TABLE_SORT_PARTS / 2];
+	_UITableSortMerge(job->keys, job->items, starts[1], half, job->scratchKeys, job->scratchItems);
+	_UITableSortMerge(job->keys + half, job->items + half, starts[3] - half, count - half, job->scratchKeys + half, job->scratchItems + half);
+	if (job->cancel) return;
+	_UITableSortMerge(job->scratchKeys, job->scratchItems, half, count, job->keys, job->items);
+}
 
-				if (height > rowHeight) {
-					rowHeight = height;
-				}
+void _UITableSortWork(void *cp) {
+	_UITableSortJob *job = (_UITableSortJob *) cp;
+	_UITableSortJobRun(job);
+	if (job->cancel) return;
+	_UITableSortBatch *batch = (_UITableSortBatch *) UI_MALLOC(sizeof(_UITableSortBatch));
+	batch->header.merge = _UITableSortMergeBatch;
+	batch->job = job;
+	batch->generation = job->generation;
+	UIWindowPostMessage(job->table->e.window, _UI_MSG_WORKER_BATCH, batch);
+}
 
-				rowPosition += width;
+void _UITableSortStop(_UITableSortJob *job) {
+	job->cancel = 1;
+
+#ifdef _UI_THREADS
+	if (job->threadRunning) _UIThreadJoin(job->thread);
+#endif
+
+	job->threadRunning = false;
+	job->cancel = 0;
+	job->generation++;
+}
+
+void _UITableModelGrow(UITable *table, int count) {
+	if (count <= table->modelAllocated) return;
+	table->modelAllocated = count > table->modelAllocated * 2 ? count : table->modelAllocated * 2;
+	table->order = (int *) UI_REALLOC(table->order, table->modelAllocated * sizeof(int));
+	table->rows = (int *) UI_REALLOC(table->rows, table->modelAllocated * sizeof(int));
+	table->rowOf = (int *) UI_REALLOC(table->rowOf, table->modelAllocated * sizeof(int));
+	table->hidden = (bool *) UI_REALLOC(table->hidden, table->modelAllocated * sizeof(bool));
+	table->sortKeys = (uint64_t *) UI_REALLOC(table->sortKeys, table->modelAllocated * sizeof(uint64_t));
+}
+
+bool _UITableGetSortKeys(UITable *table, int from, int to, uint64_t *keys) {
+	// Ask for the keys in chunks, so that the application can fill them in a tight loop.
+
+	for (int i = from; i < to; i += 65536) {
+		UITableGetSortKeys m = { 0 };
+		m.column = table->sortColumn;
+		m.from = i, m.to = to - i > 65536 ? i + 65536 : to;
+		m.keys = keys + i - from;
+		if (!UIElementMessage(&table->e, UI_MSG_TABLE_GET_SORT_KEYS, 0, &m)) return false;
+		if (table->sortDescending) for (int j = 0; j < m.to - m.from; j++) m.keys[j] = ~m.keys[j];
+	}
+
+	return true;
+}
+
+void _UITableModelRebuild(UITable *table) {
+	table->rowCount = 0;
+
+	for (int i = 0; i < table->modelItemCount; i++) {
+		int item = table->order[i];
+
+		if (table->hidden[item]) {
+			table->rowOf[item] = -1;
+		} else {
+			table->rowOf[item] = table->rowCount;
+			table->rows[table->rowCount++] = item;
+		}
+	}
+
+	table->cacheGeneration++;
+	table->heightTreeCount = -1;
+}
+
+void _UITableModelInsert(UITable *table, int from, int to) {
+	// Items [from, to) are new. The items after them are renumbered, and the new ones are filtered and merged into the order.
+
+	int count = table->modelItemCount, added = to - from, total = count + added;
+	bool sorted = table->sortColumn != -1;
+	_UITableModelGrow(table, total);
+
+	for (int i = 0; i < count; i++) {
+		if (table->order[i] >= from) table->order[i] += added;
+	}
+
+	for (int i = count - 1; i >= from; i--) {
+		table->hidden[i + added] = table->hidden[i];
+		if (sorted) table->sortKeys[i + added] = table->sortKeys[i];
+	}
+
+	for (int i = from; i < to; i++) {
+		table->hidden[i] = table->filtered && UIElementMessage(&table->e, UI_MSG_TABLE_FILTER, i, 0);
+	}
+
+	bool keyed = sorted && _UITableGetSortKeys(table, from, to, table->sortKeys + from);
+
+	if (keyed && added <= 16) {
+		// Find the place of each new item with a binary search, after any items with the same key.
+		for (int i = from; i < to; i++) {
+			int low = 0, high = count + i - from;
+
+			while (low < high) {
+				int middle = (low + high) / 2;
+				if (table->sortKeys[table->order[middle]] <= table->sortKeys[i]) low = middle + 1;
+				else high = middle;
 			}
 
-			child = child->next;
+			for (int j = count + i - from; j > low; j--) table->order[j] = table->order[j - 1];
+			table->order[low] = i;
 		}
+	} else if (keyed) {
+		// Sort the new items, and merge them into the existing order.
+		_UITableSortJob job = { 0 };
+		uint64_t *keys = (uint64_t *) UI_MALLOC(sizeof(uint64_t) * (added * 2 + total * 2));
+		int *items = (int *) UI_MALLOC(sizeof(int) * (added * 2 + total));
+		job.count = added;
+		job.keys = keys, job.scratchKeys = keys + added;
+		job.items = items, job.scratchItems = items + added;
+		for (int i = 0; i < added; i++) keys[i] = table->sortKeys[from + i], items[i] = from + i;
+		_UITableSortJobRun(&job);
 
-		if (message == UI_MSG_GET_HEIGHT) {
-			return totalHeight + rowHeight;
-		} else {
-			_UIWrapPanelLayoutRow(panel, rowStart, child, totalHeight, rowHeight);
+		uint64_t *mergeKeys = keys + added * 2;
+		int *mergeItems = items + added * 2;
+
+		for (int i = 0; i < count; i++) {
+			mergeKeys[i] = table->sortKeys[table->order[i]];
+			mergeItems[i] = table->order[i];
+		}
+
+		for (int i = 0; i < added; i++) {
+			mergeKeys[count + i] = keys[i];
+			mergeItems[count + i] = items[i];
 		}
+
+		_UITableSortMerge(mergeKeys, mergeItems, count, total, mergeKeys + total, table->order);
+		UI_FREE(keys);
+		UI_FREE(items);
+	} else if (!sorted) {
+		for (int i = 0; i < total; i++) table->order[i] = i;
+	} else {
+		for (int i = 0; i < added; i++) table->order[count + i] = from + i;
 	}
 
-	return 0;
+	table->modelItemCount = total;
+	_UITableModelRebuild(table);
 }
 
-UIWrapPanel *UIWrapPanelCreate(UIElement *parent, uint32_t flags) {
-	return (UIWrapPanel *) UIElementCreate(sizeof(UIWrapPanel), parent, flags, _UIWrapPanelMessage, "Wrap Panel");
+void _UITableModelRemove(UITable *table, int from, int to) {
+	int removed = to - from, count = 0;
+
+	for (int i = 0; i < table->modelItemCount; i++) {
+		int item = table->order[i];
+		if (item >= to) table->order[count++] = item - removed;
+		else if (item < from) table->order[count++] = item;
+	}
+
+	for (int i = to; i < table->modelItemCount; i++) {
+		table->hidden[i - removed] = table->hidden[i];
+		if (table->sortColumn != -1) table->sortKeys[i - removed] = table->sortKeys[i];
+	}
+
+	table->modelItemCount -= removed;
+	_UITableModelRebuild(table);
 }
 
-void _UIButtonCalculateColors(UIElement *element, uint32_t *color, uint32_t *textColor) {
-	bool disabled = element->flags & UI_ELEMENT_DISABLED;
-	bool focused = element == element->window->focused;
-	bool pressed = element == element->window->pressed;
-	bool hovered = element == element->window->hovered;
-	*color = disabled ? ui.theme.buttonDisabled
-		: (pressed && hovered) ? ui.theme.buttonPressed 
-		: (pressed || hovered) ? ui.theme.buttonHovered 
-		: focused ? ui.theme.selected : ui.theme.buttonNormal;
-	*textColor = disabled ? ui.theme.textDisabled 
-		: *color == ui.theme.selected ? ui.theme.textSelected : ui.theme.text;
+void _UITableModelSync(UITable *table) {
+	// Bring the model up to date with itemCount. Items are assumed to be added and removed at the end,
+	// unless UITableInsertRows and UITableRemoveRows are used.
+
+	if (!table->order || table->itemCount == table->modelItemCount) return;
+
+	if (table->itemCount < table->modelItemCount) {
+		_UITableModelRemove(table, table->itemCount, table->modelItemCount);
+	} else {
+		_UITableModelInsert(table, table->modelItemCount, table->itemCount);
+	}
 }
 
+void _UITableModelCreate(UITable *table) {
+	if (table->order) {
+		_UITableModelSync(table);
+		return;
+	}
 
-int _UIButtonMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UIButton *button = (UIButton *) element;
-	bool isMenuItem = element->flags & UI_BUTTON_MENU_ITEM;
-	bool isDropDown = element->flags & UI_BUTTON_DROP_DOWN;
-	
-	if (message == UI_MSG_GET_HEIGHT) {
-		if (isMenuItem) {
-			return UI_SIZE_MENU_ITEM_HEIGHT * element->window->scale;
-		} else {
-			return UI_SIZE_BUTTON_HEIGHT * element->window->scale;
-		}
-	} else if (message == UI_MSG_GET_WIDTH) {
-		int labelSize = UIMeasureStringWidth(button->label, button->labelBytes);
-		int paddedSize = labelSize + UI_SIZE_BUTTON_PADDING * element->window->scale;
-		if (isDropDown) paddedSize += ui.activeFont->glyphWidth * 2;
-		int minimumSize = ((element->flags & UI_BUTTON_SMALL) ? 0 
-				: isMenuItem ? UI_SIZE_MENU_ITEM_MINIMUM_WIDTH 
-				: UI_SIZE_BUTTON_MINIMUM_WIDTH) 
-			* element->window->scale;
-		return paddedSize > minimumSize ? paddedSize : minimumSize;
-	} else if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
+	table->modelItemCount = table->itemCount;
+	_UITableModelGrow(table, table->itemCount > 16 ? table->itemCount : 16);
 
-		uint32_t color, textColor;
-		_UIButtonCalculateColors(element, &color, &textColor);
+	for (int i = 0; i < table->itemCount; i++) {
+		table->order[i] = i;
+		table->hidden[i] = false;
+	}
 
-		UIDrawRectangle(painter, element->bounds, color, ui.theme.border, UI_RECT_1(isMenuItem ? 0 : 1));
+	_UITableModelRebuild(table);
+}
 
-		if (element->flags & UI_BUTTON_CHECKED) {
-			UIDrawBlock(painter, UIRectangleAdd(element->bounds, 
-				UI_RECT_1I((int) (UI_SIZE_BUTTON_CHECKED_AREA * element->window->scale))), ui.theme.buttonPressed);
+void _UITableSortApply(UITable *table, _UITableSortJob *job) {
+	// Items added while the sort was running are merged in by the sync.
+	for (int i = 0; i < job->count; i++) table->order[i] = job->items[i];
+	table->modelItemCount = job->count;
+	_UITableModelRebuild(table);
+	_UITableModelSync(table);
+	UI_FREE(job->keys);
+	UI_FREE(job->items);
+	job->keys = NULL, job->items = NULL;
+	UIElementRefresh(&table->e);
+	UIElementMessage(&table->e, UI_MSG_TABLE_SORTED, 0, 0);
+}
+
+void _UITableSortMergeBatch(_UIWorkerBatch *header) {
+	_UITableSortBatch *batch = (_UITableSortBatch *) header;
+	_UITableSortJob *job = ui.tableSorts;
+	while (job && job != batch->job) job = job->next;
+
+	if (job && job->generation == batch->generation) {
+#ifdef _UI_THREADS
+		_UIThreadJoin(job->thread);
+#endif
+		job->threadRunning = false;
+		_UITableSortApply(job->table, job);
+	}
+
+	UI_FREE(batch);
+}
+
+void _UITableSortFree(UITable *table) {
+	_UITableSortJob *job = table->sortJob;
+	if (!job) return;
+	_UITableSortStop(job);
+	_UITableSortJob **link = &ui.tableSorts;
+	while (*link != job) link = &(*link)->next;
+	*link = job->next;
+	UI_FREE(job->keys);
+	UI_FREE(job->items);
+	UI_FREE(job);
+	table->sortJob = NULL;
+}
+
+void _UITableSortFinish(UITable *table) {
+	// Item indices are about to change, so wait for a sort in progress rather than applying it to the wrong items later.
+#ifdef _UI_THREADS
+	_UITableSortJob *job = table->sortJob;
+	if (!job || !job->threadRunning) return;
+	_UIThreadJoin(job->thread);
+	job->threadRunning = false;
+	job->generation++; // Drop the batch that the thread posted.
+	_UITableSortApply(table, job);
+#endif
+}
+
+bool UITableSort(UITable *table, int column, bool descending) {
+	if (table->sortJob) {
+		_UITableSortStop(table->sortJob);
+	}
+
+	if (column == -1) {
+		table->sortColumn = -1;
+
+		if (table->order) {
+			for (int i = 0; i < table->modelItemCount; i++) table->order[i] = i;
+			_UITableModelRebuild(table);
+			UIElementRefresh(&table->e);
 		}
 
-		UIRectangle bounds = UIRectangleAdd(element->bounds, UI_RECT_2I((int) (UI_SIZE_MENU_ITEM_MARGIN * element->window->scale), 0));
+		return true;
+	}
 
-		if (isMenuItem) {
-			if (button->labelBytes == -1) {
-				button->labelBytes = _UIStringLength(button->label);
-			}
+	int previousColumn = table->sortColumn;
+	bool previousDescending = table->sortDescending;
+	table->sortColumn = column, table->sortDescending = descending;
+	_UITableModelCreate(table);
 
-			int tab = 0;
-			for (; tab < button->labelBytes && button->label[tab] != '\t'; tab++);
+	if (!_UITableGetSortKeys(table, 0, table->itemCount, table->sortKeys)) {
+		table->sortColumn = previousColumn, table->sortDescending = previousDescending;
+		return false;
+	}
 
-			UIDrawString(painter, bounds, button->label, tab, textColor, UI_ALIGN_LEFT, NULL);
+	if (!table->sortJob) {
+		table->sortJob = (_UITableSortJob *) UI_CALLOC(sizeof(_UITableSortJob));
+		table->sortJob->table = table;
+		table->sortJob->next = ui.tableSorts;
+		ui.tableSorts = table->sortJob;
+	}
 
-			if (button->labelBytes > tab) {
-				UIDrawString(painter, bounds, button->label + tab + 1, button->labelBytes - tab - 1, textColor, UI_ALIGN_RIGHT, NULL);
-			}
-		} else if (isDropDown) {
-			UIDrawString(painter, bounds, button->label, button->labelBytes, textColor, UI_ALIGN_LEFT, NULL);
-			UIDrawString(painter, bounds, "\x19", 1, textColor, UI_ALIGN_RIGHT, NULL);
-		} else {
-			UIDrawString(painter, element->bounds, button->label, button->labelBytes, textColor, UI_ALIGN_CENTER, NULL);
+	// The job sorts its own copy of the keys, so the table keeps showing the previous order until it is done.
+
+	_UITableSortJob *job = table->sortJob;
+	int count = table->itemCount;
+	UI_FREE(job->keys);
+	UI_FREE(job->items);
+	job->count = count;
+	job->keys = (uint64_t *) UI_MALLOC(sizeof(uint64_t) * (count * 2 + 1));
+	job->items = (int *) UI_MALLOC(sizeof(int) * (count * 2 + 1));
+	job->scratchKeys = job->keys + count, job->scratchItems = job->items + count;
+	for (int i = 0; i < count; i++) job->keys[i] = table->sortKeys[i], job->items[i] = i;
+
+#ifdef _UI_THREADS
+	if (count >= _UI_TABLE_SORT_THREADED_ITEMS) {
+		job->threadRunning = true;
+		job->thread = _UIThreadCreate(_UITableSortWork, job);
+		return true;
+	}
+#endif
+
+	_UITableSortJobRun(job);
+	_UITableSortApply(table, job);
+	return true;
+}
+
+void UITableFilter(UITable *table, bool narrowing) {
+	_UITableModelCreate(table);
+	table->filtered = true;
+
+	if (narrowing) {
+		for (int i = 0; i < table->rowCount; i++) {
+			int item = table->rows[i];
+			table->hidden[item] = UIElementMessage(&table->e, UI_MSG_TABLE_FILTER, item, 0);
 		}
-	} else if (message == UI_MSG_UPDATE) {
-		UIElementRepaint(element, NULL);
-	} else if (message == UI_MSG_DESTROY) {
-		UI_FREE(button->label);
-	} else if (message == UI_MSG_LEFT_DOWN) {
-		if (element->flags & UI_BUTTON_CAN_FOCUS) {
-			UIElementFocus(element);
+	} else {
+		for (int i = 0; i < table->modelItemCount; i++) {
+			table->hidden[i] = UIElementMessage(&table->e, UI_MSG_TABLE_FILTER, i, 0);
 		}
-	} else if (message == UI_MSG_KEY_TYPED) {
-		UIKeyTyped *m = (UIKeyTyped *) dp;
-		
-		if (m->textBytes == 1 && m->text[0] == ' ') {
-			UIElementMessage(element, UI_MSG_CLICKED, 0, 0);
-			UIElementRepaint(element, NULL);
+	}
+
+	_UITableModelRebuild(table);
+	UIElementRefresh(&table->e);
+}
+
+int _UITableRowCount(UITable *table) {
+	return table->order ? table->rowCount : table->itemCount;
+}
+
+int _UITableItemHeight(UITable *table, int item) {
+	int height = item < table->itemHeightsCount ? table->itemHeights[item] : 0;
+	return height ? height : UI_SIZE_TABLE_ROW;
+}
+
+void _UITableHeightsSync(UITable *table) {
+	// The Fenwick tree is over rows, in display order, of unscaled heights.
+	// It is rebuilt when the model reorders the rows, and extended in O(log n) per row when rows are appended.
+
+	int count = _UITableRowCount(table);
+	if (!table->itemHeights || table->heightTreeCount == count) return;
+
+	if (count + 1 > table->heightTreeAllocated) {
+		table->heightTreeAllocated = (count + 1) * 2;
+		table->heightTree = (int64_t *) UI_REALLOC(table->heightTree, table->heightTreeAllocated * sizeof(int64_t));
+	}
+
+	if (table->heightTreeCount == -1 || table->heightTreeCount > count) {
+		for (int j = 1; j <= count; j++) {
+			table->heightTree[j] = _UITableItemHeight(table, table->order ? table->rows[j - 1] : j - 1);
 		}
-	} else if (message == UI_MSG_CLICKED) {
-		if (button->invoke) {
-			button->invoke(element->cp);
+
+		for (int j = 1; j <= count; j++) {
+			int parent = j + (j & -j);
+			if (parent <= count) table->heightTree[parent] += table->heightTree[j];
+		}
+	} else {
+		for (int j = table->heightTreeCount + 1; j <= count; j++) {
+			int64_t sum = _UITableItemHeight(table, table->order ? table->rows[j - 1] : j - 1);
+			for (int k = j - 1; k > j - (j & -j); k -= k & -k) sum += table->heightTree[k];
+			table->heightTree[j] = sum;
 		}
 	}
 
-	return 0;
+	table->heightTreeCount = count;
+}
+
+int64_t _UITableRowTop(UITable *table, int row) {
+	if (!table->itemHeights) return (int64_t) row * (int) (UI_SIZE_TABLE_ROW * table->e.window->scale);
+	_UITableHeightsSync(table);
+	int64_t sum = 0;
+	for (int j = row; j > 0; j -= j & -j) sum += table->heightTree[j];
+	return sum * table->e.window->scale;
 }
 
-UIButton *UIButtonCreate(UIElement *parent, uint32_t flags, const char *label, ptrdiff_t labelBytes) {
-	UIButton *button = (UIButton *) UIElementCreate(sizeof(UIButton), parent, flags | UI_ELEMENT_TAB_STOP, _UIButtonMessage, "Button");
-	button->label = UIStringCopy(label, (button->labelBytes = labelBytes));
-	return button;
+int _UITableRowHeight(UITable *table, int row) {
+	if (!table->itemHeights) return UI_SIZE_TABLE_ROW * table->e.window->scale;
+	return _UITableRowTop(table, row + 1) - _UITableRowTop(table, row);
 }
 
-int _UICheckboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UICheckbox *box = (UICheckbox *) element;
-	
-	if (message == UI_MSG_GET_HEIGHT) {
-		return UI_SIZE_BUTTON_HEIGHT * element->window->scale;
-	} else if (message == UI_MSG_GET_WIDTH) {
-		int labelSize = UIMeasureStringWidth(box->label, box->labelBytes);
-		return (labelSize + UI_SIZE_CHECKBOX_BOX + UI_SIZE_CHECKBOX_GAP) * element->window->scale;
-	} else if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
-		uint32_t color, textColor;
-		_UIButtonCalculateColors(element, &color, &textColor);
-		int midY = (element->bounds.t + element->bounds.b) / 2;
-		UIRectangle boxBounds = UI_RECT_4(element->bounds.l, element->bounds.l + UI_SIZE_CHECKBOX_BOX, 
-				midY - UI_SIZE_CHECKBOX_BOX / 2, midY + UI_SIZE_CHECKBOX_BOX / 2);
-		UIDrawRectangle(painter, boxBounds, color, ui.theme.border, UI_RECT_1(1));
-		UIDrawString(painter, UIRectangleAdd(boxBounds, UI_RECT_4(1, 0, 0, 0)), 
-				box->check == UI_CHECK_CHECKED ? "*" : box->check == UI_CHECK_INDETERMINATE ? "-" : " ", -1, 
-				textColor, UI_ALIGN_CENTER, NULL);
-		UIDrawString(painter, UIRectangleAdd(element->bounds, UI_RECT_4(UI_SIZE_CHECKBOX_BOX + UI_SIZE_CHECKBOX_GAP, 0, 0, 0)), 
-				box->label, box->labelBytes, textColor, UI_ALIGN_LEFT, NULL);
-	} else if (message == UI_MSG_UPDATE) {
-		UIElementRepaint(element, NULL);
-	} else if (message == UI_MSG_DESTROY) {
-		UI_FREE(box->label);
-	} else if (message == UI_MSG_KEY_TYPED) {
-		UIKeyTyped *m = (UIKeyTyped *) dp;
-		
-		if (m->textBytes == 1 && m->text[0] == ' ') {
-			UIElementMessage(element, UI_MSG_CLICKED, 0, 0);
-			UIElementRepaint(element, NULL);
+int _UITableRowAtOffset(UITable *table, int64_t offset) {
+	// Returns the row containing offset, or the row count if it is past the end.
+	int count = _UITableRowCount(table);
+	if (offset < 0) return 0;
+
+	if (!table->itemHeights) {
+		int64_t row = offset / (int) (UI_SIZE_TABLE_ROW * table->e.window->scale);
+		return row > count ? count : row;
+	}
+
+	_UITableHeightsSync(table);
+	int position = 0, step = 1;
+	int64_t sum = 0;
+	while (step * 2 <= count) step *= 2;
+
+	for (; step; step >>= 1) {
+		if (position + step <= count && (int64_t) ((sum + table->heightTree[position + step]) * table->e.window->scale) <= offset) {
+			position += step;
+			sum += table->heightTree[position];
 		}
-	} else if (message == UI_MSG_CLICKED) {
-		box->check = (box->check + 1) % ((element->flags & UI_CHECKBOX_ALLOW_INDETERMINATE) ? 3 : 2);
-		UIElementRepaint(element, NULL);
-		if (box->invoke) box->invoke(element->cp);
 	}
 
-	return 0;
+	return position;
 }
 
-UICheckbox *UICheckboxCreate(UIElement *parent, uint32_t flags, const char *label, ptrdiff_t labelBytes) {
-	UICheckbox *box = (UICheckbox *) UIElementCreate(sizeof(UICheckbox), parent, flags | UI_ELEMENT_TAB_STOP, _UICheckboxMessage, "Checkbox");
-	box->label = UIStringCopy(label, (box->labelBytes = labelBytes));
-	return box;
+void UITableSetRowHeight(UITable *table, int index, int height) {
+	if (index < 0 || index >= table->itemCount) return;
+
+	if (index >= table->itemHeightsCount) {
+		int count = table->itemCount > index * 2 ? table->itemCount : index * 2 + 1;
+		table->itemHeights = (int *) UI_REALLOC(table->itemHeights, count * sizeof(int));
+		for (int i = table->itemHeightsCount; i < count; i++) table->itemHeights[i] = 0;
+		table->itemHeightsCount = count;
+	}
+
+	int delta = (height ? height : UI_SIZE_TABLE_ROW) - _UITableItemHeight(table, index);
+	table->itemHeights[index] = height;
+	int row = table->order ? table->rowOf[index] : index;
+
+	if (table->heightTreeCount != -1 && row != -1 && row < table->heightTreeCount) {
+		for (int j = row + 1; j <= table->heightTreeCount; j += j & -j) table->heightTree[j] += delta;
+	}
+
+	// The scroll bar is only updated by the next layout, so that setting many heights doesn't lay the table out each time.
+	UIElementRepaint(&table->e, NULL);
 }
 
-int _UILabelMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UILabel *label = (UILabel *) element;
-	
-	if (message == UI_MSG_GET_HEIGHT) {
-		return UIMeasureStringHeight();
-	} else if (message == UI_MSG_GET_WIDTH) {
-		return UIMeasureStringWidth(label->label, label->labelBytes);
-	} else if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
-		UIDrawString(painter, element->bounds, label->label, label->labelBytes, ui.theme.text, UI_ALIGN_LEFT, NULL);
-	} else if (message == UI_MSG_DESTROY) {
-		UI_FREE(label->label);
+int _UITableSelectionFind(UITable *table, int index) {
+	// Returns the first range that ends after index.
+	int low = 0, high = table->selectionCount;
+
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (table->selection[middle].to <= index) low = middle + 1;
+		else high = middle;
 	}
 
-	return 0;
+	return low;
 }
 
-void UILabelSetContent(UILabel *label, const char *string, ptrdiff_t stringBytes) {
-	UI_FREE(label->label);
-	label->label = UIStringCopy(string, (label->labelBytes = stringBytes));
+bool UITableIsSelected(UITable *table, int index) {
+	int i = _UITableSelectionFind(table, index);
+	return i < table->selectionCount && table->selection[i].from <= index;
 }
 
-UILabel *UILabelCreate(UIElement *parent, uint32_t flags, const char *string, ptrdiff_t stringBytes) {
-	UILabel *label = (UILabel *) UIElementCreate(sizeof(UILabel), parent, flags, _UILabelMessage, "Label");
-	label->label = UIStringCopy(string, (label->labelBytes = stringBytes));
-	return label;
+void _UITableSelectionReserve(UITable *table, int count) {
+	if (count <= table->selectionAllocated) return;
+	table->selectionAllocated = count > table->selectionAllocated * 2 ? count : table->selectionAllocated * 2;
+	table->selection = (UITableRange *) UI_REALLOC(table->selection, table->selectionAllocated * sizeof(UITableRange));
 }
 
-int _UISplitPaneMessage(UIElement *element, UIMessage message, int di, void *dp);
+void _UITableSelectionSet(UITable *table, int from, int to, bool selected) {
+	if (from >= to) return;
 
-int _UISplitterMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UISplitPane *splitPane = (UISplitPane *) element->parent;
-	bool vertical = splitPane->e.flags & UI_SPLIT_PANE_VERTICAL;
+	// Ranges [first, last) overlap or touch [from, to).
+	int first = _UITableSelectionFind(table, from - 1);
+	int last = first, high = table->selectionCount;
 
-	if (message == UI_MSG_PAINT) {
-		UIRectangle borders = vertical ? UI_RECT_2(0, 1) : UI_RECT_2(1, 0);
-		UIDrawRectangle((UIPainter *) dp, element->bounds, ui.theme.buttonNormal, ui.theme.border, borders);
-	} else if (message == UI_MSG_GET_CURSOR) {
-		return vertical ? UI_CURSOR_SPLIT_V : UI_CURSOR_SPLIT_H;
-	} else if (message == UI_MSG_MOUSE_DRAG) {
-		int cursor = vertical ? element->window->cursorY : element->window->cursorX;
-		int splitterSize = UI_SIZE_SPLITTER * element->window->scale;
-		int space = (vertical ? UI_RECT_HEIGHT(splitPane->e.bounds) : UI_RECT_WIDTH(splitPane->e.bounds)) - splitterSize;
-		float oldWeight = splitPane->weight;
-		splitPane->weight = (float) (cursor - splitterSize / 2 - (vertical ? splitPane->e.bounds.t : splitPane->e.bounds.l)) / space;
-		if (splitPane->weight < 0.05f) splitPane->weight = 0.05f;
-		if (splitPane->weight > 0.95f) splitPane->weight = 0.95f;
+	while (last < high) {
+		int middle = (last + high) / 2;
+		if (table->selection[middle].from <= to) last = middle + 1;
+		else high = middle;
+	}
 
-		if (element->next->next->messageClass == _UISplitPaneMessage 
-				&& (element->next->next->flags & UI_SPLIT_PANE_VERTICAL) == (splitPane->e.flags & UI_SPLIT_PANE_VERTICAL)) {
-			UISplitPane *subSplitPane = (UISplitPane *) element->next->next;
-			subSplitPane->weight = (splitPane->weight - oldWeight - subSplitPane->weight + oldWeight * subSplitPane->weight) / (-1 + splitPane->weight);
-			if (subSplitPane->weight < 0.05f) subSplitPane->weight = 0.05f;
-			if (subSplitPane->weight > 0.95f) subSplitPane->weight = 0.95f;
+	UITableRange replacement[2];
+	int replacementCount = 0;
+
+	if (selected) {
+		UITableRange range = { from, to };
+		if (first < last && table->selection[first].from < from) range.from = table->selection[first].from;
+		if (first < last && table->selection[last - 1].to > to) range.to = table->selection[last - 1].to;
+		replacement[replacementCount++] = range;
+	} else {
+		if (first < last && table->selection[first].from < from) {
+			UITableRange range = { table->selection[first].from, from };
+			replacement[replacementCount++] = range;
 		}
 
-		UIElementRefresh(&splitPane->e);
+		if (first < last && table->selection[last - 1].to > to) {
+			UITableRange range = { to, table->selection[last - 1].to };
+			replacement[replacementCount++] = range;
+		}
 	}
 
-	return 0;
+	if (first == 0 && last == table->selectionCount) {
+		// Covers everything, as with select all or clear; no need to move anything.
+		_UITableSelectionReserve(table, replacementCount);
+	} else {
+		int delta = replacementCount - (last - first);
+		_UITableSelectionReserve(table, table->selectionCount + delta);
+
+		if (delta > 0) {
+			for (int i = table->selectionCount - 1; i >= last; i--) table->selection[i + delta] = table->selection[i];
+		} else if (delta < 0) {
+			for (int i = last; i < table->selectionCount; i++) table->selection[i + delta] = table->selection[i];
+		}
+	}
+
+	table->selectionCount += replacementCount - (last - first);
+	for (int i = 0; i < replacementCount; i++) table->selection[first + i] = replacement[i];
 }
 
-int _UISplitPaneMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UISplitPane *splitPane = (UISplitPane *) element;
-	bool vertical = splitPane->e.flags & UI_SPLIT_PANE_VERTICAL;
+void UITableSelect(UITable *table, int from, int to, bool selected) {
+	_UITableSelectionSet(table, from, to, selected);
+	UIElementRepaint(&table->e, NULL);
+}
 
-	if (message == UI_MSG_LAYOUT) {
-		UIElement *splitter = element->children;
-		UI_ASSERT(splitter);
-		UIElement *left = splitter->next;
-		UI_ASSERT(left);
-		UIElement *right = left->next;
-		UI_ASSERT(right);
-		UI_ASSERT(!right->next);
+void _UITableSelectionShift(UITable *table, int index, int delta) {
+	// Items from index on move by delta. For a removal, the items [index, index - delta) are dropped first.
+	if (delta < 0) _UITableSelectionSet(table, index, index - delta, false);
+	int first = _UITableSelectionFind(table, index);
 
-		int splitterSize = UI_SIZE_SPLITTER * element->window->scale;
-		int space = (vertical ? UI_RECT_HEIGHT(element->bounds) : UI_RECT_WIDTH(element->bounds)) - splitterSize;
-		int leftSize = space * splitPane->weight;
-		int rightSize = space - leftSize;
+	for (int i = first; i < table->selectionCount; i++) {
+		if (table->selection[i].from >= index) table->selection[i].from += delta;
+		table->selection[i].to += delta;
+	}
 
-		if (vertical) {
-			UIElementMove(left, UI_RECT_4(element->bounds.l, element->bounds.r, element->bounds.t, element->bounds.t + leftSize), false);
-			UIElementMove(splitter, UI_RECT_4(element->bounds.l, element->bounds.r, element->bounds.t + leftSize, element->bounds.t + leftSize + splitterSize), false);
-			UIElementMove(right, UI_RECT_4(element->bounds.l, element->bounds.r, element->bounds.b - rightSize, element->bounds.b), false);
+	if (delta > 0) {
+		// A range that spanned index is split around the new items.
+		_UITableSelectionSet(table, index, index + delta, false);
+	} else if (first > 0 && first < table->selectionCount && table->selection[first - 1].to == table->selection[first].from) {
+		// The ranges either side of the removed items now touch.
+		table->selection[first - 1].to = table->selection[first].to;
+		for (int i = first + 1; i < table->selectionCount; i++) table->selection[i - 1] = table->selection[i];
+		table->selectionCount--;
+	}
+}
+
+void _UITableSelectRows(UITable *table, int fromRow, int toRow) {
+	// Select the items shown in the rows [fromRow, toRow], and nothing else.
+	UITableSelect(table, 0, 0x7FFFFFFF, false);
+
+	if (!table->order) {
+		UITableSelect(table, fromRow, toRow + 1, true);
+		return;
+	}
+
+	// The items are not contiguous when sorted, so sort them and build the ranges directly.
+	int count = toRow - fromRow + 1;
+	_UITableSortJob job = { 0 };
+	job.count = count;
+	job.keys = (uint64_t *) UI_MALLOC(sizeof(uint64_t) * count * 2);
+	job.items = (int *) UI_MALLOC(sizeof(int) * count * 2);
+	job.scratchKeys = job.keys + count, job.scratchItems = job.items + count;
+	for (int i = 0; i < count; i++) job.keys[i] = table->rows[fromRow + i], job.items[i] = table->rows[fromRow + i];
+	_UITableSortJobRun(&job);
+	table->selectionCount = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (table->selectionCount && table->selection[table->selectionCount - 1].to == job.items[i]) {
+			table->selection[table->selectionCount - 1].to++;
 		} else {
-			UIElementMove(left, UI_RECT_4(element->bounds.l, element->bounds.l + leftSize, element->bounds.t, element->bounds.b), false);
-			UIElementMove(splitter, UI_RECT_4(element->bounds.l + leftSize, element->bounds.l + leftSize + splitterSize, element->bounds.t, element->bounds.b), false);
-			UIElementMove(right, UI_RECT_4(element->bounds.r - rightSize, element->bounds.r, element->bounds.t, element->bounds.b), false);
+			_UITableSelectionReserve(table, table->selectionCount + 1);
+			UITableRange range = { job.items[i], job.items[i] + 1 };
+			table->selection[table->selectionCount++] = range;
 		}
 	}
 
-	return 0;
+	UI_FREE(job.keys);
+	UI_FREE(job.items);
 }
 
-UISplitPane *UISplitPaneCreate(UIElement *parent, uint32_t flags, float weight) {
-	UISplitPane *splitPane = (UISplitPane *) UIElementCreate(sizeof(UISplitPane), parent, flags, _UISplitPaneMessage, "Split Pane");
-	splitPane->weight = weight;
-	UIElementCreate(sizeof(UIElement), &splitPane->e, 0, _UISplitterMessage, "Splitter");
-	return splitPane;
+int _UITableHScrollHeight(UITable *table) {
+	return (table->hScroll->e.flags & UI_ELEMENT_HIDE) ? 0 : UI_SIZE_SCROLL_BAR * table->e.window->scale;
 }
 
-int _UITabPaneMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UITabPane *tabPane = (UITabPane *) element;
-	
-	if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
-		UIRectangle top = element->bounds;
-		top.b = top.t + UI_SIZE_BUTTON_HEIGHT * element->window->scale;
-		UIDrawRectangle(painter, top, ui.theme.panel1, ui.theme.border, UI_RECT_4(0, 0, 0, 1));
+void _UITableColumnsChanged(UITable *table) {
+	table->columnOffsets = (int64_t *) UI_REALLOC(table->columnOffsets, (table->columnCount + 1) * sizeof(int64_t));
+	int gap = UI_SIZE_TABLE_COLUMN_GAP * table->e.window->scale;
+	table->columnOffsets[0] = gap;
 
-		UIRectangle tab = top;
-		tab.l += UI_SIZE_TAB_PANE_SPACE_LEFT * element->window->scale;
-		tab.t += UI_SIZE_TAB_PANE_SPACE_TOP * element->window->scale;
+	for (int i = 0; i < table->columnCount; i++) {
+		table->columnOffsets[i + 1] = table->columnOffsets[i] + table->columnWidths[i] + gap;
+	}
+}
 
-		int position = 0;
-		int index = 0;
+int _UITableColumnAtOffset(UITable *table, int64_t x) {
+	// Returns the last column starting at or before x, or -1 if x is before the first column.
+	int low = 0, high = table->columnCount;
 
-		while (true) {
-			int end = position;
-			for (; tabPane->tabs[end] != '\t' && tabPane->tabs[end]; end++);
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (table->columnOffsets[middle] <= x) low = middle + 1;
+		else high = middle;
+	}
 
-			int width = UIMeasureStringWidth(tabPane->tabs, end - position);
-			tab.r = tab.l + width + UI_SIZE_BUTTON_PADDING;
+	return low - 1;
+}
 
-			uint32_t color = tabPane->active == index ? ui.theme.buttonPressed : ui.theme.buttonNormal;
+int _UITableHitTestRow(UITable *table, int x, int y) {
+	x -= table->e.bounds.l;
 
-			UIRectangle t = tab;
+	if (x < 0 || x >= UI_RECT_WIDTH(table->e.bounds) - UI_SIZE_SCROLL_BAR * table->e.window->scale) {
+		return -1;
+	}
 
-			if (tabPane->active == index) {
-				t.b++;
-				t.t--;
-			} else {
-				t.t++;
-			}
+	if (y >= table->e.bounds.b - _UITableHScrollHeight(table)) {
+		return -1;
+	}
 
-			UIDrawRectangle(painter, t, color, ui.theme.border, UI_RECT_1(1));
-			UIDrawString(painter, tab, tabPane->tabs + position, end - position, ui.theme.text, UI_ALIGN_CENTER, NULL);
-			tab.l = tab.r - 1;
+	y -= (table->e.bounds.t + UI_SIZE_TABLE_HEADER * table->e.window->scale) - table->vScroll->position;
 
-			if (tabPane->tabs[end] == '\t') {
-				position = end + 1;
-				index++;
-			} else {
-				break;
-			}
-		}
-	} else if (message == UI_MSG_LEFT_DOWN) {
-		UIRectangle tab = element->bounds;
-		tab.b = tab.t + UI_SIZE_BUTTON_HEIGHT * element->window->scale;
-		tab.l += UI_SIZE_TAB_PANE_SPACE_LEFT * element->window->scale;
-		tab.t += UI_SIZE_TAB_PANE_SPACE_TOP * element->window->scale;
+	int row = _UITableRowAtOffset(table, y);
 
-		int position = 0;
-		int index = 0;
+	if (y < 0 || row >= _UITableRowCount(table)) {
+		return -1;
+	}
 
-		while (true) {
-			int end = position;
-			for (; tabPane->tabs[end] != '\t' && tabPane->tabs[end]; end++);
+	return row;
+}
 
-			int width = UIMeasureStringWidth(tabPane->tabs, end - position);
-			tab.r = tab.l + width + UI_SIZE_BUTTON_PADDING;
+int UITableHitTest(UITable *table, int x, int y) {
+	int row = _UITableHitTestRow(table, x, y);
+	return row == -1 || !table->order ? row : table->rows[row];
+}
 
-			if (UIRectangleContains(tab, element->window->cursorX, element->window->cursorY)) {
-				tabPane->active = index;
-				UIElementMessage(element, UI_MSG_LAYOUT, 0, 0);
-				UIElementRepaint(element, NULL);
-				break;
-			}
+int UITableHeaderHitTest(UITable *table, int x, int y) {
+	if (!table->columnCount) return -1;
+	UIRectangle header = table->e.bounds;
+	header.b = header.t + UI_SIZE_TABLE_HEADER * table->e.window->scale;
+	header.r -= UI_SIZE_SCROLL_BAR * table->e.window->scale;
+	if (!UIRectangleContains(header, x, y)) return -1;
+	int64_t offset = x - header.l + (int64_t) table->hScroll->position;
+	int index = _UITableColumnAtOffset(table, offset);
+	if (index == -1 || offset >= table->columnOffsets[index] + table->columnWidths[index]) return -1;
+	return index;
+}
+
+bool UITableEnsureVisible(UITable *table, int index) {
+	if (table->order) {
+		if (index < 0 || index >= table->modelItemCount || table->rowOf[index] == -1) return false;
+		index = table->rowOf[index];
+	}
+
+	int rowHeight = _UITableRowHeight(table, index);
+	int64_t y = _UITableRowTop(table, index);
+	y -= table->vScroll->position;
+	int height = UI_RECT_HEIGHT(table->e.bounds) - UI_SIZE_TABLE_HEADER * table->e.window->scale - _UITableHScrollHeight(table) - rowHeight;
+
+	if (y < 0) {
+		table->vScroll->position += y;
+		UIElementRefresh(&table->e);
+		return true;
+	} else if (y > height) {
+		table->vScroll->position -= height - y;
+		UIElementRefresh(&table->e);
+		return true;
+	} else {
+		return false;
+	}
+}
+
+#define _UI_TABLE_SIZE_ALL_ROWS (1024)
+#define _UI_TABLE_SIZE_SAMPLES (256)
+#define _UI_TABLE_SIZE_BUDGET_MS (4)
+
+void _UITableFetch(UITable *table, int from, int to, int columnFrom, int columnTo) {
+	// Get the cells of rows [from, to) and columns [columnFrom, columnTo) into the fetch arrays,
+	// with one UI_MSG_TABLE_GET_RANGE if the application handles it.
+
+	int rows = to - from, columns = columnTo - columnFrom, cells = rows * columns;
+
+	if (cells > table->fetchCellsAllocated) {
+		table->fetchCellsAllocated = cells * 2;
+		table->fetchStrings = (const char **) UI_REALLOC(table->fetchStrings, table->fetchCellsAllocated * sizeof(const char *));
+		table->fetchBytes = (ptrdiff_t *) UI_REALLOC(table->fetchBytes, table->fetchCellsAllocated * sizeof(ptrdiff_t));
+	}
+
+	if (rows > table->fetchRowsAllocated) {
+		table->fetchRowsAllocated = rows * 2;
+		table->fetchSelected = (bool *) UI_REALLOC(table->fetchSelected, table->fetchRowsAllocated * sizeof(bool));
+	}
+
+	for (int i = 0; i < rows; i++) table->fetchSelected[i] = false;
+	if (!cells) return;
+
+	UITableGetRange range = { 0 };
+	range.from = from, range.to = to;
+	range.items = table->order ? table->rows + from : NULL;
+	range.columnFrom = columnFrom, range.columnTo = columnTo;
+	range.strings = table->fetchStrings;
+	range.bytes = table->fetchBytes;
+	range.isSelected = table->fetchSelected;
+
+	for (int attempt = 0; attempt < 2; attempt++) {
+		// The arena only grows when the application asks for more.
+		range.arena = table->fetchArena;
+		range.arenaBytes = table->fetchArenaBytes;
+		int result = UIElementMessage(&table->e, UI_MSG_TABLE_GET_RANGE, 0, &range);
+
+		if (result > 0) {
+			return;
+		} else if (result == 0) {
+			break;
+		} else if ((size_t) -result > table->fetchArenaBytes) {
+			table->fetchArenaBytes = -result;
+			UI_FREE(table->fetchArena);
+			table->fetchArena = (char *) UI_MALLOC(table->fetchArenaBytes);
+		}
+	}
+
+	// Fall back to one UI_MSG_TABLE_GET_ITEM per cell. The text of each cell is packed into the arena after the previous one,
+	// and the strings are pointed into it at the end, since the arena moves when it grows.
 
-			tab.l = tab.r - 1;
+	UITableGetItem m = { 0 };
+	size_t longBytes = 0, used = 0;
 
-			if (tabPane->tabs[end] == '\t') {
-				position = end + 1;
-				index++;
-			} else {
-				break;
+	for (int i = 0, k = 0; i < rows; i++) {
+		m.index = table->order ? table->rows[from + i] : from + i;
+		m.isSelected = false;
+
+		for (int j = columnFrom; j < columnTo; j++, k++) {
+			if (table->fetchArenaBytes < used + 256) {
+				table->fetchArenaBytes = (used + 256) * 2;
+				table->fetchArena = (char *) UI_REALLOC(table->fetchArena, table->fetchArenaBytes);
+			}
+
+			m.buffer = table->fetchArena + used;
+			m.bufferBytes = 256;
+			m.column = j;
+			m.string = NULL;
+			int bytes = UIElementMessage(&table->e, UI_MSG_TABLE_GET_ITEM, 0, &m);
+			table->fetchStrings[k] = m.string;
+			table->fetchBytes[k] = bytes;
+
+			if (!m.string && bytes >= 256) {
+				// The text didn't fit; get it again once we know how much space all such cells need.
+				longBytes += bytes + 1;
+			} else if (!m.string && bytes > 0) {
+				used += bytes;
 			}
 		}
-	} else if (message == UI_MSG_LAYOUT) {
-		UIElement *child = element->children;
-		int index = 0;
 
-		UIRectangle content = element->bounds;
-		content.t += UI_SIZE_BUTTON_HEIGHT * element->window->scale;
+		table->fetchSelected[i] = m.isSelected;
+	}
 
-		while (child) {
-			if (tabPane->active == index) {
-				child->flags &= ~UI_ELEMENT_HIDE;
-				UIElementMove(child, content, false);
-				UIElementMessage(child, UI_MSG_TAB_SELECTED, 0, 0);
-			} else {
-				child->flags |= UI_ELEMENT_HIDE;
-			}
+	used = 0;
 
-			child = child->next;
-			index++;
-		}
-	} else if (message == UI_MSG_GET_HEIGHT) {
-		UIElement *child = element->children;
-		int index = 0;
-		int baseHeight = UI_SIZE_BUTTON_HEIGHT * element->window->scale;
+	for (int k = 0; k < cells; k++) {
+		if (table->fetchStrings[k] || table->fetchBytes[k] >= 256) continue;
+		table->fetchStrings[k] = table->fetchArena + used;
+		if (table->fetchBytes[k] > 0) used += table->fetchBytes[k];
+	}
 
-		while (child) {
-			if (tabPane->active == index) {
-				return baseHeight + UIElementMessage(child, UI_MSG_GET_HEIGHT, di, dp);
-			}
+	if (!longBytes) return;
 
-			child = child->next;
-			index++;
-		}
-	} else if (message == UI_MSG_DESTROY) {
-		UI_FREE(tabPane->tabs);
+	if (longBytes > table->fetchLongBytes) {
+		table->fetchLongBytes = longBytes * 2;
+		UI_FREE(table->fetchLong);
+		table->fetchLong = (char *) UI_MALLOC(table->fetchLongBytes);
 	}
 
-	return 0;
+	for (int k = 0, position = 0; k < cells; k++) {
+		if (table->fetchStrings[k]) continue;
+		int row = from + k / columns;
+		m.index = table->order ? table->rows[row] : row;
+		m.column = columnFrom + k % columns;
+		m.buffer = table->fetchLong + position;
+		m.bufferBytes = table->fetchBytes[k] + 1;
+		m.string = NULL;
+		int bytes = UIElementMessage(&table->e, UI_MSG_TABLE_GET_ITEM, 0, &m);
+		if ((size_t) bytes > m.bufferBytes && bytes > 0) bytes = m.bufferBytes;
+		table->fetchStrings[k] = m.string ? m.string : m.buffer;
+		table->fetchBytes[k] = bytes;
+		position += m.bufferBytes;
+	}
 }
 
-UITabPane *UITabPaneCreate(UIElement *parent, uint32_t flags, const char *tabs) {
-	UITabPane *tabPane = (UITabPane *) UIElementCreate(sizeof(UITabPane), parent, flags, _UITabPaneMessage, "Tab Pane");
-	tabPane->tabs = UIStringCopy(tabs, -1);
-	return tabPane;
-}
+bool _UITableMeasureRows(UITable *table, int from, int to) {
+	if (to > _UITableRowCount(table)) to = _UITableRowCount(table);
+	if (from >= to) return false;
+	_UITableFetch(table, from, to, 0, table->columnCount);
+	bool changed = false;
 
-int _UISpacerMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UISpacer *spacer = (UISpacer *) element;
-	
-	if (message == UI_MSG_GET_HEIGHT) {
-		return spacer->height * element->window->scale;
-	} else if (message == UI_MSG_GET_WIDTH) {
-		return spacer->width * element->window->scale;
-	} else if (message == UI_MSG_PAINT && (element->flags & UI_SPACER_LINE)) {
-		UIDrawBlock((UIPainter *) dp, element->bounds, ui.theme.border);
+	for (int i = 0, k = 0; i < to - from; i++) {
+		for (int j = 0; j < table->columnCount; j++, k++) {
+			int width = UIMeasureStringWidth(table->fetchStrings[k], table->fetchBytes[k]);
+
+			if (width > table->columnWidths[j]) {
+				table->columnWidths[j] = width;
+				changed = true;
+			}
+		}
 	}
 
-	return 0;
+	return changed;
 }
 
-UISpacer *UISpacerCreate(UIElement *parent, uint32_t flags, int width, int height) {
-	UISpacer *spacer = (UISpacer *) UIElementCreate(sizeof(UISpacer), parent, flags, _UISpacerMessage, "Spacer");
-	spacer->width = width;
-	spacer->height = height;
-	return spacer;
-}
+void _UITableCacheRows(UITable *table, int from, int to) {
+	// Rows are direct-mapped by index; there are at least twice as many slots as rows on screen, so they don't collide.
 
-int _UIScrollBarMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UIScrollBar *scrollBar = (UIScrollBar *) element;
+	if (table->cacheCount < (to - from) * 2) {
+		int count = 16;
+		while (count < (to - from) * 2) count *= 2;
 
-	if (message == UI_MSG_GET_WIDTH || message == UI_MSG_GET_HEIGHT) {
-		return UI_SIZE_SCROLL_BAR * element->window->scale;
-	} else if (message == UI_MSG_LAYOUT) {
-		UIElement *up = element->children;
-		UIElement *thumb = up->next;
-		UIElement *down = thumb->next;
+		for (int i = 0; i < table->cacheCount; i++) {
+			UI_FREE(table->cache[i].bytes);
+			UI_FREE(table->cache[i].text);
+		}
 
-		if (scrollBar->page >= scrollBar->maximum || scrollBar->maximum <= 0 || scrollBar->page <= 0) {
-			up->flags |= UI_ELEMENT_HIDE;
-			thumb->flags |= UI_ELEMENT_HIDE;
-			down->flags |= UI_ELEMENT_HIDE;
+		UI_FREE(table->cache);
+		table->cache = (UITableCachedRow *) UI_CALLOC(count * sizeof(UITableCachedRow));
+		table->cacheCount = count;
+	}
 
-			scrollBar->position = 0;
-		} else {
-			up->flags &= ~UI_ELEMENT_HIDE;
-			thumb->flags &= ~UI_ELEMENT_HIDE;
-			down->flags &= ~UI_ELEMENT_HIDE;
+	for (int i = from; i < to; ) {
+		UITableCachedRow *slot = &table->cache[i & (table->cacheCount - 1)];
 
-			int size = scrollBar->horizontal ? UI_RECT_WIDTH(element->bounds) : UI_RECT_HEIGHT(element->bounds);
-			int thumbSize = size * scrollBar->page / scrollBar->maximum;
+		if (slot->generation == table->cacheGeneration && slot->index == i) {
+			i++;
+			continue;
+		}
 
-			if (thumbSize < UI_SIZE_SCROLL_MINIMUM_THUMB * element->window->scale) {
-				thumbSize = UI_SIZE_SCROLL_MINIMUM_THUMB * element->window->scale;
-			}
+		int end = i + 1;
 
-			if (scrollBar->position < 0) {
-				scrollBar->position = 0;
-			} else if (scrollBar->position > scrollBar->maximum - scrollBar->page) {
-				scrollBar->position = scrollBar->maximum - scrollBar->page;
+		for (; end < to; end++) {
+			UITableCachedRow *next = &table->cache[end & (table->cacheCount - 1)];
+			if (next->generation == table->cacheGeneration && next->index == end) break;
+		}
+
+		_UITableFetch(table, i, end, 0, table->columnCount);
+
+		for (int j = i, k = 0; j < end; j++) {
+			slot = &table->cache[j & (table->cacheCount - 1)];
+			size_t textBytes = 0;
+
+			if (slot->columns < table->columnCount) {
+				slot->columns = table->columnCount;
+				slot->bytes = (ptrdiff_t *) UI_REALLOC(slot->bytes, slot->columns * sizeof(ptrdiff_t));
 			}
 
-			int thumbPosition = scrollBar->position / (scrollBar->maximum - scrollBar->page) * (size - thumbSize);
+			for (int c = 0; c < table->columnCount; c++) {
+				ptrdiff_t bytes = table->fetchBytes[k + c];
+				if (bytes < 0) bytes = _UIStringLength(table->fetchStrings[k + c]);
+				slot->bytes[c] = bytes;
+				textBytes += bytes;
+			}
 
-			if (scrollBar->position == scrollBar->maximum - scrollBar->page) {
-				thumbPosition = size - thumbSize;
+			if (textBytes > slot->textAllocated) {
+				slot->textAllocated = textBytes * 2;
+				slot->text = (char *) UI_REALLOC(slot->text, slot->textAllocated);
 			}
 
-			if (scrollBar->horizontal) {
-				UIRectangle r = element->bounds;
-				r.r = r.l + thumbPosition;
-				UIElementMove(up, r, false);
-				r.l = r.r, r.r = r.l + thumbSize;
-				UIElementMove(thumb, r, false);
-				r.l = r.r, r.r = element->bounds.r;
-				UIElementMove(down, r, false);
-			} else {
-				UIRectangle r = element->bounds;
-				r.b = r.t + thumbPosition;
-				UIElementMove(up, r, false);
-				r.t = r.b, r.b = r.t + thumbSize;
-				UIElementMove(thumb, r, false);
-				r.t = r.b, r.b = element->bounds.b;
-				UIElementMove(down, r, false);
+			for (int c = 0, position = 0; c < table->columnCount; c++, k++) {
+				for (ptrdiff_t b = 0; b < slot->bytes[c]; b++) slot->text[position++] = table->fetchStrings[k][b];
 			}
+
+			slot->index = j;
+			slot->generation = table->cacheGeneration;
+			slot->isSelected = table->fetchSelected[j - i];
 		}
-	} else if (message == UI_MSG_PAINT) {
-		if (scrollBar->page >= scrollBar->maximum || scrollBar->maximum <= 0 || scrollBar->page <= 0) {
-			UIDrawBlock((UIPainter *) dp, element->bounds, ui.theme.panel1);
+
+		i = end;
+	}
+}
+
+void _UITableCacheShift(UITable *table, int row, int delta) {
+	// Rows from row on move by delta. For a removal, the rows [row, row - delta) are dropped.
+	// Cached rows are moved to their new slots, so the rows that stay on screen aren't fetched again.
+
+	int count = table->cacheCount;
+	if (!count) return;
+	UITableCachedRow *old = table->cache;
+	table->cache = (UITableCachedRow *) UI_CALLOC(count * sizeof(UITableCachedRow));
+
+	for (int i = 0; i < count; i++) {
+		int index = old[i].index;
+		if (old[i].generation != table->cacheGeneration) continue;
+
+		if (index >= row) {
+			if (index < row - delta) continue;
+			index += delta;
 		}
-	} else if (message == UI_MSG_MOUSE_WHEEL) {
-		scrollBar->position += di;
-		UIElementRefresh(element);
-		UIElementMessage(element->parent, UI_MSG_SCROLLED, 0, 0);
-		return 1;
+
+		UITableCachedRow *slot = &table->cache[index & (count - 1)];
+		if (slot->generation == table->cacheGeneration) continue;
+		*slot = old[i];
+		slot->index = index;
+		old[i].columns = -1; // Moved.
 	}
 
-	return 0;
+	// Give the buffers of the rows that weren't moved to the empty slots.
+
+	for (int i = 0, j = 0; i < count; i++) {
+		if (old[i].columns == -1) continue;
+		while (table->cache[j].generation == table->cacheGeneration) j++;
+		table->cache[j] = old[i];
+		table->cache[j++].generation = 0;
+	}
+
+	UI_FREE(old);
 }
 
-int _UIScrollUpDownMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UIScrollBar *scrollBar = (UIScrollBar *) element->parent;
-	bool isDown = element->cp;
+void _UITableRepaintRow(UITable *table, int index) {
+	if (index < 0) return;
+	UIRectangle row = table->e.bounds;
+	row.r -= UI_SIZE_SCROLL_BAR * table->e.window->scale;
+	row.t += UI_SIZE_TABLE_HEADER * table->e.window->scale + _UITableRowTop(table, index) - (int64_t) table->vScroll->position;
+	row.b = row.t + _UITableRowHeight(table, index);
+	UIElementRepaint(&table->e, &row);
+}
 
-	if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
-		uint32_t color = element == element->window->pressed ? ui.theme.buttonPressed 
-			: element == element->window->hovered ? ui.theme.buttonHovered : ui.theme.panel2;
-		UIDrawRectangle(painter, element->bounds, color, ui.theme.border, UI_RECT_1(0));
-		
-		if (scrollBar->horizontal) {
-			UIDrawGlyph(painter, isDown ? (element->bounds.r - ui.activeFont->glyphWidth - 2 * element->window->scale) 
-					: (element->bounds.l + 2 * element->window->scale), 
-				(element->bounds.t + element->bounds.b - ui.activeFont->glyphHeight) / 2,
-				isDown ? 26 : 27, ui.theme.text);
-		} else {
-			UIDrawGlyph(painter, (element->bounds.l + element->bounds.r - ui.activeFont->glyphWidth) / 2 + 1, 
-				isDown ? (element->bounds.b - ui.activeFont->glyphHeight - 2 * element->window->scale) 
-					: (element->bounds.t + 2 * element->window->scale), 
-				isDown ? 25 : 24, ui.theme.text);
-		}
-	} else if (message == UI_MSG_UPDATE) {
-		UIElementRepaint(element, NULL);
-	} else if (message == UI_MSG_LEFT_DOWN) {
-		UIElementAnimate(element, false);
-		scrollBar->lastAnimateTime = UI_CLOCK();
-	} else if (message == UI_MSG_LEFT_UP) {
-		UIElementAnimate(element, true);
-	} else if (message == UI_MSG_ANIMATE) {
-		UI_CLOCK_T previous = scrollBar->lastAnimateTime;
-		UI_CLOCK_T current = UI_CLOCK();
-		UI_CLOCK_T delta = current - previous;
-		double deltaSeconds = (double) delta / UI_CLOCKS_PER_SECOND;
-		if (deltaSeconds > 0.1) deltaSeconds = 0.1;
-		double deltaPixels = deltaSeconds * scrollBar->page * 3;
-		scrollBar->lastAnimateTime = current;
-		if (isDown) scrollBar->position += deltaPixels;
-		else scrollBar->position -= deltaPixels;
-		UIElementRefresh(&scrollBar->e);
-		UIElementMessage(scrollBar->e.parent, UI_MSG_SCROLLED, 0, 0);
+bool _UITableMeasureStep(UITable *table) {
+	// Widths only ever grow here, so columns don't jitter while the rest of the rows are measured.
+	uint64_t start = UIAnimateClock();
+	bool changed = false;
+
+	int rowCount = _UITableRowCount(table);
+
+	if (table->columnsMeasured > rowCount) {
+		table->columnsMeasured = rowCount;
 	}
 
-	return 0;
+	while (table->columnsMeasured < rowCount) {
+		int end = table->columnsMeasured + 64;
+		if (end > rowCount) end = rowCount;
+
+		if (_UITableMeasureRows(table, table->columnsMeasured, end)) changed = true;
+		table->columnsMeasured = end;
+		if (UIAnimateClock() - start >= _UI_TABLE_SIZE_BUDGET_MS) break;
+	}
+
+	return changed;
 }
 
-int _UIScrollThumbMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UIScrollBar *scrollBar = (UIScrollBar *) element->parent;
+void _UITableQueueSizing(UITable *table) {
+	if (table->sizingQueued || table->columnsMeasured == -1 || table->columnsMeasured >= _UITableRowCount(table)) return;
+	table->sizingQueued = true;
+	table->nextSizing = ui.sizingTables;
+	ui.sizingTables = table;
+}
 
-	if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
-		uint32_t color = element == element->window->pressed ? ui.theme.buttonPressed 
-			: element == element->window->hovered ? ui.theme.buttonHovered : ui.theme.buttonNormal;
-		UIDrawRectangle(painter, element->bounds, color, ui.theme.border, UI_RECT_1(2));
-	} else if (message == UI_MSG_UPDATE) {
-		UIElementRepaint(element, NULL);
-	} else if (message == UI_MSG_MOUSE_DRAG && element->window->pressedButton == 1) {
-		if (!scrollBar->inDrag) {
-			scrollBar->inDrag = true;
-			
-			if (scrollBar->horizontal) {
-				scrollBar->dragOffset = element->bounds.l - scrollBar->e.bounds.l - element->window->cursorX;
-			} else {
-				scrollBar->dragOffset = element->bounds.t - scrollBar->e.bounds.t - element->window->cursorY;
+void _UIProcessIdle() {
+	// Called by the message loop when there are no events waiting.
+	UITable **link = &ui.sizingTables;
+
+	while (*link) {
+		UITable *table = *link;
+
+		if (~table->e.flags & UI_ELEMENT_DESTROY) {
+			float previousScale = _UIFontScaleEnter(table->e.window);
+
+			if (table->columnsMeasured != -1 && _UITableMeasureStep(table)) {
+				_UITableColumnsChanged(table);
+				UIElementRefresh(&table->e);
 			}
+
+			_UIFontScaleLeave(previousScale);
 		}
 
-		int thumbPosition = (scrollBar->horizontal ? element->window->cursorX : element->window->cursorY) + scrollBar->dragOffset;
-		int size = scrollBar->horizontal ? (UI_RECT_WIDTH(scrollBar->e.bounds) - UI_RECT_WIDTH(element->bounds))
-				: (UI_RECT_HEIGHT(scrollBar->e.bounds) - UI_RECT_HEIGHT(element->bounds));
-		scrollBar->position = (double) thumbPosition / size * (scrollBar->maximum - scrollBar->page);
-		UIElementRefresh(&scrollBar->e);
-		UIElementMessage(scrollBar->e.parent, UI_MSG_SCROLLED, 0, 0);
-	} else if (message == UI_MSG_LEFT_UP) {
-		scrollBar->inDrag = false;
+		if (table->columnsMeasured == -1 || table->columnsMeasured >= _UITableRowCount(table)) {
+			table->sizingQueued = false;
+			*link = table->nextSizing;
+		} else {
+			link = &table->nextSizing;
+		}
 	}
 
-	return 0;
+	_UIUpdate();
 }
 
-UIScrollBar *UIScrollBarCreate(UIElement *parent, uint32_t flags) {
-	UIScrollBar *scrollBar = (UIScrollBar *) UIElementCreate(sizeof(UIScrollBar), parent, flags, _UIScrollBarMessage, "Scroll Bar");
-	bool horizontal = scrollBar->horizontal = flags & UI_SCROLL_BAR_HORIZONTAL;
-	UIElementCreate(sizeof(UIElement), &scrollBar->e, flags, _UIScrollUpDownMessage, !horizontal ? "Scroll Up" : "Scroll Left")->cp = (void *) (uintptr_t) 0;
-	UIElementCreate(sizeof(UIElement), &scrollBar->e, flags, _UIScrollThumbMessage, "Scroll Thumb");
-	UIElementCreate(sizeof(UIElement), &scrollBar->e, flags, _UIScrollUpDownMessage, !horizontal ? "Scroll Down" : "Scroll Right")->cp = (void *) (uintptr_t) 1;
-	return scrollBar;
-}
+void _UITableResizeColumns(UITable *table) {
+	int position = 0;
+	int count = 0;
 
-bool _UICharIsAlpha(char c) {
-	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
-}
+	while (true) {
+		int end = position;
+		for (; table->columns[end] != '\t' && table->columns[end]; end++);
+		count++;
+		if (table->columns[end] == '\t') position = end + 1;
+		else break;
+	}
 
-bool _UICharIsDigit(char c) {
-	return c >= '0' && c <= '9';
-}
+	UI_FREE(table->columnWidths);
+	table->columnWidths = (int *) UI_MALLOC(count * sizeof(int));
+	table->columnCount = count;
+	table->cacheGeneration++;
+
+	position = 0;
+
+	for (int i = 0; i < count; i++) {
+		int end = position;
+		for (; table->columns[end] != '\t' && table->columns[end]; end++);
+		table->columnWidths[i] = UIMeasureStringWidth(table->columns + position, end - position);
+		position = end + 1;
+	}
 
-bool _UICharIsAlphaOrDigitOrUnderscore(char c) {
-	return _UICharIsAlpha(c) || _UICharIsDigit(c) || c == '_';
-}
+	int rowCount = _UITableRowCount(table);
 
-int UICodeHitTest(UICode *code, int x, int y) {
-	x -= code->e.bounds.l;
+	if (rowCount <= _UI_TABLE_SIZE_ALL_ROWS) {
+		for (int i = 0; i < rowCount; i += 64) {
+			_UITableMeasureRows(table, i, i + 64);
+		}
 
-	if (x < 0 || x >= UI_RECT_WIDTH(code->e.bounds) - UI_SIZE_SCROLL_BAR * code->e.window->scale) {
-		return 0;
+		table->columnsMeasured = rowCount;
+		_UITableColumnsChanged(table);
+		return;
 	}
 
-	y -= code->e.bounds.t - code->vScroll->position;
+	// Large table: size from the visible rows and an even sample first, then measure the rest in idle time.
 
-	UIFont *previousFont = UIFontActivate(code->font);
-	int lineHeight = UIMeasureStringHeight();
-	bool inMargin = x < UI_SIZE_CODE_MARGIN + UI_SIZE_CODE_MARGIN_GAP / 2 && (~code->e.flags & UI_CODE_NO_MARGIN);
-	UIFontActivate(previousFont);
+	int first = _UITableRowAtOffset(table, table->vScroll->position);
+	int visible = _UITableRowAtOffset(table, table->vScroll->position + table->vScroll->page) - first + 1;
+	if (visible < 64) visible = 64;
 
-	if (y < 0 || y >= lineHeight * code->lineCount) {
-		return 0;
+	_UITableMeasureRows(table, first, first + visible);
+
+	for (int i = 0; i < _UI_TABLE_SIZE_SAMPLES; i++) {
+		int index = (int) ((int64_t) i * rowCount / _UI_TABLE_SIZE_SAMPLES);
+		_UITableMeasureRows(table, index, index + 1);
 	}
 
-	int line = y / lineHeight + 1;
-	return inMargin ? -line : line;
+	table->columnsMeasured = 0;
+	_UITableColumnsChanged(table);
+	_UITableQueueSizing(table);
 }
 
-int UIDrawStringHighlighted(UIPainter *painter, UIRectangle lineBounds, const char *string, ptrdiff_t bytes, int tabSize) {
-	if (bytes == -1) bytes = _UIStringLength(string);
-	if (bytes > 10000) bytes = 10000;
-
-	uint32_t colors[] = {
-		ui.theme.codeDefault,
-		ui.theme.codeComment,
-		ui.theme.codeString,
-		ui.theme.codeNumber,
-		ui.theme.codeOperator,
-		ui.theme.codePreprocessor,
-	};
+void UITableResizeColumns(UITable *table) {
+	float previousScale = _UIFontScaleEnter(table->e.window);
+	_UITableResizeColumns(table);
+	_UIFontScaleLeave(previousScale);
+}
 
-	int x = lineBounds.l;
-	int y = (lineBounds.t + lineBounds.b - UIMeasureStringHeight()) / 2;
-	int ti = 0;
-	int lexState = 0;
-	bool inComment = false, inIdentifier = false, inChar = false, startedString = false;
-	uint32_t last = 0;
+int _UITableMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	UITable *table = (UITable *) element;
 
-	while (bytes--) {
-		char c = *string++;
+	if (message == UI_MSG_PAINT) {
+		UIPainter *painter = (UIPainter *) dp;
+		UIRectangle bounds = element->bounds;
+		bounds.r -= UI_SIZE_SCROLL_BAR * element->window->scale;
+		bounds.b -= _UITableHScrollHeight(table);
+		UIDrawBlock(painter, bounds, ui.theme.panel2);
+		int lineHeight = UI_SIZE_TABLE_ROW * element->window->scale;
+		int rowsTop = bounds.t + UI_SIZE_TABLE_HEADER * table->e.window->scale;
+		int64_t scroll = table->vScroll->position;
+		int64_t left = bounds.l - (int64_t) table->hScroll->position;
+		int hovered = _UITableHitTestRow(table, element->window->cursorX, element->window->cursorY);
+		table->hovered = hovered;
 
-		last <<= 8;
-		last |= c;
+		// Only get the rows that intersect the clip; a hover change repaints just one or two rows.
+		// Likewise only the columns that intersect it are requested and drawn.
 
-		if (lexState == 4) {
-			lexState = 0;
-		} else if (lexState == 1) {
-			if ((last & 0xFF0000) == ('*' << 16) && (last & 0xFF00) == ('/' << 8) && inComment) {
-				lexState = 0, inComment = false;
-			}
-		} else if (lexState == 3) {
-			if (!_UICharIsAlpha(c) && !_UICharIsDigit(c)) {
-				lexState = 0;
-			}
-		} else if (lexState == 2) {
-			if (!startedString) {
-				if (!inChar && ((last >> 8) & 0xFF) == '"' && ((last >> 16) & 0xFF) != '\\') {
-					lexState = 0;
-				} else if (inChar && ((last >> 8) & 0xFF) == '\'' && ((last >> 16) & 0xFF) != '\\') {
-					lexState = 0;
-				}
-			}
+		int first = _UITableRowAtOffset(table, scroll), last = first;
 
-			startedString = false;
-		}
-
-		if (lexState == 0) {
-			if (c == '#') {
-				lexState = 5;
-			} else if (c == '/' && *string == '/') {
-				lexState = 1;
-			} else if (c == '/' && *string == '*') {
-				lexState = 1, inComment = true;
-			} else if (c == '"') {
-				lexState = 2;
-				inChar = false;
-				startedString = true;
-			} else if (c == '\'') {
-				lexState = 2;
-				inChar = true;
-				startedString = true;
-			} else if (_UICharIsDigit(c) && !inIdentifier) {
-				lexState = 3;
-			} else if (!_UICharIsAlpha(c) && !_UICharIsDigit(c)) {
-				lexState = 4;
-				inIdentifier = false;
-			} else {
-				inIdentifier = true;
-			}
+		if (painter->clip.b > rowsTop) {
+			if (painter->clip.t > rowsTop) first = _UITableRowAtOffset(table, painter->clip.t - rowsTop + scroll);
+			last = _UITableRowAtOffset(table, painter->clip.b - 1 - rowsTop + scroll) + 1;
 		}
 
-		if (c == '\t') {
-			x += ui.activeFont->glyphWidth, ti++;
-			while (ti % tabSize) x += ui.activeFont->glyphWidth, ti++;
-		} else {
-			UIDrawGlyph(painter, x, y, c, colors[lexState]);
-			x += ui.activeFont->glyphWidth, ti++;
-		}
-	}
+		if (last > _UITableRowCount(table)) last = _UITableRowCount(table);
+		int columnFirst = 0, columnLast = 0;
 
-	return x;
-}
+		if (table->columnCount) {
+			columnFirst = _UITableColumnAtOffset(table, painter->clip.l - left);
+			columnLast = _UITableColumnAtOffset(table, painter->clip.r - 1 - left) + 1;
+			if (columnFirst < 0) columnFirst = 0;
+		}
 
-int _UICodeMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UICode *code = (UICode *) element;
-	
-	if (message == UI_MSG_LAYOUT) {
-		UIFont *previousFont = UIFontActivate(code->font);
+		bool cached = element->flags & UI_TABLE_CACHE_CELLS;
 
-		if (code->moveScrollToFocusNextLayout) {
-			code->vScroll->position = (code->focused + 0.5) * UIMeasureStringHeight() - UI_RECT_HEIGHT(code->e.bounds) / 2;
+		if (first < last) {
+			if (cached) _UITableCacheRows(table, first, last);
+			else _UITableFetch(table, first, last, columnFirst, columnLast);
 		}
 
-		UIRectangle scrollBarBounds = element->bounds;
-		scrollBarBounds.l = scrollBarBounds.r - UI_SIZE_SCROLL_BAR * code->e.window->scale;
-		code->vScroll->maximum = code->lineCount * UIMeasureStringHeight();
-		code->vScroll->page = UI_RECT_HEIGHT(element->bounds);
-		UIFontActivate(previousFont);
-		UIElementMove(&code->vScroll->e, scrollBarBounds, true);
-	} else if (message == UI_MSG_PAINT) {
-		UIFont *previousFont = UIFontActivate(code->font);
+		UIRectangle row = bounds;
+		row.t = rowsTop + _UITableRowTop(table, first) - scroll;
 
-		UIPainter *painter = (UIPainter *) dp;
-		UIRectangle lineBounds = element->bounds;
-		lineBounds.r -= UI_SIZE_SCROLL_BAR * code->e.window->scale;
+		for (int i = first, k = 0; i < last; i++) {
+			row.b = rowsTop + _UITableRowTop(table, i + 1) - scroll;
+			UITableCachedRow *slot = cached ? &table->cache[i & (table->cacheCount - 1)] : NULL;
+			uint32_t textColor = ui.theme.text;
 
-		if (~code->e.flags & UI_CODE_NO_MARGIN) {
-			lineBounds.l += UI_SIZE_CODE_MARGIN + UI_SIZE_CODE_MARGIN_GAP;
-		}
+			bool selected = cached ? slot->isSelected : table->fetchSelected[i - first];
+			if (table->selectionCount && !selected) selected = UITableIsSelected(table, table->order ? table->rows[i] : i);
 
-		int lineHeight = UIMeasureStringHeight();
-		lineBounds.t -= (int64_t) code->vScroll->position % lineHeight;
+			if (selected) {
+				UIDrawBlock(painter, row, ui.theme.selected);
+				textColor = ui.theme.textSelected;
+			} else if (hovered == i) {
+				UIDrawBlock(painter, row, ui.theme.buttonHovered);
+			}
 
-		UIDrawBlock(painter, element->bounds, ui.theme.codeBackground);
+			UIRectangle cell = row;
+			const char *text = cached ? slot->text : NULL;
+			UIRectangle previousClip = painter->clip;
+			painter->clip = UIRectangleIntersection(previousClip, row);
 
-		for (int i = code->vScroll->position / lineHeight; i < code->lineCount; i++) {
-			if (lineBounds.t > element->clip.b) {
-				break;
+			if (cached) {
+				for (int j = 0; j < columnFirst; j++) text += slot->bytes[j];
 			}
 
-			lineBounds.b = lineBounds.t + lineHeight;
-
-			if (~code->e.flags & UI_CODE_NO_MARGIN) {
-				char string[16];
-				int p = 16;
-				int lineNumber = i + 1;
+			for (int j = columnFirst; j < columnLast; j++, k++) {
+				cell.l = left + table->columnOffsets[j];
+				cell.r = cell.l + table->columnWidths[j];
+				const char *string = cached ? text : table->fetchStrings[k];
+				ptrdiff_t bytes = cached ? slot->bytes[j] : table->fetchBytes[k];
+				if (cached) text += bytes;
 
-				while (lineNumber) {
-					string[--p] = (lineNumber % 10) + '0';
-					lineNumber /= 10;
+				if (row.b - row.t == lineHeight) {
+					UIDrawString(painter, cell, string, bytes, textColor, UI_ALIGN_LEFT, NULL);
+				} else {
+					// Taller rows show each line of the text in its own band.
+					UIRectangle line = cell;
+					line.b = line.t + lineHeight;
+					if (bytes < 0) bytes = _UIStringLength(string);
+
+					while (line.t < row.b) {
+						ptrdiff_t end = 0;
+						while (end < bytes && string[end] != '\n') end++;
+						UIDrawString(painter, line, string, end, textColor, UI_ALIGN_LEFT, NULL);
+						if (end == bytes) break;
+						string += end + 1, bytes -= end + 1;
+						line.t += lineHeight, line.b += lineHeight;
+					}
 				}
+			}
 
-				UIRectangle marginBounds = lineBounds;
-				marginBounds.r = marginBounds.l - UI_SIZE_CODE_MARGIN_GAP;
-				marginBounds.l -= UI_SIZE_CODE_MARGIN + UI_SIZE_CODE_MARGIN_GAP;
+			painter->clip = previousClip;
+			row.t = row.b;
+		}
+
+		UIRectangle header = bounds;
+		header.b = header.t + UI_SIZE_TABLE_HEADER * table->e.window->scale;
+		UIDrawRectangle(painter, header, ui.theme.panel1, ui.theme.border, UI_RECT_4(0, 0, 0, 1));
 
-				uint32_t marginColor = UIElementMessage(element, UI_MSG_CODE_GET_MARGIN_COLOR, i + 1, 0);
+		// The names are found from columns each time, since the application may have changed it.
+		const char *name = table->columns;
 
-				if (marginColor) {
-					UIDrawBlock(painter, marginBounds, marginColor);
-				}
+		for (int j = 0; j < columnLast; j++) {
+			const char *end = name;
+			while (*end && *end != '\t') end++;
 
-				UIDrawString(painter, marginBounds, string + p, 16 - p, ui.theme.codeDefault, UI_ALIGN_RIGHT, NULL);
+			if (j >= columnFirst) {
+				header.l = left + table->columnOffsets[j];
+				header.r = header.l + table->columnWidths[j];
+				UIDrawString(painter, header, name, end - name, ui.theme.text, UI_ALIGN_LEFT, NULL);
+				if (j == table->columnHighlight) UIDrawInvert(painter, header);
 			}
 
-			if (code->focused == i) {
-				UIDrawBlock(painter, lineBounds, ui.theme.codeFocused);
-			}
+			name = *end ? end + 1 : end;
+		}
 
-			int x = UIDrawStringHighlighted(painter, lineBounds, code->content + code->lines[i].offset, code->lines[i].bytes, code->tabSize);
-			int y = (lineBounds.t + lineBounds.b - UIMeasureStringHeight()) / 2;
+		if (_UITableHScrollHeight(table)) {
+			UIRectangle corner = element->bounds;
+			corner.l = bounds.r, corner.t = bounds.b;
+			UIDrawBlock(painter, corner, ui.theme.panel1);
+		}
+	} else if (message == UI_MSG_LAYOUT) {
+		_UITableModelSync(table);
+		if (table->columnCount) _UITableColumnsChanged(table);
+		int scrollBarSize = UI_SIZE_SCROLL_BAR * element->window->scale;
+		int64_t width = table->columnCount ? table->columnOffsets[table->columnCount] : 0;
+		bool horizontal = width > UI_RECT_WIDTH(element->bounds) - scrollBarSize;
+		if (horizontal) table->hScroll->e.flags &= ~UI_ELEMENT_HIDE;
+		else table->hScroll->e.flags |= UI_ELEMENT_HIDE, table->hScroll->position = 0;
 
-			UICodeDecorateLine m = { 0 };
-			m.x = x, m.y = y, m.bounds = lineBounds, m.index = i + 1, m.painter = painter;
-			UIElementMessage(element, UI_MSG_CODE_DECORATE_LINE, 0, &m);
+		UIRectangle scrollBarBounds = element->bounds;
+		scrollBarBounds.l = scrollBarBounds.r - scrollBarSize;
+		scrollBarBounds.b -= _UITableHScrollHeight(table);
+		table->vScroll->maximum = _UITableRowTop(table, _UITableRowCount(table));
+		table->vScroll->page = UI_RECT_HEIGHT(scrollBarBounds) - UI_SIZE_TABLE_HEADER * table->e.window->scale;
+		UIElementMove(&table->vScroll->e, scrollBarBounds, true);
+
+		scrollBarBounds = element->bounds;
+		scrollBarBounds.r -= scrollBarSize;
+		scrollBarBounds.t = scrollBarBounds.b - scrollBarSize;
+		table->hScroll->maximum = width;
+		table->hScroll->page = UI_RECT_WIDTH(scrollBarBounds);
+		UIElementMove(&table->hScroll->e, scrollBarBounds, true);
+
+		// New rows might have been added; keep measuring.
+		_UITableQueueSizing(table);
+	} else if (message == UI_MSG_MOUSE_MOVE || (message == UI_MSG_UPDATE && di == UI_UPDATE_HOVERED)) {
+		int hovered = _UITableHitTestRow(table, element->window->cursorX, element->window->cursorY);
 
-			lineBounds.t += lineHeight;
+		if (hovered != table->hovered) {
+			_UITableRepaintRow(table, table->hovered);
+			_UITableRepaintRow(table, hovered);
+			table->hovered = hovered;
+		}
+	} else if (message == UI_MSG_UPDATE) {
+		UIElementRepaint(element, NULL);
+	} else if (message == UI_MSG_LEFT_DOWN && (element->flags & UI_TABLE_SELECTION)) {
+		int row = _UITableHitTestRow(table, element->window->cursorX, element->window->cursorY);
+		if (row == -1) return 0;
+		int item = table->order ? table->rows[row] : row;
+		int anchor = table->selectionAnchor;
+		int anchorRow = !table->order ? anchor : anchor < table->modelItemCount ? table->rowOf[anchor] : -1;
+
+		if (element->window->shift && anchorRow >= 0 && anchorRow < _UITableRowCount(table)) {
+			_UITableSelectRows(table, anchorRow < row ? anchorRow : row, anchorRow < row ? row : anchorRow);
+		} else if (element->window->ctrl) {
+			UITableSelect(table, item, item + 1, !UITableIsSelected(table, item));
+			table->selectionAnchor = item;
+		} else {
+			UITableSelect(table, 0, 0x7FFFFFFF, false);
+			UITableSelect(table, item, item + 1, true);
+			table->selectionAnchor = item;
 		}
 
-		UIFontActivate(previousFont);
+		UIElementRepaint(element, NULL);
+		UIElementMessage(element, UI_MSG_VALUE_CHANGED, 0, 0);
 	} else if (message == UI_MSG_SCROLLED) {
-		code->moveScrollToFocusNextLayout = false;
 		UIElementRefresh(element);
 	} else if (message == UI_MSG_MOUSE_WHEEL) {
-		return UIElementMessage(&code->vScroll->e, message, di, dp);
-	} else if (message == UI_MSG_GET_CURSOR) {
-		if (UICodeHitTest(code, element->window->cursorX, element->window->cursorY) < 0) {
-			return UI_CURSOR_FLIPPED_ARROW;
-		}
+		UIScrollBar *scrollBar = element->window->shift && !(table->hScroll->e.flags & UI_ELEMENT_HIDE) ? table->hScroll : table->vScroll;
+		return UIElementMessage(&scrollBar->e, message, di, dp);
 	} else if (message == UI_MSG_DESTROY) {
-		UI_FREE(code->content);
-		UI_FREE(code->lines);
+		UI_FREE(table->columns);
+		UI_FREE(table->columnWidths);
+		UI_FREE(table->columnOffsets);
+		UI_FREE(table->selection);
+		UI_FREE(table->fetchArena);
+		UI_FREE(table->fetchLong);
+		UI_FREE(table->fetchStrings);
+		UI_FREE(table->fetchBytes);
+		UI_FREE(table->fetchSelected);
+
+		for (int i = 0; i < table->cacheCount; i++) {
+			UI_FREE(table->cache[i].bytes);
+			UI_FREE(table->cache[i].text);
+		}
+
+		UI_FREE(table->cache);
+		_UITableSortFree(table);
+		UI_FREE(table->order);
+		UI_FREE(table->rows);
+		UI_FREE(table->rowOf);
+		UI_FREE(table->hidden);
+		UI_FREE(table->sortKeys);
+		UI_FREE(table->itemHeights);
+		UI_FREE(table->heightTree);
+
+		if (table->sizingQueued) {
+			UITable **link = &ui.sizingTables;
+			while (*link != table) link = &(*link)->nextSizing;
+			*link = table->nextSizing;
+		}
 	}
 
 	return 0;
 }
 
-void UICodeFocusLine(UICode *code, int index) {
-	code->focused = index - 1;
-	code->moveScrollToFocusNextLayout = true;
+UITable *UITableCreate(UIElement *parent, uint32_t flags, const char *columns) {
+	UITable *table = (UITable *) UIElementCreate(sizeof(UITable), parent, flags, _UITableMessage, "Table");
+	table->vScroll = UIScrollBarCreate(&table->e, 0);
+	table->hScroll = UIScrollBarCreate(&table->e, UI_SCROLL_BAR_HORIZONTAL);
+	table->hScroll->e.flags |= UI_ELEMENT_HIDE;
+	table->columns = UIStringCopy(columns, -1);
+	table->columnHighlight = -1;
+	table->columnsMeasured = -1;
+	table->hovered = -1;
+	table->sortColumn = -1;
+	table->heightTreeCount = -1;
+	table->cacheGeneration = 1;
+	return table;
 }
 
-void UICodeInsertContent(UICode *code, const char *content, ptrdiff_t byteCount, bool replace) {
-	UIFont *previousFont = UIFontActivate(code->font);
-
-	if (byteCount == -1) {
-		byteCount = _UIStringLength(content);
-	}
+void UITableInvalidate(UITable *table) {
+	table->cacheGeneration++;
+	UIElementRepaint(&table->e, NULL);
+}
 
-	if (byteCount > 1000000000) {
-		byteCount = 1000000000;
-	}
+void _UITableChangeItems(UITable *table, int index, int delta) {
+	// Insert (delta > 0) or remove (delta < 0) items at index. Unless the view is at the top, the first visible row that stays
+	// is kept in the same place, and only the rows that moved on screen are repainted. The table isn't laid out again,
+	// so many changes made while handling one message are painted together.
 
-	if (replace) {
-		UI_FREE(code->content);
-		UI_FREE(code->lines);
-		code->content = NULL;
-		code->lines = NULL;
-		code->contentBytes = 0;
-		code->lineCount = 0;
-	}
+	_UITableSortFinish(table);
+	_UITableModelSync(table);
 
-	code->content = (char *) UI_REALLOC(code->content, code->contentBytes + byteCount);
+	int removeTo = delta < 0 ? index - delta : index;
+	int rowCount = _UITableRowCount(table);
+	int64_t position = table->vScroll->position;
+	int anchorRow = _UITableRowAtOffset(table, position), anchorItem = -1;
 
-	if (!byteCount) {
-		return;
+	for (; anchorRow < rowCount; anchorRow++) {
+		int item = table->order ? table->rows[anchorRow] : anchorRow;
+		if (item < index || item >= removeTo) { anchorItem = item; break; }
 	}
 
-	int lineCount = content[byteCount - 1] != '\n';
+	int64_t anchorOffset = position - _UITableRowTop(table, anchorRow);
 
-	for (int i = 0; i < byteCount; i++) {
-		code->content[i + code->contentBytes] = content[i];
+	// The rows of the removed items, before the change.
 
-		if (content[i] == '\n') {
-			lineCount++;
-		}
+	int firstChanged = 0x7FFFFFFF, lastChanged = -1, measuredRemoved = 0;
+
+	for (int i = index; i < removeTo; i++) {
+		int row = table->order ? table->rowOf[i] : i;
+		if (row == -1) continue;
+		if (row < firstChanged) firstChanged = row;
+		if (row > lastChanged) lastChanged = row;
+		if (row < table->columnsMeasured) measuredRemoved++;
 	}
 
-	code->lines = (UICodeLine *) UI_REALLOC(code->lines, sizeof(UICodeLine) * (code->lineCount + lineCount));
-	int offset = 0, lineIndex = 0;
+	bool changedAboveAnchor = anchorItem != -1 && firstChanged < anchorRow;
+	bool changedBelowAnchor = anchorItem == -1 || lastChanged > anchorRow;
 
-	for (intptr_t i = 0; i <= byteCount && lineIndex < lineCount; i++) {
-		if (content[i] == '\n' || i == byteCount) {
-			UICodeLine line = { 0 };
-			line.offset = offset + code->contentBytes;
-			line.bytes = i - offset;
-			code->lines[code->lineCount + lineIndex] = line;
-			lineIndex++;
-			offset = i + 1;
+	if (table->itemHeights && index < table->itemHeightsCount) {
+		if (delta > 0) {
+			table->itemHeights = (int *) UI_REALLOC(table->itemHeights, (table->itemHeightsCount + delta) * sizeof(int));
+			for (int i = table->itemHeightsCount - 1; i >= index; i--) table->itemHeights[i + delta] = table->itemHeights[i];
+			for (int i = index; i < index + delta; i++) table->itemHeights[i] = 0;
+			table->itemHeightsCount += delta;
+		} else {
+			int end = removeTo < table->itemHeightsCount ? removeTo : table->itemHeightsCount;
+			for (int i = end; i < table->itemHeightsCount; i++) table->itemHeights[i - (end - index)] = table->itemHeights[i];
+			table->itemHeightsCount -= end - index;
 		}
 	}
 
-	code->lineCount += lineCount;
-	code->contentBytes += byteCount;
+	if (index < table->itemCount) table->heightTreeCount = -1;
+	table->itemCount += delta;
 
-	if (!replace) {
-		code->vScroll->position = code->lineCount * UIMeasureStringHeight();
+	if (!table->order) {
+		_UITableCacheShift(table, index, delta);
+	} else if (delta > 0) {
+		_UITableModelInsert(table, index, index + delta);
+	} else {
+		_UITableModelRemove(table, index, removeTo);
 	}
 
-	UIFontActivate(previousFont);
-}
+	_UITableSelectionShift(table, index, delta);
+	if (table->selectionAnchor >= removeTo) table->selectionAnchor += delta;
+	else if (table->selectionAnchor >= index) table->selectionAnchor = index;
 
-UICode *UICodeCreate(UIElement *parent, uint32_t flags) {
-	UICode *code = (UICode *) UIElementCreate(sizeof(UICode), parent, flags, _UICodeMessage, "Code");
-	code->font = ui.activeFont;
-	code->vScroll = UIScrollBarCreate(&code->e, 0);
-	code->focused = -1;
-	code->tabSize = 4;
-	return code;
-}
+	if (anchorItem >= removeTo) anchorItem += delta;
+	int anchorRowNew = anchorItem == -1 ? -1 : table->order ? table->rowOf[anchorItem] : anchorItem;
+	bool widened = false;
 
-int _UIGaugeMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UIGauge *gauge = (UIGauge *) element;
+	if (delta > 0) {
+		// The rows of the inserted items. Rows only move down, so the column sizer only has to see the new ones.
 
-	if (message == UI_MSG_GET_HEIGHT) {
-		return UI_SIZE_GAUGE_HEIGHT * element->window->scale;
-	} else if (message == UI_MSG_GET_WIDTH) {
-		return UI_SIZE_GAUGE_WIDTH * element->window->scale;
-	} else if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
-		UIDrawRectangle(painter, element->bounds, ui.theme.buttonNormal, ui.theme.border, UI_RECT_1(1));
-		UIRectangle filled = UIRectangleAdd(element->bounds, UI_RECT_1I(1));
-		filled.r = filled.l + UI_RECT_WIDTH(filled) * gauge->position;
-		UIDrawBlock(painter, filled, ui.theme.selected);
-	}
+		for (int i = index; i < index + delta; i++) {
+			int row = table->order ? table->rowOf[i] : i;
+			if (row == -1) continue;
+			if (row < firstChanged) firstChanged = row;
+			if (row > lastChanged) lastChanged = row;
 
-	return 0;
-}
+			if (row < table->columnsMeasured && delta <= 64) {
+				if (_UITableMeasureRows(table, row, row + 1)) widened = true;
+			}
+		}
 
-UIGauge *UIGaugeCreate(UIElement *parent, uint32_t flags) {
-	return (UIGauge *) UIElementCreate(sizeof(UIGauge), parent, flags, _UIGaugeMessage, "Gauge");
-}
+		changedAboveAnchor = anchorItem != -1 && firstChanged < anchorRowNew;
+		changedBelowAnchor = anchorItem == -1 || lastChanged > anchorRowNew;
+		if (delta > 64 && firstChanged < table->columnsMeasured) table->columnsMeasured = firstChanged;
+	} else if (table->columnsMeasured != -1) {
+		table->columnsMeasured -= measuredRemoved;
+	}
 
-int _UISliderMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UISlider *slider = (UISlider *) element;
+	_UITableQueueSizing(table);
 
-	if (message == UI_MSG_GET_HEIGHT) {
-		return UI_SIZE_SLIDER_HEIGHT * element->window->scale;
-	} else if (message == UI_MSG_GET_WIDTH) {
-		return UI_SIZE_SLIDER_WIDTH * element->window->scale;
-	} else if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
-		UIRectangle bounds = element->bounds;
-		int centerY = (bounds.t + bounds.b) / 2;
-		int trackSize = UI_SIZE_SLIDER_TRACK * element->window->scale;
-		int thumbSize = UI_SIZE_SLIDER_THUMB * element->window->scale;
-		int thumbPosition = (UI_RECT_WIDTH(bounds) - thumbSize) * slider->position;
-		UIRectangle track = UI_RECT_4(bounds.l, bounds.r, centerY - (trackSize + 1) / 2, centerY + trackSize / 2);
-		UIDrawRectangle(painter, track, ui.theme.buttonNormal, ui.theme.border, UI_RECT_1(1));
-		bool pressed = element == element->window->pressed;
-		bool hovered = element == element->window->hovered;
-		bool disabled = element->flags & UI_ELEMENT_DISABLED;
-		uint32_t color = disabled ? ui.theme.buttonDisabled : pressed ? ui.theme.buttonPressed : hovered ? ui.theme.buttonHovered : ui.theme.buttonNormal;
-		UIRectangle thumb = UI_RECT_4(bounds.l + thumbPosition, bounds.l + thumbPosition + thumbSize, centerY - (thumbSize + 1) / 2, centerY + thumbSize / 2);
-		UIDrawRectangle(painter, thumb, color, ui.theme.border, UI_RECT_1(1));
-	} else if (message == UI_MSG_LEFT_DOWN || (message == UI_MSG_MOUSE_DRAG && element->window->pressedButton == 1)) {
-		UIRectangle bounds = element->bounds;
-		int thumbSize = UI_SIZE_SLIDER_THUMB * element->window->scale;
-		slider->position = (float) (element->window->cursorX - thumbSize / 2 - bounds.l) / (UI_RECT_WIDTH(bounds) - thumbSize);
-		if (slider->steps > 1) slider->position = (int) (slider->position * (slider->steps - 1) + 0.5f) / (float) (slider->steps - 1);
-		if (slider->position < 0) slider->position = 0;
-		if (slider->position > 1) slider->position = 1;
-		UIElementMessage(element, UI_MSG_VALUE_CHANGED, 0, 0);
-		UIElementRepaint(element, NULL);
-	} else if (message == UI_MSG_UPDATE) {
-		UIElementRepaint(element, NULL);
+	bool anchored = position > 0 && anchorItem != -1;
+	if (anchored) position = _UITableRowTop(table, anchorRowNew) + anchorOffset;
+
+	if (widened) {
+		table->vScroll->position = position;
+		_UITableColumnsChanged(table);
+		UIElementRefresh(&table->e);
+		return;
 	}
 
-	return 0;
-}
+	table->vScroll->maximum = _UITableRowTop(table, _UITableRowCount(table));
+	table->vScroll->position = position;
+	UIElementMessage(&table->vScroll->e, UI_MSG_LAYOUT, 0, 0);
+	UIElementRepaint(&table->vScroll->e, NULL);
 
-UISlider *UISliderCreate(UIElement *parent, uint32_t flags) {
-	return (UISlider *) UIElementCreate(sizeof(UISlider), parent, flags, _UISliderMessage, "Slider");
-}
+	if (table->vScroll->position != position) {
+		// The scroll position was clamped, so everything moved.
+		UIElementRepaint(&table->e, NULL);
+		return;
+	}
 
-int UITableHitTest(UITable *table, int x, int y) {
-	x -= table->e.bounds.l;
+	if (lastChanged == -1) return;
+	UIRectangle dirty = table->e.bounds;
+	dirty.r -= UI_SIZE_SCROLL_BAR * table->e.window->scale;
+	dirty.b -= _UITableHScrollHeight(table);
+	dirty.t += UI_SIZE_TABLE_HEADER * table->e.window->scale;
+	int64_t rowsTop = dirty.t - position;
 
-	if (x < 0 || x >= UI_RECT_WIDTH(table->e.bounds) - UI_SIZE_SCROLL_BAR * table->e.window->scale) {
-		return -1;
+	if (!anchored || !changedAboveAnchor) {
+		// Everything above the first change is where it was.
+		int64_t top = rowsTop + _UITableRowTop(table, firstChanged);
+		if (top > dirty.t) dirty.t = top > dirty.b ? dirty.b : top;
+	}
+
+	if (anchored && !changedBelowAnchor) {
+		// Everything from the anchor down is where it was.
+		int64_t bottom = rowsTop + _UITableRowTop(table, anchorRowNew);
+		if (bottom < dirty.b) dirty.b = bottom < dirty.t ? dirty.t : bottom;
 	}
 
-	y -= (table->e.bounds.t + UI_SIZE_TABLE_HEADER * table->e.window->scale) - table->vScroll->position;
+	if (UI_RECT_VALID(dirty)) UIElementRepaint(&table->e, &dirty);
+}
+
+void UITableInsertRows(UITable *table, int index, int count) {
+	if (index < 0 || index > table->itemCount || count <= 0) return;
+	float previousScale = _UIFontScaleEnter(table->e.window);
+	_UITableChangeItems(table, index, count);
+	_UIFontScaleLeave(previousScale);
+}
+
+void UITableRemoveRows(UITable *table, int index, int count) {
+	if (index < 0 || count <= 0) return;
+	if (count > table->itemCount - index) count = table->itemCount - index;
+	if (count <= 0) return;
+	float previousScale = _UIFontScaleEnter(table->e.window);
+	_UITableChangeItems(table, index, -count);
+	_UIFontScaleLeave(previousScale);
+}
 
-	int rowHeight = UI_SIZE_TABLE_ROW * table->e.window->scale;
+void _UITextboxMoveGap(UITextbox *textbox, ptrdiff_t position) {
+	// Only the text between the old and new positions of the gap is moved.
+	char *string = textbox->buffer;
+	ptrdiff_t gapBytes = textbox->gapBytes;
 
-	if (y < 0 || y >= rowHeight * table->itemCount) {
-		return -1;
+	if (position < textbox->gapStart) {
+		for (ptrdiff_t i = textbox->gapStart - 1; i >= position; i--) string[i + gapBytes] = string[i];
+	} else {
+		for (ptrdiff_t i = textbox->gapStart; i < position; i++) string[i] = string[i + gapBytes];
 	}
 
-	return y / rowHeight;
+	textbox->gapStart = position;
 }
 
-int UITableHeaderHitTest(UITable *table, int x, int y) {
-	if (!table->columnCount) return -1;
-	UIRectangle header = table->e.bounds;
-	header.b = header.t + UI_SIZE_TABLE_HEADER * table->e.window->scale;
-	header.l += UI_SIZE_TABLE_COLUMN_GAP * table->e.window->scale;
-	int position = 0, index = 0;
-
-	while (true) {
-		int end = position;
-		for (; table->columns[end] != '\t' && table->columns[end]; end++);
-		header.r = header.l + table->columnWidths[index];
-		if (UIRectangleContains(header, x, y)) return index;
-		header.l += table->columnWidths[index] + UI_SIZE_TABLE_COLUMN_GAP * table->e.window->scale;
-		if (table->columns[end] != '\t') break;
-		position = end + 1, index++;
-	}
+char _UITextboxCharacter(UITextbox *textbox, ptrdiff_t index) {
+	return textbox->buffer[index < textbox->gapStart ? index : index + textbox->gapBytes];
+}
 
-	return -1;
+void _UITextboxCopyText(UITextbox *textbox, ptrdiff_t from, ptrdiff_t to, char *buffer) {
+	ptrdiff_t split = to < textbox->gapStart ? to : from > textbox->gapStart ? from : textbox->gapStart;
+	for (ptrdiff_t i = from; i < split; i++) buffer[i - from] = textbox->buffer[i];
+	for (ptrdiff_t i = split; i < to; i++) buffer[i - from] = textbox->buffer[i + textbox->gapBytes];
 }
 
-bool UITableEnsureVisible(UITable *table, int index) {
-	int rowHeight = UI_SIZE_TABLE_ROW * table->e.window->scale;
-	int y = index * rowHeight;
-	y -= table->vScroll->position;
-	int height = UI_RECT_HEIGHT(table->e.bounds) - UI_SIZE_TABLE_HEADER * table->e.window->scale - rowHeight;
+char *UITextboxToCString(UITextbox *textbox) {
+	char *buffer = (char *) UI_MALLOC(textbox->bytes + 1);
+	_UITextboxCopyText(textbox, 0, textbox->bytes, buffer);
+	buffer[textbox->bytes] = 0;
+	return buffer;
+}
 
-	if (y < 0) {
-		table->vScroll->position += y;
-		UIElementRefresh(&table->e);
-		return true;
-	} else if (y > height) {
-		table->vScroll->position -= height - y;
-		UIElementRefresh(&table->e);
-		return true;
-	} else {
-		return false;
+void _UITextJournalReserve(UITextJournal *journal, size_t textBytes) {
+	if (journal->textBytes + textBytes > journal->textAllocated) {
+		journal->textAllocated = (journal->textBytes + textBytes) * 2;
+		journal->text = (char *) UI_REALLOC(journal->text, journal->textAllocated);
 	}
 }
 
-void UITableResizeColumns(UITable *table) {
-	int position = 0;
-	int count = 0;
+UITextJournalEntry *_UITextJournalRecord(UITextJournal *journal, ptrdiff_t position, ptrdiff_t bytes, bool deletion, bool joined) {
+	// Returns the new entry; the caller copies its text to journal->text + entry->text.
 
-	while (true) {
-		int end = position;
-		for (; table->columns[end] != '\t' && table->columns[end]; end++);
-		count++;
-		if (table->columns[end] == '\t') position = end + 1;
-		else break;
+	if (journal->entryCurrent < journal->entryCount) {
+		// Forget what could have been redone.
+		journal->textBytes = journal->entries[journal->entryCurrent].text;
+		journal->entryCount = journal->entryCurrent;
 	}
 
-	UI_FREE(table->columnWidths);
-	table->columnWidths = (int *) UI_MALLOC(count * sizeof(int));
-	table->columnCount = count;
+	if (journal->entryCount == journal->entriesAllocated) {
+		journal->entriesAllocated = journal->entriesAllocated * 2 + 16;
+		journal->entries = (UITextJournalEntry *) UI_REALLOC(journal->entries, journal->entriesAllocated * sizeof(UITextJournalEntry));
+	}
 
-	position = 0;
+	_UITextJournalReserve(journal, bytes);
+	UITextJournalEntry *entry = &journal->entries[journal->entryCount++];
+	entry->position = position, entry->bytes = bytes, entry->text = journal->textBytes;
+	entry->deletion = deletion, entry->joined = joined;
+	journal->textBytes += bytes;
+	journal->entryCurrent = journal->entryCount;
+	return entry;
+}
 
-	char buffer[256];
-	UITableGetItem m = { 0 };
-	m.buffer = buffer;
-	m.bufferBytes = sizeof(buffer);
+void _UITextJournalTrim(UITextJournal *journal) {
+	if (!journal->maximumBytes) return;
 
 	while (true) {
-		int end = position;
-		for (; table->columns[end] != '\t' && table->columns[end]; end++);
+		size_t used = journal->textBytes - journal->textFirst + (journal->entryCount - journal->entryFirst) * sizeof(UITextJournalEntry);
+		if (used <= journal->maximumBytes) break;
+		int end = journal->entryFirst + 1;
+		while (end < journal->entryCount && journal->entries[end].joined) end++;
+		if (end >= journal->entryCurrent) break;
+		journal->entryFirst = end;
+		journal->textFirst = journal->entries[end].text;
+	}
 
-		int longest = UIMeasureStringWidth(table->columns + position, end - position);
+	if (journal->entryFirst * 2 > journal->entryCount || journal->textFirst * 2 > journal->textBytes) {
+		// Most of the journal has been dropped, so move the rest back to the start.
 
-		for (int i = 0; i < table->itemCount; i++) {
-			m.index = i;
-			int bytes = UIElementMessage(&table->e, UI_MSG_TABLE_GET_ITEM, 0, &m);
-			int width = UIMeasureStringWidth(buffer, bytes);
+		for (int i = journal->entryFirst; i < journal->entryCount; i++) {
+			journal->entries[i - journal->entryFirst] = journal->entries[i];
+			journal->entries[i - journal->entryFirst].text -= journal->textFirst;
+		}
 
-			if (width > longest) {
-				longest = width;
-			}
+		for (size_t i = journal->textFirst; i < journal->textBytes; i++) {
+			journal->text[i - journal->textFirst] = journal->text[i];
 		}
 
-		table->columnWidths[m.column] = longest;
-		m.column++;
-		if (table->columns[end] == '\t') position = end + 1;
-		else break;
+		journal->entryCount -= journal->entryFirst;
+		journal->entryCurrent -= journal->entryFirst;
+		journal->textBytes -= journal->textFirst;
+		journal->entryFirst = 0;
+		journal->textFirst = 0;
 	}
 }
 
-int _UITableMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	UITable *table = (UITable *) element;
-
-	if (message == UI_MSG_PAINT) {
-		UIPainter *painter = (UIPainter *) dp;
-		UIRectangle bounds = element->bounds;
-		bounds.r -= UI_SIZE_SCROLL_BAR * element->window->scale;
-		UIDrawBlock(painter, bounds, ui.theme.panel2);
-		char buffer[256];
-		UIRectangle row = bounds;
-		int rowHeight = UI_SIZE_TABLE_ROW * element->window->scale;
-		UITableGetItem m = { 0 };
-		m.buffer = buffer;
-		m.bufferBytes = sizeof(buffer);
-		row.t += UI_SIZE_TABLE_HEADER * table->e.window->scale;
-		row.t -= (int64_t) table->vScroll->position % rowHeight;
-		int hovered = UITableHitTest(table, element->window->cursorX, element->window->cursorY);
-
-		for (int i = table->vScroll->position / rowHeight; i < table->itemCount; i++) {
-			if (row.t > element->clip.b) {
-				break;
-			}
-			
-			row.b = row.t + rowHeight;
-			m.index = i;
-			m.isSelected = false;
-			m.column = 0;
-			int bytes = UIElementMessage(element, UI_MSG_TABLE_GET_ITEM, 0, &m);
-			uint32_t textColor = ui.theme.text;
+void _UITextboxRecord(UITextbox *textbox, ptrdiff_t deleteFrom, ptrdiff_t deleteTo, const char *text, ptrdiff_t bytes) {
+	// Consecutive keystrokes extend the last entry, rather than adding a new one each.
 
-			if (m.isSelected) {
-				UIDrawBlock(painter, row, ui.theme.selected);
-				textColor = ui.theme.textSelected;
-			} else if (hovered == i) {
-				UIDrawBlock(painter, row, ui.theme.buttonHovered);
-			}
+	UITextJournal *journal = &textbox->journal;
+	bool small = deleteTo - deleteFrom + bytes <= 4;
+	UITextJournalEntry *last = journal->mergeable && small && journal->entryCurrent == journal->entryCount 
+		&& journal->entryCurrent > journal->entryFirst ? &journal->entries[journal->entryCurrent - 1] : NULL;
+	journal->mergeable = small;
 
-			UIRectangle cell = row;
-			cell.l += UI_SIZE_TABLE_COLUMN_GAP * table->e.window->scale;
+	if (last && deleteFrom == deleteTo && !last->deletion && last->position + last->bytes == deleteFrom) {
+		_UITextJournalReserve(journal, bytes);
+		for (ptrdiff_t i = 0; i < bytes; i++) journal->text[journal->textBytes + i] = text[i];
+		journal->textBytes += bytes, last->bytes += bytes;
+	} else if (last && !bytes && last->deletion && !last->joined && (deleteTo == last->position || deleteFrom == last->position)) {
+		ptrdiff_t deleted = deleteTo - deleteFrom;
+		_UITextJournalReserve(journal, deleted);
+		char *lastText = journal->text + last->text;
 
-			for (int j = 0; j < table->columnCount; j++) {
-				if (j) {
-					m.column = j;
-					bytes = UIElementMessage(element, UI_MSG_TABLE_GET_ITEM, 0, &m);
-				}
+		if (deleteTo == last->position) {
+			// Backspace; the deleted text goes before the rest.
+			for (ptrdiff_t i = last->bytes - 1; i >= 0; i--) lastText[i + deleted] = lastText[i];
+			_UITextboxCopyText(textbox, deleteFrom, deleteTo, lastText);
+			last->position = deleteFrom;
+		} else {
+			_UITextboxCopyText(textbox, deleteFrom, deleteTo, lastText + last->bytes);
+		}
 
-				cell.r = cell.l + table->columnWidths[j];
-				if ((size_t) bytes > m.bufferBytes && bytes > 0) bytes = m.bufferBytes;
-				UIDrawString(painter, cell, buffer, bytes, textColor, UI_ALIGN_LEFT, NULL);
-				cell.l += table->columnWidths[j] + UI_SIZE_TABLE_COLUMN_GAP * table->e.window->scale;
-			}
+		journal->textBytes += deleted, last->bytes += deleted;
+	} else {
+		if (deleteTo > deleteFrom) {
+			UITextJournalEntry *entry = _UITextJournalRecord(journal, deleteFrom, deleteTo - deleteFrom, true, false);
+			_UITextboxCopyText(textbox, deleteFrom, deleteTo, journal->text + entry->text);
+		}
 
-			row.t += rowHeight;
+		if (bytes) {
+			UITextJournalEntry *entry = _UITextJournalRecord(journal, deleteFrom, bytes, false, deleteTo > deleteFrom);
+			for (ptrdiff_t i = 0; i < bytes; i++) journal->text[entry->text + i] = text[i];
 		}
+	}
 
-		UIRectangle header = bounds;
-		header.b = header.t + UI_SIZE_TABLE_HEADER * table->e.window->scale;
-		UIDrawRectangle(painter, header, ui.theme.panel1, ui.theme.border, UI_RECT_4(0, 0, 0, 1));
-		header.l += UI_SIZE_TABLE_COLUMN_GAP * table->e.window->scale;
+	_UITextJournalTrim(journal);
+}
 
-		int position = 0;
-		int index = 0;
+void _UITextboxEdit(UITextbox *textbox, ptrdiff_t deleteFrom, ptrdiff_t deleteTo, const char *text, ptrdiff_t bytes) {
+	// Deleting widens the gap, and inserting fills it, so editing at the caret doesn't move the rest of the text.
 
-		if (table->columnCount) {
-			while (true) {
-				int end = position;
-				for (; table->columns[end] != '\t' && table->columns[end]; end++);
-
-				header.r = header.l + table->columnWidths[index];
-				UIDrawString(painter, header, table->columns + position, end - position, ui.theme.text, UI_ALIGN_LEFT, NULL);
-				if (index == table->columnHighlight) UIDrawInvert(painter, header);
-				header.l += table->columnWidths[index] + UI_SIZE_TABLE_COLUMN_GAP * table->e.window->scale;
-
-				if (table->columns[end] == '\t') {
-					position = end + 1;
-					index++;
-				} else {
-					break;
-				}
-			}
+	if (deleteFrom <= textbox->gapStart && textbox->gapStart <= deleteTo) {
+		// The deleted text is next to the gap, as when undoing a paste, so nothing has to move.
+		textbox->gapStart = deleteFrom;
+	} else {
+		_UITextboxMoveGap(textbox, deleteFrom);
+	}
+
+	textbox->gapBytes += deleteTo - deleteFrom;
+	textbox->bytes -= deleteTo - deleteFrom;
+
+	if (textbox->gapBytes < bytes) {
+		ptrdiff_t allocated = textbox->bytes + textbox->gapBytes;
+		ptrdiff_t newAllocated = (textbox->bytes + bytes) * 2 + 16;
+		ptrdiff_t after = textbox->bytes - textbox->gapStart;
+		textbox->buffer = (char *) UI_REALLOC(textbox->buffer, newAllocated);
+
+		for (ptrdiff_t i = after - 1; i >= 0; i--) {
+			textbox->buffer[newAllocated - after + i] = textbox->buffer[allocated - after + i];
 		}
-	} else if (message == UI_MSG_LAYOUT) {
-		UIRectangle scrollBarBounds = element->bounds;
-		scrollBarBounds.l = scrollBarBounds.r - UI_SIZE_SCROLL_BAR * element->window->scale;
-		table->vScroll->maximum = table->itemCount * UI_SIZE_TABLE_ROW * element->window->scale;
-		table->vScroll->page = UI_RECT_HEIGHT(element->bounds) - UI_SIZE_TABLE_HEADER * table->e.window->scale;
-		UIElementMove(&table->vScroll->e, scrollBarBounds, true);
-	} else if (message == UI_MSG_MOUSE_MOVE || message == UI_MSG_UPDATE) {
-		UIElementRepaint(element, NULL);
-	} else if (message == UI_MSG_SCROLLED) {
-		UIElementRefresh(element);
-	} else if (message == UI_MSG_MOUSE_WHEEL) {
-		return UIElementMessage(&table->vScroll->e, message, di, dp);
-	} else if (message == UI_MSG_DESTROY) {
-		UI_FREE(table->columns);
-		UI_FREE(table->columnWidths);
+
+		textbox->gapBytes = newAllocated - textbox->bytes;
 	}
 
-	return 0;
-}
+	for (ptrdiff_t i = 0; i < bytes; i++) {
+		textbox->buffer[textbox->gapStart + i] = text[i];
+	}
 
-UITable *UITableCreate(UIElement *parent, uint32_t flags, const char *columns) {
-	UITable *table = (UITable *) UIElementCreate(sizeof(UITable), parent, flags, _UITableMessage, "Table");
-	table->vScroll = UIScrollBarCreate(&table->e, 0);
-	table->columns = UIStringCopy(columns, -1);
-	table->columnHighlight = -1;
-	return table;
+	textbox->gapStart += bytes;
+	textbox->gapBytes -= bytes;
+	textbox->bytes += bytes;
 }
 
 void UITextboxReplace(UITextbox *textbox, const char *text, ptrdiff_t bytes, bool sendChangedMessage) {
@@ -2956,32 +6853,64 @@ void UITextboxReplace(UITextbox *textbox, const char *text, ptrdiff_t bytes, boo
 		UI_SWAP(int, deleteFrom, deleteTo);
 	}
 
-	for (int i = deleteTo; i < textbox->bytes; i++) {
-		textbox->string[i - deleteTo + deleteFrom] = textbox->string[i];
+	if (deleteFrom != deleteTo || bytes) {
+		_UITextboxRecord(textbox, deleteFrom, deleteTo, text, bytes);
 	}
 
-	textbox->bytes -= deleteTo - deleteFrom;
-	textbox->carets[0] = textbox->carets[1] = deleteFrom;
-
-	textbox->string = (char *) UI_REALLOC(textbox->string, textbox->bytes + bytes);
+	_UITextboxEdit(textbox, deleteFrom, deleteTo, text, bytes);
+	textbox->carets[0] = textbox->carets[1] = deleteFrom + bytes;
 
-	for (int i = textbox->bytes + bytes - 1; i >= textbox->carets[0] + bytes; i--) {
-		textbox->string[i] = textbox->string[i - bytes];
+	if (sendChangedMessage) {
+		UIElementMessage(&textbox->e, UI_MSG_VALUE_CHANGED, 0, 0);
 	}
 
-	for (int i = textbox->carets[0]; i < textbox->carets[0] + bytes; i++) {
-		textbox->string[i] = text[i - textbox->carets[0]];
-	}
+	textbox->e.window->textboxModifiedFlag = true;
+}
 
-	textbox->bytes += bytes;
-	textbox->carets[0] += bytes;
-	textbox->carets[1] = textbox->carets[0];
+bool UITextboxUndo(UITextbox *textbox) {
+	UITextJournal *journal = &textbox->journal;
+	if (journal->entryCurrent == journal->entryFirst) return false;
+	UITextJournalEntry *entry;
 
-	if (sendChangedMessage) {
-		UIElementMessage(&textbox->e, UI_MSG_VALUE_CHANGED, 0, 0);
-	}
+	do {
+		entry = &journal->entries[--journal->entryCurrent];
+
+		if (entry->deletion) {
+			// Put the text back, and select it.
+			_UITextboxEdit(textbox, entry->position, entry->position, journal->text + entry->text, entry->bytes);
+			textbox->carets[0] = entry->position + entry->bytes, textbox->carets[1] = entry->position;
+		} else {
+			_UITextboxEdit(textbox, entry->position, entry->position + entry->bytes, NULL, 0);
+			textbox->carets[0] = textbox->carets[1] = entry->position;
+		}
+	} while (entry->joined);
+
+	journal->mergeable = false;
+	UIElementMessage(&textbox->e, UI_MSG_VALUE_CHANGED, 0, 0);
+	textbox->e.window->textboxModifiedFlag = true;
+	return true;
+}
+
+bool UITextboxRedo(UITextbox *textbox) {
+	UITextJournal *journal = &textbox->journal;
+	if (journal->entryCurrent == journal->entryCount) return false;
+
+	do {
+		UITextJournalEntry *entry = &journal->entries[journal->entryCurrent++];
+
+		if (entry->deletion) {
+			_UITextboxEdit(textbox, entry->position, entry->position + entry->bytes, NULL, 0);
+			textbox->carets[0] = textbox->carets[1] = entry->position;
+		} else {
+			_UITextboxEdit(textbox, entry->position, entry->position, journal->text + entry->text, entry->bytes);
+			textbox->carets[0] = textbox->carets[1] = entry->position + entry->bytes;
+		}
+	} while (journal->entryCurrent < journal->entryCount && journal->entries[journal->entryCurrent].joined);
 
+	journal->mergeable = false;
+	UIElementMessage(&textbox->e, UI_MSG_VALUE_CHANGED, 0, 0);
 	textbox->e.window->textboxModifiedFlag = true;
+	return true;
 }
 
 void UITextboxClear(UITextbox *textbox, bool sendChangedMessage) {
@@ -3003,8 +6932,8 @@ void UITextboxMoveCaret(UITextbox *textbox, bool backward, bool word) {
 		if (!word) {
 			return;
 		} else if (textbox->carets[0] != textbox->bytes && textbox->carets[0] != 0) {
-			char c1 = textbox->string[textbox->carets[0] - 1];
-			char c2 = textbox->string[textbox->carets[0]];
+			char c1 = _UITextboxCharacter(textbox, textbox->carets[0] - 1);
+			char c2 = _UITextboxCharacter(textbox, textbox->carets[0]);
 
 			if (_UICharIsAlphaOrDigitOrUnderscore(c1) != _UICharIsAlphaOrDigitOrUnderscore(c2)) {
 				return;
@@ -3013,6 +6942,12 @@ void UITextboxMoveCaret(UITextbox *textbox, bool backward, bool word) {
 	}
 }
 
+int _UITextboxMeasure(UITextbox *textbox, ptrdiff_t to) {
+	// Tab stops and kerning depend on the text before, so the text is measured without the gap in it, as it's drawn.
+	_UITextboxMoveGap(textbox, textbox->bytes);
+	return UIMeasureStringWidth(textbox->buffer, to);
+}
+
 int _UITextboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
 	UITextbox *textbox = (UITextbox *) element;
 
@@ -3022,7 +6957,7 @@ int _UITextboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
 		return UI_SIZE_TEXTBOX_WIDTH * element->window->scale;
 	} else if (message == UI_MSG_PAINT) {
 		int scaledMargin = UI_SIZE_TEXTBOX_MARGIN * element->window->scale;
-		int totalWidth = UIMeasureStringWidth(textbox->string, textbox->bytes) + scaledMargin * 2;
+		int totalWidth = _UITextboxMeasure(textbox, textbox->bytes) + scaledMargin * 2;
 		UIRectangle textBounds = UIRectangleAdd(element->bounds, UI_RECT_1I(scaledMargin));
 
 		if (textbox->scroll > totalWidth - UI_RECT_WIDTH(textBounds)) {
@@ -3033,7 +6968,7 @@ int _UITextboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
 			textbox->scroll = 0;
 		}
 
-		int caretX = UIMeasureStringWidth(textbox->string, textbox->carets[0]) - textbox->scroll;
+		int caretX = _UITextboxMeasure(textbox, textbox->carets[0]) - textbox->scroll;
 
 		if (caretX < 0) {
 			textbox->scroll = caretX + textbox->scroll;
@@ -3057,7 +6992,11 @@ int _UITextboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
 		selection.colorBackground = ui.theme.selected;
 		selection.colorText = ui.theme.textSelected;
 		textBounds.l -= textbox->scroll;
-		UIDrawString(painter, textBounds, textbox->string, textbox->bytes, 
+
+		// Drawing is O(n) anyway, so the gap is moved to the end and the text is drawn in one piece;
+		// tab stops and kerning then carry across where the gap was.
+		_UITextboxMoveGap(textbox, textbox->bytes);
+		UIDrawString(painter, textBounds, textbox->buffer, textbox->bytes, 
 			disabled ? ui.theme.textDisabled : ui.theme.text, UI_ALIGN_LEFT, focused ? &selection : NULL);
 	} else if (message == UI_MSG_GET_CURSOR) {
 		return UI_CURSOR_TEXT;
@@ -3066,7 +7005,9 @@ int _UITextboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
 	} else if (message == UI_MSG_UPDATE) {
 		UIElementRepaint(element, NULL);
 	} else if (message == UI_MSG_DESTROY) {
-		UI_FREE(textbox->string);
+		UI_FREE(textbox->buffer);
+		UI_FREE(textbox->journal.entries);
+		UI_FREE(textbox->journal.text);
 	} else if (message == UI_MSG_KEY_TYPED) {
 		UIKeyTyped *m = (UIKeyTyped *) dp;
 		bool handled = true;
@@ -3099,6 +7040,11 @@ int _UITextboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
 		} else if (m->code == UI_KEYCODE_LETTER('A') && element->window->ctrl) {
 			textbox->carets[1] = 0;
 			textbox->carets[0] = textbox->bytes;
+		} else if (m->code == UI_KEYCODE_LETTER('Z') && element->window->ctrl && !element->window->alt && !element->window->shift) {
+			UITextboxUndo(textbox);
+		} else if (((m->code == UI_KEYCODE_LETTER('Z') && element->window->shift) || (m->code == UI_KEYCODE_LETTER('Y') && !element->window->shift)) 
+				&& element->window->ctrl && !element->window->alt) {
+			UITextboxRedo(textbox);
 		} else if (m->textBytes && !element->window->alt && !element->window->ctrl && m->text[0] >= 0x20) {
 			UITextboxReplace(textbox, m->text, m->textBytes, true);
 		} else if ((m->code == UI_KEYCODE_LETTER('C') || m->code == UI_KEYCODE_LETTER('X') || m->code == UI_KEYCODE_INSERT) 
@@ -3108,7 +7054,7 @@ int _UITextboxMessage(UIElement *element, UIMessage message, int di, void *dp) {
 
 			if (from != to) {
 				char *pasteText = (char *) UI_CALLOC(to - from + 1);
-				for (int i = from; i < to; i++) pasteText[i - from] = textbox->string[i];
+				_UITextboxCopyText(textbox, from, to, pasteText);
 				_UIClipboardWriteText(element->window, pasteText);
 			}
 			
@@ -3760,10 +7706,7 @@ int _UIDialogTextboxMessage(UIElement *element, UIMessage message, int di, void
 		char **buffer = (char **) element->cp;
 		*buffer = (char *) UI_REALLOC(*buffer, textbox->bytes + 1);
 		(*buffer)[textbox->bytes] = 0;
-
-		for (ptrdiff_t i = 0; i < textbox->bytes; i++) {
-			(*buffer)[i] = textbox->string[i];
-		}
+		_UITextboxCopyText(textbox, 0, textbox->bytes, *buffer);
 	}
 
 	return 0;
@@ -4387,19 +8330,77 @@ bool _UIWindowInputEvent(UIWindow *window, UIMessage message, int di, void *dp)
 	return handled;
 }
 
-UIFont *UIFontCreate(const char *cPath, uint32_t size) {
+UIFont *UIFontCreateWithWarmUp(const char *cPath, uint32_t size, const uint32_t *codePoints, size_t codePointCount) {
 	UIFont *font = (UIFont *) UI_CALLOC(sizeof(UIFont));
 
 #ifdef UI_FREETYPE
 	if (cPath) {
-		if (!FT_New_Face(ui.ft, cPath, 0, &font->font)) {
-			FT_Set_Char_Size(font->font, 0, size * 64, 100, 100);
+		font->path = UIStringCopy(cPath, -1);
+		font->size = size;
+
+#ifdef _UI_GLYPH_FILES
+		if (ui.glyphCacheDirectory) _UIFontMapGlyphFile(font);
+
+		if (font->glyphFile) {
+			// The face is only opened if a glyph or metric is missing from the file.
+			const _UIGlyphFileHeader *header = font->glyphFile;
+			const uint8_t *metrics = (const uint8_t *) header + header->metricsOffset;
+			font->glyphWidth = header->glyphWidth;
+			font->glyphHeight = header->glyphHeight;
+			font->proportional = header->flags & _UI_GLYPH_FILE_PROPORTIONAL;
+			for (uintptr_t i = 0; i < 128; i++) font->advances[i] = ((const int16_t *) metrics)[i];
+
+			if (header->flags & _UI_GLYPH_FILE_KERNING) {
+				font->kerning = (int8_t *) UI_MALLOC(128 * 128);
+				for (uintptr_t i = 0; i < 128 * 128; i++) font->kerning[i] = ((const int8_t *) (metrics + sizeof(font->advances)))[i];
+			}
+
+			font->isFreeType = true;
+		}
+#endif
+
+		if (!font->isFreeType && _UIFontOpenFace(font)) {
 			FT_Load_Char(font->font, 'a', FT_LOAD_DEFAULT);
 			font->glyphWidth = font->font->glyph->advance.x / 64;
 			font->glyphHeight = (font->font->size->metrics.ascender - font->font->size->metrics.descender) / 64;
+			for (uintptr_t i = 0; i < 128; i++) font->advances[i] = -1;
+			font->proportional = FT_HAS_KERNING(font->font);
+
+			// Not every monospaced font sets the fixed width flag, so check a few advances too.
+			for (uintptr_t i = 0; !FT_IS_FIXED_WIDTH(font->font) && !font->proportional && "iWm."[i]; i++) {
+				font->proportional = _UIFontAdvance(font, "iWm."[i]) != font->glyphWidth;
+			}
+
+			if (FT_HAS_KERNING(font->font)) {
+				font->kerning = (int8_t *) UI_MALLOC(128 * 128);
+				for (uintptr_t i = 0; i < 128 * 128; i++) font->kerning[i] = -128;
+			}
+
 			font->isFreeType = true;
+		}
+
+		if (font->isFreeType) {
+			font->next = ui.fonts;
+			ui.fonts = font;
+
+#ifdef _UI_THREADS
+			uint32_t *missing = (uint32_t *) UI_MALLOC(sizeof(uint32_t) * (codePointCount + 1));
+			size_t missingCount = 0;
+
+			for (uintptr_t i = 0; i < codePointCount; i++) {
+#ifdef _UI_GLYPH_FILES
+				if (_UIFontFindGlyphFileRecord(font, codePoints[i])) continue;
+#endif
+				missing[missingCount++] = codePoints[i];
+			}
+
+			if (missingCount) _UIFontWarmUpStart(font, cPath, missing, missingCount);
+			UI_FREE(missing);
+#endif
 			return font;
 		}
+
+		UI_FREE(font->path);
 	}
 #endif
 	
@@ -4408,18 +8409,89 @@ UIFont *UIFontCreate(const char *cPath, uint32_t size) {
 	return font;
 }
 
+UIFont *UIFontCreate(const char *cPath, uint32_t size) {
+	return UIFontCreateWithWarmUp(cPath, size, NULL, 0);
+}
+
+#ifdef UI_FREETYPE
+UIFont *_UIFontAtScale(UIFont *font, float scale) {
+	// Scaled copies are created the first time a window at that scale uses the font,
+	// and their glyphs are rendered as they are drawn.
+
+	if (!font || !font->isFreeType) {
+		return font;
+	}
+
+	UIFont *base = font->base ? font->base : font;
+	uint32_t size = scale > 0 ? (uint32_t) (base->size * scale + 0.5f) : 0;
+
+	if (!size || size == base->size) {
+		return base;
+	}
+
+	for (UIFont *scaled = base->scaled; scaled; scaled = scaled->scaledNext) {
+		if (scaled->size == size) {
+			return scaled;
+		}
+	}
+
+	UIFont *scaled = UIFontCreate(base->path, size);
+	scaled->size = size;
+	scaled->base = base;
+	scaled->scaledNext = base->scaled;
+	base->scaled = scaled;
+	return scaled;
+}
+
+void _UIFontSetScale(float scale) {
+	ui.fontScale = scale;
+	ui.activeFont = _UIFontAtScale(ui.activeFont, scale);
+}
+#endif
+
+float _UIFontScaleEnter(UIWindow *window) {
+	// Public functions that measure text can be called from outside a message handler,
+	// so they switch to the scale of their window themselves. Returns the previous scale.
+#ifdef UI_FREETYPE
+	float previousScale = ui.fontScale;
+	if (window && window->scale != previousScale) _UIFontSetScale(window->scale);
+	return previousScale;
+#else
+	(void) window;
+	return 1.0f;
+#endif
+}
+
+void _UIFontScaleLeave(float previousScale) {
+#ifdef UI_FREETYPE
+	if (previousScale != ui.fontScale) _UIFontSetScale(previousScale);
+#else
+	(void) previousScale;
+#endif
+}
+
 UIFont *UIFontActivate(UIFont *font) {
 	UIFont *previous = ui.activeFont;
+#ifdef UI_FREETYPE
+	ui.activeFont = _UIFontAtScale(font, ui.fontScale);
+	return previous && previous->base ? previous->base : previous;
+#else
 	ui.activeFont = font;
 	return previous;
+#endif
 }
 
 void _UIInitialiseCommon() {
 	ui.theme = _uiThemeDark;
+	ui.lexerC = UILexerCreate(UI_LEXER_C);
 
 #ifdef UI_FREETYPE
 	FT_Init_FreeType(&ui.ft);
-	UIFontActivate(UIFontCreate(_UI_TO_STRING_2(UI_FONT_PATH), 11));
+	ui.glyphCacheBudget = 4 * 1024 * 1024;
+	ui.fontScale = 1.0f;
+	uint32_t printable[95];
+	for (uintptr_t i = 0; i < 95; i++) printable[i] = ' ' + i;
+	UIFontActivate(UIFontCreateWithWarmUp(_UI_TO_STRING_2(UI_FONT_PATH), 11, printable, 95));
 #else
 	UIFontActivate(UIFontCreate(0, 0));
 #endif
@@ -4659,9 +8731,11 @@ bool UIAutomationCheckTableItemMatches(UITable *table, int row, int column, cons
 	m.column = column;
 	m.index = row;
 	int length = UIElementMessage(&table->e, UI_MSG_TABLE_GET_ITEM, 0, &m);
-	if (length != bytes) return false;
-	for (int i = 0; input[i]; i++) if (buffer[i] != input[i]) return false;
-	return true;
+	const char *string = m.string ? m.string : buffer;
+	bool matches = length == bytes;
+	for (int i = 0; matches && input[i]; i++) if (string[i] != input[i]) matches = false;
+	UI_FREE(buffer);
+	return matches;
 }
 
 #endif
@@ -4674,6 +8748,9 @@ int UIMessageLoop() {
 #else
 	int result = 0;
 	while (!ui.quit && _UIMessageLoopSingle(&result)) ui.dialogResult = NULL;
+#ifdef UI_FREETYPE
+	UIGlyphCacheSave();
+#endif
 	return result;
 #endif
 }
@@ -4871,7 +8948,40 @@ void _UIClipboardReadTextEnd(UIWindow *window, char *text) {
 	}
 }
 
+typedef struct _UIX11PostedMessage {
+	struct _UIX11PostedMessage *next;
+	Window window;
+	UIMessage message;
+	void *dp;
+} _UIX11PostedMessage;
+
+void _UIX11PostDispatch(UIEpollDispatchPtr *ptr) {
+	uint64_t count;
+	if (read(ui.postFD, &count, sizeof(count)) != sizeof(count)) return;
+
+	pthread_mutex_lock(&ui.postMutex);
+	_UIX11PostedMessage *posted = ui.postedFirst;
+	ui.postedFirst = ui.postedLast = NULL;
+	pthread_mutex_unlock(&ui.postMutex);
+
+	while (posted) {
+		// The window might have been destroyed since the message was posted.
+		UIWindow *window = posted->window ? _UIFindWindow(posted->window) : NULL;
+		if (window || !posted->window) _UIWindowReceivePosted(window, posted->message, posted->dp);
+		_UIX11PostedMessage *next = posted->next;
+		UI_FREE(posted);
+		posted = next;
+	}
+}
+
 void UIInitialise() {
+	// The post queue is set up first, since _UIInitialiseCommon can start worker threads that post to it.
+	ui.epollFD = epoll_create1(EPOLL_CLOEXEC);
+	pthread_mutex_init(&ui.postMutex, NULL);
+	ui.postFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ui.postDispatch.fp = _UIX11PostDispatch;
+	UIEpollAdd(ui.postFD, &ui.postDispatch);
+
 	_UIInitialiseCommon();
 
 	XInitThreads();
@@ -4921,6 +9031,11 @@ void UIInitialise() {
 		XSetLocaleModifiers("@im=none");
 		ui.xim = XOpenIM(ui.display, 0, 0, 0);
 	}
+
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.ptr = &ui.display;
+	epoll_ctl(ui.epollFD, EPOLL_CTL_ADD, ConnectionNumber(ui.display), &event);
 }
 
 void _UIWindowSetCursor(UIWindow *window, int cursor) {
@@ -5066,55 +9181,46 @@ bool _UIProcessEvent(XEvent *event) {
 		UIWindow *window = _UIFindWindow(event->xkey.window);
 		if (!window) return false;
 
-		if (event->xkey.x == 0x7123 && event->xkey.y == 0x7456) {
-			// HACK! See UIWindowPostMessage.
-			UIElementMessage(&window->e, (UIMessage) event->xkey.state, 0, 
-				(void *) (((uintptr_t) (event->xkey.time & 0xFFFFFFFF) << 32) 
-					| ((uintptr_t) (event->xkey.x_root & 0xFFFF) << 0) 
-					| ((uintptr_t) (event->xkey.y_root & 0xFFFF) << 16)));
-			_UIUpdate();
-		} else {
-			char text[32];
-			KeySym symbol = NoSymbol;
-			Status status;
-			// printf("%ld, %s\n", symbol, text);
-			UIKeyTyped m = { 0 };
-			m.textBytes = Xutf8LookupString(window->xic, &event->xkey, text, sizeof(text) - 1, &symbol, &status); 
-			m.text = text;
-			m.code = XLookupKeysym(&event->xkey, 0);
-
-			if (symbol == XK_Control_L || symbol == XK_Control_R) {
-				window->ctrl = true;
-				window->ctrlCode = event->xkey.keycode;
-				_UIWindowInputEvent(window, UI_MSG_MOUSE_MOVE, 0, 0);
-			} else if (symbol == XK_Shift_L || symbol == XK_Shift_R) {
-				window->shift = true;
-				window->shiftCode = event->xkey.keycode;
-				_UIWindowInputEvent(window, UI_MSG_MOUSE_MOVE, 0, 0);
-			} else if (symbol == XK_Alt_L || symbol == XK_Alt_R) {
-				window->alt = true;
-				window->altCode = event->xkey.keycode;
-				_UIWindowInputEvent(window, UI_MSG_MOUSE_MOVE, 0, 0);
-			} else if (symbol == XK_KP_Left) {
-				m.code = UI_KEYCODE_LEFT;
-			} else if (symbol == XK_KP_Right) {
-				m.code = UI_KEYCODE_RIGHT;
-			} else if (symbol == XK_KP_Up) {
-				m.code = UI_KEYCODE_UP;
-			} else if (symbol == XK_KP_Down) {
-				m.code = UI_KEYCODE_DOWN;
-			} else if (symbol == XK_KP_Home) {
-				m.code = UI_KEYCODE_HOME;
-			} else if (symbol == XK_KP_End) {
-				m.code = UI_KEYCODE_END;
-			} else if (symbol == XK_KP_Enter) {
-				m.code = UI_KEYCODE_ENTER;
-			} else if (symbol == XK_KP_Delete) {
-				m.code = UI_KEYCODE_DELETE;
-			}
+		char text[32];
+		KeySym symbol = NoSymbol;
+		Status status;
+		// printf("%ld, %s\n", symbol, text);
+		UIKeyTyped m = { 0 };
+		m.textBytes = Xutf8LookupString(window->xic, &event->xkey, text, sizeof(text) - 1, &symbol, &status); 
+		m.text = text;
+		m.code = XLookupKeysym(&event->xkey, 0);
 
-			_UIWindowInputEvent(window, UI_MSG_KEY_TYPED, 0, &m);
+		if (symbol == XK_Control_L || symbol == XK_Control_R) {
+			window->ctrl = true;
+			window->ctrlCode = event->xkey.keycode;
+			_UIWindowInputEvent(window, UI_MSG_MOUSE_MOVE, 0, 0);
+		} else if (symbol == XK_Shift_L || symbol == XK_Shift_R) {
+			window->shift = true;
+			window->shiftCode = event->xkey.keycode;
+			_UIWindowInputEvent(window, UI_MSG_MOUSE_MOVE, 0, 0);
+		} else if (symbol == XK_Alt_L || symbol == XK_Alt_R) {
+			window->alt = true;
+			window->altCode = event->xkey.keycode;
+			_UIWindowInputEvent(window, UI_MSG_MOUSE_MOVE, 0, 0);
+		} else if (symbol == XK_KP_Left) {
+			m.code = UI_KEYCODE_LEFT;
+		} else if (symbol == XK_KP_Right) {
+			m.code = UI_KEYCODE_RIGHT;
+		} else if (symbol == XK_KP_Up) {
+			m.code = UI_KEYCODE_UP;
+		} else if (symbol == XK_KP_Down) {
+			m.code = UI_KEYCODE_DOWN;
+		} else if (symbol == XK_KP_Home) {
+			m.code = UI_KEYCODE_HOME;
+		} else if (symbol == XK_KP_End) {
+			m.code = UI_KEYCODE_END;
+		} else if (symbol == XK_KP_Enter) {
+			m.code = UI_KEYCODE_ENTER;
+		} else if (symbol == XK_KP_Delete) {
+			m.code = UI_KEYCODE_DELETE;
 		}
+
+		_UIWindowInputEvent(window, UI_MSG_KEY_TYPED, 0, &m);
 	} else if (event->type == KeyRelease) {
 		UIWindow *window = _UIFindWindow(event->xkey.window);
 		if (!window) return false;
@@ -5289,15 +9395,26 @@ bool _UIProcessEvent(XEvent *event) {
 bool _UIMessageLoopSingle(int *result) {
 	XEvent events[64];
 
-	if (ui.animating) {
-		if (XPending(ui.display)) {
+	if (XPending(ui.display)) {
+		XNextEvent(ui.display, events + 0);
+	} else {
+		// Wait for the X connection, a watched file descriptor or a timer.
+		// Only one event is taken at a time, since a callback may remove other watchers.
+		struct epoll_event event;
+		int count = epoll_wait(ui.epollFD, &event, 1, ui.animating || ui.sizingTables ? 0 : -1);
+
+		if (count == 1 && event.data.ptr != &ui.display) {
+			UIEpollDispatchPtr *ptr = (UIEpollDispatchPtr *) event.data.ptr;
+			ptr->fp(ptr);
+			_UIUpdate();
+			return true;
+		} else if (count == 1 && XPending(ui.display)) {
 			XNextEvent(ui.display, events + 0);
 		} else {
-			_UIProcessAnimations();
+			if (ui.animating) _UIProcessAnimations();
+			if (ui.sizingTables) _UIProcessIdle();
 			return true;
 		}
-	} else {
-		XNextEvent(ui.display, events + 0);
 	}
 
 	int p = 1;
@@ -5333,27 +9450,75 @@ bool _UIMessageLoopSingle(int *result) {
 	return true;
 }
 
-void UIWindowPostMessage(UIWindow *window, UIMessage message, void *_dp) {
-	// HACK! Xlib doesn't seem to have a nice way to do this,
-	// so send a specially crafted key press event instead.
-	// TODO Maybe ClientMessage is what this should use?
-	uintptr_t dp = (uintptr_t) _dp;
-	XKeyEvent event = { 0 };
-	event.display = ui.display;
-	event.window = window->window;
-	event.root = DefaultRootWindow(ui.display);
-	event.subwindow = None;
-	event.time = dp >> 32;
-	event.x = 0x7123;
-	event.y = 0x7456;
-	event.x_root = (dp >> 0) & 0xFFFF;
-	event.y_root = (dp >> 16) & 0xFFFF;
-	event.same_screen = True;
-	event.keycode = 1;
-	event.state = message;
-	event.type = KeyPress;
-	XSendEvent(ui.display, window->window, True, KeyPressMask, (XEvent *) &event);
-	XFlush(ui.display);
+void UIEpollAdd(int fd, UIEpollDispatchPtr *ptr) {
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.ptr = ptr;
+	bool success = 0 == epoll_ctl(ui.epollFD, EPOLL_CTL_ADD, fd, &event);
+	UI_ASSERT(success);
+	(void) success;
+}
+
+void UIEpollRemove(int fd) {
+	bool success = 0 == epoll_ctl(ui.epollFD, EPOLL_CTL_DEL, fd, NULL);
+	UI_ASSERT(success);
+	(void) success;
+}
+
+void _UITimerDispatch(UIEpollDispatchPtr *ptr) {
+	UITimer *timer = (UITimer *) ((uint8_t *) ptr - offsetof(UITimer, dispatch));
+	uint64_t expirations; // Periods missed while the loop was busy are merged into one call.
+
+	if (read(timer->fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+		timer->invoke(timer->cp);
+	}
+}
+
+void UITimerSet(UITimer *timer, uint32_t milliseconds, bool periodic) {
+	struct itimerspec specification;
+	specification.it_value.tv_sec = milliseconds / 1000;
+	specification.it_value.tv_nsec = (milliseconds % 1000) * 1000000;
+	specification.it_interval.tv_sec = periodic ? specification.it_value.tv_sec : 0;
+	specification.it_interval.tv_nsec = periodic ? specification.it_value.tv_nsec : 0;
+	timerfd_settime(timer->fd, 0, &specification, NULL);
+}
+
+UITimer *UITimerCreate(uint32_t milliseconds, bool periodic, void (*invoke)(void *cp), void *cp) {
+	UITimer *timer = (UITimer *) UI_CALLOC(sizeof(UITimer));
+	timer->invoke = invoke;
+	timer->cp = cp;
+	timer->dispatch.fp = _UITimerDispatch;
+	timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	UI_ASSERT(timer->fd != -1);
+	UIEpollAdd(timer->fd, &timer->dispatch);
+	UITimerSet(timer, milliseconds, periodic);
+	return timer;
+}
+
+void UITimerDestroy(UITimer *timer) {
+	UIEpollRemove(timer->fd);
+	close(timer->fd);
+	UI_FREE(timer);
+}
+
+void UIWindowPostMessage(UIWindow *window, UIMessage message, void *dp) {
+	// Xlib isn't used here, since flushing the connection from another thread can read X events
+	// into Xlib's queue after the message loop checked it, and before it waits on epoll.
+	_UIX11PostedMessage *posted = (_UIX11PostedMessage *) UI_MALLOC(sizeof(_UIX11PostedMessage));
+	posted->next = NULL;
+	posted->window = window ? window->window : 0;
+	posted->message = message;
+	posted->dp = dp;
+
+	pthread_mutex_lock(&ui.postMutex);
+	if (ui.postedLast) ui.postedLast->next = posted;
+	else ui.postedFirst = posted;
+	ui.postedLast = posted;
+	pthread_mutex_unlock(&ui.postMutex);
+
+	uint64_t one = 1;
+	ssize_t written = write(ui.postFD, &one, sizeof(one));
+	(void) written;
 }
 
 #endif
@@ -5512,7 +9677,7 @@ LRESULT CALLBACK _UIWindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPAR
 		DragFinish(drop);
 		_UIUpdate();
 	} else if (message == WM_APP + 1) {
-		UIElementMessage(&window->e, (UIMessage) wParam, 0, (void *) lParam);
+		_UIWindowReceivePosted(window, (UIMessage) wParam, (void *) lParam);
 		_UIUpdate();
 	} else {
 		if (message == WM_NCLBUTTONDOWN || message == WM_NCMBUTTONDOWN || message == WM_NCRBUTTONDOWN) {
@@ -5530,6 +9695,7 @@ LRESULT CALLBACK _UIWindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPAR
 
 void UIInitialise() {
 	ui.heap = GetProcessHeap();
+	ui.threadID = GetCurrentThreadId();
 	
 	_UIInitialiseCommon();
 
@@ -5561,24 +9727,27 @@ void UIInitialise() {
 bool _UIMessageLoopSingle(int *result) {
 	MSG message = { 0 };
 
-	if (ui.animating) {
-		if (PeekMessage(&message, NULL, 0, 0, PM_REMOVE)) {
-			if (message.message == WM_QUIT) {
-				*result = message.wParam;
-				return false;
-			}
-
-			TranslateMessage(&message);
-			DispatchMessage(&message);
-		} else {
-			_UIProcessAnimations();
+	if (ui.animating || ui.sizingTables) {
+		if (!PeekMessage(&message, NULL, 0, 0, PM_REMOVE)) {
+			if (ui.animating) _UIProcessAnimations();
+			if (ui.sizingTables) _UIProcessIdle();
+			return true;
 		}
-	} else {
-		if (!GetMessage(&message, NULL, 0, 0)) {
+
+		if (message.message == WM_QUIT) {
 			*result = message.wParam;
 			return false;
 		}
+	} else if (!GetMessage(&message, NULL, 0, 0)) {
+		*result = message.wParam;
+		return false;
+	}
 
+	if (!message.hwnd && message.message == WM_APP + 1) {
+		// Posted to the thread by UIWindowPostMessage without a window.
+		_UIWindowReceivePosted(NULL, (UIMessage) message.wParam, (void *) message.lParam);
+		_UIUpdate();
+	} else {
 		TranslateMessage(&message);
 		DispatchMessage(&message);
 	}
@@ -5649,7 +9818,8 @@ void _UIWindowGetScreenPosition(UIWindow *window, int *_x, int *_y) {
 }
 
 void UIWindowPostMessage(UIWindow *window, UIMessage message, void *_dp) {
-	PostMessage(window->hwnd, WM_APP + 1, (WPARAM) message, (LPARAM) _dp);
+	if (window) PostMessage(window->hwnd, WM_APP + 1, (WPARAM) message, (LPARAM) _dp);
+	else PostThreadMessage(ui.threadID, WM_APP + 1, (WPARAM) message, (LPARAM) _dp);
 }
 
 void *_UIHeapReAlloc(void *pointer, size_t size) {
@@ -5838,7 +10008,7 @@ int _UIWindowCanvasMessage(EsElement *element, EsMessage *message) {
 	} else if (message->type == ES_MSG_MOUSE_LEFT_CLICK) {
 		_UIInspectorSetFocusedWindow(window);
 	} else if (message->type == ES_MSG_USER_START) {
-		UIElementMessage(&window->e, (UIMessage) message->user.context1.u, 0, (void *) message->user.context2.p);
+		_UIWindowReceivePosted(window, (UIMessage) message->user.context1.u, (void *) message->user.context2.p);
 		_UIUpdate();
 	} else if (message->type == ES_MSG_GET_CURSOR) {
 		message->cursorStyle = ES_CURSOR_NORMAL;
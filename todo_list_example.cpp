@@ -131,7 +131,9 @@ int InputTextboxMessage(UIElement *element, UIMessage message, int di, void *dp)
 		items[itemCount].textBytes = inputTextbox->bytes;
 		items[itemCount].text = (char *) malloc(inputTextbox->bytes);
 		items[itemCount].completed = false;
-		memcpy(items[itemCount].text, inputTextbox->string, inputTextbox->bytes);
+		char *text = UITextboxToCString(inputTextbox);
+		memcpy(items[itemCount].text, text, inputTextbox->bytes);
+		UI_FREE(text);
 		UITextboxClear(inputTextbox, false);
 		UIElementRefresh(&inputTextbox->e);
 		
@@ -44,10 +44,11 @@ void Calculate() {
 		UILabelSetContent(output, "Enter value to convert.", -1);
 	} else {
 		char buffer[64];
-		snprintf(buffer, sizeof(buffer), "%.*s", (int) input->bytes, input->string);
+		char *string = UITextboxToCString(input);
 		Unit *unitFrom = &categories[category].units[from];
 		Unit *unitTo = &categories[category].units[to];
-		double x = (strtod(buffer, NULL) - unitFrom->bias) * unitFrom->ratio / unitTo->ratio + unitTo->bias;
+		double x = (strtod(string, NULL) - unitFrom->bias) * unitFrom->ratio / unitTo->ratio + unitTo->bias;
+		UI_FREE(string);
 		snprintf(buffer, sizeof(buffer), "%f %s", x, unitTo->name);
 		UILabelSetContent(output, buffer, -1);
 	}